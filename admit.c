@@ -0,0 +1,409 @@
+/**
+ * Linux Job Control Shell Project
+ * admit module: admission control for background launches
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Background launches (&, bgteam and inmortal relaunches) go through
+ * admit_hold(). While a limit is exceeded they wait in a FIFO queue that is
+ * checked when a job ends and every ADMIT_TICK_MS from a timerfd. Pressure
+ * averages lag behind new launches, so with a pressure limit set only one
+ * queued job is released per check.
+ *
+ * With "admit longest" the queue is no longer FIFO: the job expected to run
+ * longest (jobprof) goes first, and jobs never seen before go ahead of
+ * them. On several cores the long ones then overlap with the rest of the
+ * batch instead of being left alone at its end. The expected time is taken
+ * once when a job is queued and the queue is kept in release order, so a
+ * release only takes the head.
+ **/
+#include "admit.h"
+#include "event_loop.h"
+#include "jobprof.h"
+#include "jobsched.h"
+#include "notify.h"
+#include "shell.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/timerfd.h>
+
+enum pressure_file { PRESSURE_CPU, PRESSURE_MEMORY, PRESSURE_LOAD };
+static const char *pressure_paths[] = {
+    "/proc/pressure/cpu", "/proc/pressure/memory", "/proc/loadavg"};
+static int pressure_fd[] = {-1, -1, -1};
+
+static admit_limits limits;
+static admit_entry *queue = NULL;
+static admit_entry *queue_last = NULL;
+static int n_queued = 0;
+static unsigned long n_enqueued = 0; /* Sequence of the next entry */
+static int timer_fd = -1;
+static int longest_first = 0; /* Release by expected run time, not FIFO */
+
+// Queue wait statistics of released jobs
+static long released = 0;
+static long long wait_total_ns = 0;
+static long long wait_max_ns = 0;
+
+// Reads a pressure value: "some avg10" of a PSI file or the 1 minute
+// loadavg. Files stay open, later reads are a single pread(). Returns -1 if
+// the file is not available (kernel without PSI...)
+static double read_pressure(enum pressure_file file) {
+  char buff[256];
+  char *p;
+  ssize_t n;
+
+  if (pressure_fd[file] == -1) {
+    pressure_fd[file] = open(pressure_paths[file], O_RDONLY | O_CLOEXEC);
+    if (pressure_fd[file] == -1)
+      return (-1);
+  }
+  n = pread(pressure_fd[file], buff, sizeof(buff) - 1, 0);
+  if (n <= 0)
+    return (-1);
+  buff[n] = '\0';
+  if (file == PRESSURE_LOAD)
+    return strtod(buff, NULL);
+  p = strstr(buff, "avg10=");
+  if (!p)
+    return (-1);
+  return strtod(p + 6, NULL);
+}
+
+// Is any pressure limit exceeded?
+static int pressure_high(void) {
+  if (limits.cpu > 0 && read_pressure(PRESSURE_CPU) > limits.cpu)
+    return (1);
+  if (limits.memory > 0 && read_pressure(PRESSURE_MEMORY) > limits.memory)
+    return (1);
+  if (limits.load > 0 && read_pressure(PRESSURE_LOAD) > limits.load)
+    return (1);
+  return (0);
+}
+
+static int running_jobs(void) {
+  int n = 0;
+  for (job *item = get_iterator(tasks); item; item = item->next) {
+    if (item->state == BACKGROUND)
+      n++;
+  }
+  return (n);
+}
+
+// Is there room for one more background job? SIGCHLD must be blocked
+static int has_room(void) {
+  if (limits.max_running > 0 && running_jobs() >= limits.max_running)
+    return (0);
+  return !pressure_high();
+}
+
+// Periodic check while there are queued jobs, disarmed otherwise
+static void arm_timer(int on) {
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  if (on) {
+    its.it_value.tv_nsec = ADMIT_TICK_MS * 1000000LL;
+    its.it_interval.tv_nsec = ADMIT_TICK_MS * 1000000LL;
+  }
+  timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+static void free_entry(admit_entry *entry) {
+  free_pp_char(entry->comm_args);
+  redir_free(&entry->redir);
+  free(entry);
+}
+
+static void timer_ready(int fd, short revents, void *data) {
+  unsigned long long expirations;
+  ssize_t ignored = read(fd, &expirations, sizeof(expirations));
+  (void)ignored;
+  loop_print_begin();
+  admit_release();
+  loop_print_end();
+}
+
+static void admit_event(notify_event_t *ev) {
+  if (ev->kind == NOTIFY_ENDED)
+    admit_release();
+}
+
+/**
+ * Creates the check timer and subscribes to job ends. Returns -1 on error.
+ **/
+int admit_init(void) {
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd == -1) {
+    perror("Error at timerfd_create");
+    return (-1);
+  }
+  notify_subscribe(admit_event);
+  return loop_watch_fd(timer_fd, POLLIN, timer_ready, NULL);
+}
+
+/**
+ * Must the next background launch be queued? Launches are kept in order, so
+ * anything already queued holds it too. Call with SIGCHLD blocked.
+ **/
+int admit_hold(void) {
+  if (queue)
+    return (1);
+  if (!limits.max_running && limits.cpu <= 0 && limits.memory <= 0 &&
+      limits.load <= 0)
+    return (0);
+  return !has_room();
+}
+
+// Whether a is released before b: by expected run time with
+// longest_first, then in the order they were queued
+static int goes_before(const admit_entry *a, const admit_entry *b) {
+  if (longest_first && a->expected_ns != b->expected_ns)
+    return (a->expected_ns > b->expected_ns);
+  return (a->seq < b->seq);
+}
+
+// Puts entry in its place in the queue. Most entries go last (FIFO, or a
+// batch of the same command), so that is checked first
+static void insert(admit_entry *entry) {
+  admit_entry **link = &queue;
+
+  entry->next = NULL;
+  if (!queue_last || !goes_before(entry, queue_last)) {
+    if (queue_last)
+      queue_last->next = entry;
+    else
+      queue = entry;
+    queue_last = entry;
+    return;
+  }
+  while (!goes_before(entry, *link))
+    link = &(*link)->next;
+  entry->next = *link;
+  *link = entry;
+}
+
+// Merge sort of the list at head by goes_before(). Returns the new head
+static admit_entry *sort_list(admit_entry *head) {
+  admit_entry *slow = head, *fast, *second, *merged = NULL;
+  admit_entry **tail = &merged;
+
+  if (!head || !head->next)
+    return (head);
+  for (fast = head->next; fast && fast->next; fast = fast->next->next)
+    slow = slow->next;
+  second = slow->next;
+  slow->next = NULL;
+  head = sort_list(head);
+  second = sort_list(second);
+  while (head && second) {
+    admit_entry **from = goes_before(second, head) ? &second : &head;
+    *tail = *from;
+    tail = &(*from)->next;
+    *from = (*from)->next;
+  }
+  *tail = head ? head : second;
+  return (merged);
+}
+
+// Reorders the queue after a change of longest_first. SIGCHLD must be
+// blocked
+static void sort_queue(void) {
+  queue = sort_list(queue);
+  for (queue_last = queue; queue_last && queue_last->next;)
+    queue_last = queue_last->next;
+}
+
+/**
+ * Adds a launch to the queue, in release order. Call with SIGCHLD blocked.
+ **/
+void admit_enqueue(char **args, int inmortal, const redir_plan *redir) {
+  admit_entry *entry = (admit_entry *)calloc(1, sizeof(admit_entry));
+  if (!entry) {
+    perror("Error at calloc");
+    return;
+  }
+  entry->comm_args = cpy_args(args);
+  entry->inmortal = inmortal;
+  if (redir)
+    redir_copy(&entry->redir, redir);
+  entry->queued_ns = monotonic_ns();
+  // Never profiled: could be the longest, it goes first
+  entry->expected_ns = prof_expected(args);
+  if (entry->expected_ns < 0)
+    entry->expected_ns = LLONG_MAX;
+  entry->seq = n_enqueued++;
+  insert(entry);
+  if (!n_queued++)
+    arm_timer(1);
+}
+
+/**
+ * Launches args in background or queues it. Returns the pid, 0 if queued
+ **/
+pid_t admit_launch(char **args) {
+  block_SIGCHLD();
+  if (admit_hold()) {
+    admit_enqueue(args, 0, NULL);
+    unblock_SIGCHLD();
+    return (0);
+  }
+  unblock_SIGCHLD();
+  return launch_background(args);
+}
+
+// Takes the next entry out of the queue, its head. SIGCHLD must be blocked
+static admit_entry *dequeue(void) {
+  admit_entry *entry = queue;
+
+  queue = entry->next;
+  if (!queue)
+    queue_last = NULL;
+  n_queued--;
+  return (entry);
+}
+
+/**
+ * Launches queued jobs while there is room for them, in order or longest
+ * first
+ **/
+void admit_release(void) {
+  int pressure = limits.cpu > 0 || limits.memory > 0 || limits.load > 0;
+
+  block_SIGCHLD();
+  while (queue && has_room()) {
+    admit_entry *entry = dequeue();
+    long long waited = monotonic_ns() - entry->queued_ns;
+    pid_t pid;
+
+    pid = launch_job(entry->comm_args, entry->inmortal, &entry->redir, NULL,
+                     NULL);
+    if (pid > 0) {
+      released++;
+      wait_total_ns += waited;
+      if (waited > wait_max_ns)
+        wait_max_ns = waited;
+      printf("Queued job released... pid: %d, command: %s, waited: %.2fs\n",
+             pid, entry->comm_args[0], waited / 1e9);
+    }
+    free_entry(entry);
+    if (pressure)
+      break;
+  }
+  if (!queue)
+    arm_timer(0);
+  unblock_SIGCHLD();
+}
+
+/**
+ * Prints the queued jobs (part of the jobs builtin) and the wait statistics
+ **/
+void admit_print(void) {
+  long long now = monotonic_ns();
+  int n = 1;
+
+  block_SIGCHLD();
+  for (admit_entry *entry = queue; entry; entry = entry->next, n++)
+    printf(" [Q%d] command: %s, state: %s, waiting: %.2fs\n", n,
+           entry->comm_args[0], state_strings[QUEUED],
+           (now - entry->queued_ns) / 1e9);
+  if (released || queue)
+    printf("Queue: %d waiting, %ld released, wait avg: %.2fs, max: %.2fs\n",
+           n_queued, released,
+           released ? wait_total_ns / 1e9 / released : 0.0,
+           wait_max_ns / 1e9);
+  unblock_SIGCHLD();
+}
+
+static void print_limit(const char *name, double limit,
+                        enum pressure_file file) {
+  double value = read_pressure(file);
+  printf("  %-7s limit: ", name);
+  if (limit > 0)
+    printf("%-6.2f", limit);
+  else
+    printf("%-6s", "off");
+  if (value < 0)
+    printf(" now: n/a\n");
+  else
+    printf(" now: %.2f\n", value);
+}
+
+/**
+ * admit [off] [longest | fifo] [-j max_running] [-c cpu%] [-m memory%]
+ * [-l loadavg]
+ * Without arguments prints the limits, current pressure and the queue.
+ * A 0 disables a limit, off disables them all and releases the queue.
+ * longest releases the queue by expected run time, fifo in order.
+ **/
+void admit_builtin(char **args) {
+  admit_limits new_limits = limits;
+
+  for (int i = 1; args[i]; i++) {
+    char *end;
+    double value;
+
+    if (!strcmp(args[i], "off")) {
+      memset(&new_limits, 0, sizeof(new_limits));
+      continue;
+    }
+    if (!strcmp(args[i], "longest") || !strcmp(args[i], "fifo")) {
+      if (longest_first != (args[i][0] == 'l')) {
+        longest_first = args[i][0] == 'l';
+        block_SIGCHLD();
+        sort_queue();
+        unblock_SIGCHLD();
+      }
+      continue;
+    }
+    if (!args[i + 1] || args[i][0] != '-' || args[i][2] != '\0' ||
+        !strchr("jcml", args[i][1]))
+      goto usage;
+    value = strtod(args[i + 1], &end);
+    if (end == args[i + 1] || *end || value < 0)
+      goto usage;
+    switch (args[i][1]) {
+    case 'j':
+      new_limits.max_running = (int)value;
+      break;
+    case 'c':
+      new_limits.cpu = value;
+      break;
+    case 'm':
+      new_limits.memory = value;
+      break;
+    case 'l':
+      new_limits.load = value;
+      break;
+    }
+    i++;
+  }
+  if ((new_limits.cpu > 0 && read_pressure(PRESSURE_CPU) < 0) ||
+      (new_limits.memory > 0 && read_pressure(PRESSURE_MEMORY) < 0)) {
+    printf("admit: /proc/pressure is not available, use -l instead\n");
+    return;
+  }
+  limits = new_limits;
+
+  if (args[1]) {
+    admit_release();
+    return;
+  }
+  block_SIGCHLD();
+  printf("Admission control: %d running", running_jobs());
+  unblock_SIGCHLD();
+  if (limits.max_running > 0)
+    printf(" (max %d)", limits.max_running);
+  printf(", order: %s\n", longest_first ? "longest first" : "fifo");
+  print_limit("cpu", limits.cpu, PRESSURE_CPU);
+  print_limit("memory", limits.memory, PRESSURE_MEMORY);
+  print_limit("load", limits.load, PRESSURE_LOAD);
+  admit_print();
+  return;
+
+usage:
+  printf("Usage: admit [off] [longest | fifo] [-j max_running] [-c cpu%%] "
+         "[-m memory%%] [-l loadavg]\n");
+}
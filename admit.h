@@ -0,0 +1,47 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for admit module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _ADMIT_H
+#define _ADMIT_H
+
+#include "job_control.h"
+#include "redir.h"
+
+#define ADMIT_TICK_MS 500 /* Pressure check period while jobs are queued */
+
+/* Background launch held back until the machine has room for it */
+typedef struct admit_entry_ {
+  char **comm_args;
+  int inmortal;
+  redir_plan redir; /* Redirections of the original command line */
+  long long queued_ns; /* CLOCK_MONOTONIC time it was queued */
+  long long expected_ns; /* jobprof run time, LLONG_MAX if never seen */
+  unsigned long seq;     /* Order it was queued in */
+  struct admit_entry_ *next;
+} admit_entry;
+
+/* Admission limits, 0 disables each one */
+typedef struct admit_limits_ {
+  int max_running; /* Background jobs running at the same time */
+  double cpu;      /* /proc/pressure/cpu "some avg10" (%) */
+  double memory;   /* /proc/pressure/memory "some avg10" (%) */
+  double load;     /* 1 minute loadavg */
+} admit_limits;
+
+/**
+ * Public Functions
+ **/
+int admit_init(void);
+int admit_hold(void);
+void admit_enqueue(char **args, int inmortal, const redir_plan *redir);
+pid_t admit_launch(char **args);
+void admit_release(void);
+void admit_print(void);
+void admit_builtin(char **args);
+
+#endif
@@ -0,0 +1,450 @@
+/**
+ * Linux Job Control Shell Project
+ * ckpt module: job table checkpoint and re-adoption after a restart
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Every change to tasks is written to a small mmapped file. Each slot holds
+ * two copies of its record: the one not in use is written and then the
+ * current index flips, so a crash in the middle of an update leaves the
+ * previous record intact. The page cache keeps the data when the process
+ * dies, so no msync is needed.
+ *
+ * When a new shell opens the file, it checks each recorded job against
+ * /proc. A reused pid is caught because its start time differs. The jobs
+ * still alive are put back in tasks and their alarms are armed again.
+ * They are no longer our children (the kernel gave them to init or to a
+ * subreaper above the dead shell), so a pidfd tells when they end. The
+ * pidfds go in one epoll set, a single descriptor of the event loop however
+ * many jobs are adopted. Their exit status is lost and they are reported
+ * as ended correctly. The shell
+ * also becomes a child subreaper, and reaps the orphans that its jobs
+ * leave behind.
+ **/
+#include "ckpt.h"
+#include "admit.h"
+#include "event_loop.h"
+#include "notify.h"
+#include "shell.h"
+#include "termpol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+static ckpt_file *file = NULL;
+static int reap_fd = -1; /* eventfd, poked by the SIGCHLD handler */
+static int adopted_fd = -1; /* epoll set of the pidfds of adopted jobs */
+
+// starttime of /proc/<pid>/stat, 0 if the process is gone or a zombie
+static unsigned long long start_time(pid_t pid) {
+  char path[64], buff[1024], *p;
+  unsigned long long start = 0;
+  ssize_t len;
+  int fd;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return (0);
+  len = read(fd, buff, sizeof(buff) - 1);
+  close(fd);
+  if (len <= 0)
+    return (0);
+  buff[len] = '\0';
+  // The command may hold spaces and ')', fields restart after the last ')'
+  p = strrchr(buff, ')');
+  if (!p || p[1] != ' ' || p[2] == 'Z')
+    return (0);
+  // p + 1 is the space before field 3 (state), starttime is field 22
+  p++;
+  for (int field = 3; field < 22 && p; field++)
+    p = strchr(p + 1, ' ');
+  if (p)
+    start = strtoull(p + 1, NULL, 10);
+  return (start);
+}
+
+static const ckpt_record *current(int slot) {
+  ckpt_slot *s = &file->slot[slot];
+  return &s->rec[__atomic_load_n(&s->cur, __ATOMIC_ACQUIRE)];
+}
+
+// Writes the copy not in use and makes it the current one
+static void write_record(int slot, const ckpt_record *rec) {
+  ckpt_slot *s = &file->slot[slot];
+  int next = !s->cur;
+  s->rec[next] = *rec;
+  __atomic_store_n(&s->cur, next, __ATOMIC_RELEASE);
+}
+
+static int free_slot(void) {
+  for (int i = 0; i < CKPT_SLOTS; i++) {
+    if (!current(i)->pgid)
+      return (i);
+  }
+  return (-1);
+}
+
+/**
+ * Saves a job that was added to tasks or changed. Call with SIGCHLD
+ * blocked (or from the handler). Does nothing without a checkpoint file.
+ **/
+void ckpt_sync(job *item) {
+  ckpt_record rec;
+  const ckpt_record *old = NULL;
+  char *p;
+
+  if (!file)
+    return;
+  if (item->ckpt_slot == -1)
+    item->ckpt_slot = free_slot();
+  if (item->ckpt_slot == -1)
+    return; // Full, this job is not saved
+  if (current(item->ckpt_slot)->pgid == item->pgid)
+    old = current(item->ckpt_slot);
+
+  memset(&rec, 0, sizeof(rec));
+  rec.pgid = item->pgid;
+  rec.start_time = old ? old->start_time : start_time(item->pgid);
+  rec.state = item->state;
+  rec.inmortal = item->inmortal;
+  rec.limits = item->limits;
+  if (item->isAlarmSig)
+    rec.alarm_signal = item->initTime + item->timeAlarmSig;
+  if (item->threadWait)
+    rec.alarm_thread = item->threadWait->deadline;
+  if (item->isProcWait && item->pid_wait > 0) {
+    rec.alarm_pid = item->pid_wait;
+    rec.alarm_start = old && old->alarm_pid == item->pid_wait
+                          ? old->alarm_start
+                          : start_time(item->pid_wait);
+  }
+  p = rec.argv;
+  for (int i = 0; item->comm_args && item->comm_args[i]; i++) {
+    size_t len = strlen(item->comm_args[i]) + 1;
+    if (p + len > rec.argv + CKPT_ARGV)
+      break;
+    memcpy(p, item->comm_args[i], len);
+    p += len;
+    rec.argc++;
+  }
+  write_record(item->ckpt_slot, &rec);
+}
+
+/**
+ * Forgets a job that leaves tasks (and stops watching it if adopted)
+ **/
+void ckpt_drop(job *item) {
+  ckpt_record rec;
+
+  if (item->pidfd != -1) {
+    epoll_ctl(adopted_fd, EPOLL_CTL_DEL, item->pidfd, NULL);
+    close(item->pidfd);
+    item->pidfd = -1;
+  }
+  if (!file || item->ckpt_slot == -1)
+    return;
+  memset(&rec, 0, sizeof(rec));
+  write_record(item->ckpt_slot, &rec);
+  item->ckpt_slot = -1;
+}
+
+// An adopted job has ended: the same steps as the SIGCHLD handler, without
+// a wait status
+static void adopted_ended(job *item) {
+  if (notify_space() < 3)
+    notify_drain();
+  block_SIGCHLD();
+  remove_job(tasks, item);
+  job_ended(item, 0, NULL, 0);
+  unblock_SIGCHLD();
+}
+
+// Some pidfds of the set became readable
+static void adopted_ready(int fd, short revents, void *data) {
+  struct epoll_event ev[16];
+  int n = epoll_wait(adopted_fd, ev, 16, 0);
+
+  // Any left over keep the set readable for the next poll
+  for (int i = 0; i < n; i++)
+    adopted_ended((job *)ev[i].data.ptr);
+}
+
+// Tells the loop when an adopted job ends. Returns -1 if it can't
+static int watch_adopted(job *item, pid_t pid) {
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = item};
+
+  if (adopted_fd == -1) {
+    adopted_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (adopted_fd == -1) {
+      perror("Error at epoll_create1");
+      return (-1);
+    }
+    if (loop_watch_fd(adopted_fd, POLLIN, adopted_ready, NULL) == -1) {
+      fprintf(stderr, "Error: no room in the event loop for adopted jobs\n");
+      close(adopted_fd);
+      adopted_fd = -1;
+      return (-1);
+    }
+  }
+  item->pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if (item->pidfd == -1) {
+    perror("Error at pidfd_open");
+    return (-1);
+  }
+  if (epoll_ctl(adopted_fd, EPOLL_CTL_ADD, item->pidfd, &ev) == -1) {
+    perror("Error at epoll_ctl");
+    close(item->pidfd);
+    item->pidfd = -1;
+    return (-1);
+  }
+  return (0);
+}
+
+// Is the packed argv of a record from the file whole: argc strings, each
+// ending inside it?
+static int argv_valid(const ckpt_record *rec) {
+  const char *p = rec->argv, *end = rec->argv + CKPT_ARGV;
+
+  if (rec->argc < 1 || rec->argc > CKPT_ARGV / 2)
+    return (0);
+  for (int i = 0; i < rec->argc; i++) {
+    const char *nul = memchr(p, '\0', end - p);
+    if (!nul)
+      return (0);
+    p = nul + 1;
+  }
+  return (1);
+}
+
+// Puts a recorded job back in tasks. Returns the seconds left to its
+// alarm-signal deadline (0 if none)
+static int adopt(const ckpt_record *rec, int children) {
+  char *argv[CKPT_ARGV / 2 + 1];
+  const char *p = rec->argv;
+  time_t now = time(NULL);
+  int left = 0;
+  job *item;
+
+  if (!rec->pgid)
+    return (0);
+  // A damaged file is not trusted with the job
+  if (!argv_valid(rec)) {
+    fprintf(stderr, "Checkpoint record of pid: %d is corrupt, not adopted\n",
+            rec->pgid);
+    return (0);
+  }
+  // Gone, or the pid belongs to another process now
+  if (start_time(rec->pgid) != rec->start_time) {
+    // Its alarm-proc would kill whoever gets the pid next
+    if (rec->alarm_pid && start_time(rec->alarm_pid) == rec->alarm_start)
+      kill(rec->alarm_pid, SIGKILL);
+    return (0);
+  }
+  for (int i = 0; i < rec->argc; i++) {
+    argv[i] = (char *)p;
+    p += strlen(p) + 1;
+  }
+  argv[rec->argc] = NULL;
+
+  item = new_job(rec->pgid, argv[0], rec->state);
+  item->inmortal = rec->inmortal;
+  item->limits = rec->limits;
+  item->comm_args = cpy_args(argv);
+  // Profiled from when it really started, /proc counts it from boot like
+  // CLOCK_MONOTONIC (but for suspended time)
+  item->start_ns = rec->start_time * (1000000000LL / sysconf(_SC_CLK_TCK));
+  item->threadWait = NULL;
+  item->isProcWait = 0;
+  item->pid_wait = -1;
+  item->isAlarmSig = 0;
+  item->timeAlarmSig = 0;
+  item->initTime = 0;
+  // Nothing would tell when it ends, so it is left running on its own
+  if (!children && watch_adopted(item, rec->pgid) == -1) {
+    printf("Job pid: %d, command: %s can't be watched, not adopted\n",
+           item->pgid, item->command);
+    free_pp_char(item->comm_args);
+    free_job(item);
+    return (0);
+  }
+  if (rec->alarm_signal || rec->alarm_thread)
+    term_claim(rec->pgid);
+  if (rec->alarm_signal) {
+    left = rec->alarm_signal > now ? rec->alarm_signal - now : 1;
+    item->isAlarmSig = 1;
+    item->initTime = now;
+    item->timeAlarmSig = left;
+  }
+  if (rec->alarm_thread)
+    item->threadWait = alarm_thread_start(
+        rec->pgid, rec->alarm_thread > now ? rec->alarm_thread - now : 0);
+  // The alarm-proc process survived the shell, it still fires on time
+  if (rec->alarm_pid && start_time(rec->alarm_pid) == rec->alarm_start) {
+    item->isProcWait = 1;
+    item->pid_wait = rec->alarm_pid;
+  }
+  add_job(tasks, item);
+  ckpt_sync(item);
+  printf("Adopted job pid: %d, command: %s, state: %s\n", item->pgid,
+         item->command, state_strings[item->state]);
+  return (left);
+}
+
+// A child ended: the orphans are reaped from the loop, where no fork is
+// halfway through being added to tasks
+static void reap_ready(int fd, short revents, void *data) {
+  uint64_t n;
+  ssize_t ignored = read(fd, &n, sizeof(n));
+  (void)ignored;
+  ckpt_reap_orphans();
+}
+
+// Is pid one the shell waits for itself: a job or the alarm-proc of one?
+static int is_own(pid_t pid) {
+  job *item = get_iterator(tasks);
+  while (item) {
+    if (item->pgid == pid || (item->isProcWait && item->pid_wait == pid))
+      return (1);
+    next(item);
+  }
+  return (0);
+}
+
+/**
+ * Called by the SIGCHLD handler, wakes the loop up to reap orphans
+ **/
+void ckpt_child_event(void) {
+  uint64_t one = 1;
+  ssize_t ignored;
+
+  if (reap_fd == -1)
+    return;
+  ignored = write(reap_fd, &one, sizeof(one));
+  (void)ignored;
+}
+
+/**
+ * Reaps the orphans given to the shell as subreaper (and the jobs removed
+ * by deljob). Jobs and their alarm-proc are left to their own waitpid.
+ * Nothing is done while a foreground job runs. Returns the number reaped.
+ **/
+int ckpt_reap_orphans(void) {
+  char path[64];
+  sigset_t block_sigchld, old_mask;
+  siginfo_t si;
+  FILE *f;
+  int pid, n = 0;
+
+  if (reap_fd == -1 || foreground_pid)
+    return (0);
+  snprintf(path, sizeof(path), "/proc/self/task/%d/children", getpid());
+  sigemptyset(&block_sigchld);
+  sigaddset(&block_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &block_sigchld, &old_mask);
+  f = fopen(path, "r");
+  while (f && fscanf(f, "%d", &pid) == 1) {
+    if (is_own(pid))
+      continue;
+    si.si_pid = 0;
+    if (waitid(P_PID, pid, &si, WEXITED | WNOHANG) == 0 && si.si_pid)
+      n++;
+  }
+  if (f)
+    fclose(f);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  return (n);
+}
+
+/**
+ * Opens (or creates) the checkpoint file, adopts the jobs it holds and
+ * makes the shell a child subreaper. Call it once the signal handlers are
+ * installed. Returns -1 on error or if another live shell owns the file.
+ **/
+int ckpt_open(const char *path) {
+  ckpt_record *old;
+  struct stat st;
+  int fd, fresh, children, next_alarm = 0;
+
+  fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    perror("Error opening the checkpoint file");
+    if (fd != -1)
+      close(fd);
+    return (-1);
+  }
+  fresh = st.st_size != sizeof(ckpt_file);
+  if (fresh && ftruncate(fd, sizeof(ckpt_file)) == -1) {
+    perror("Error at ftruncate");
+    close(fd);
+    return (-1);
+  }
+  file = (ckpt_file *)mmap(NULL, sizeof(ckpt_file), PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    perror("Error at mmap");
+    file = NULL;
+    return (-1);
+  }
+  if (fresh || memcmp(file->magic, CKPT_MAGIC, sizeof(file->magic)) ||
+      file->n_slots != CKPT_SLOTS) {
+    memset(file, 0, sizeof(ckpt_file));
+    memcpy(file->magic, CKPT_MAGIC, sizeof(file->magic));
+    file->n_slots = CKPT_SLOTS;
+  } else if (file->owner != getpid() &&
+             start_time(file->owner) == file->owner_start) {
+    fprintf(stderr, "Checkpoint file %s is in use by the shell %d\n", path,
+            file->owner);
+    munmap(file, sizeof(ckpt_file));
+    file = NULL;
+    return (-1);
+  }
+
+  // Orphans of the jobs come to the shell instead of init
+  if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1)
+    perror("Error at prctl");
+  else if ((reap_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+    perror("Error at eventfd");
+  else
+    loop_watch_fd(reap_fd, POLLIN, reap_ready, NULL);
+
+  // Same pid: the shell exec'd itself, the jobs are still its children
+  children = file->owner == getpid();
+  old = (ckpt_record *)malloc(CKPT_SLOTS * sizeof(ckpt_record));
+  if (!old) {
+    perror("Error at malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < CKPT_SLOTS; i++) {
+    // cur comes from the file too: a bad one leaves the slot free
+    unsigned int cur = file->slot[i].cur;
+    if (cur < 2)
+      old[i] = file->slot[i].rec[cur];
+    else
+      memset(&old[i], 0, sizeof(old[i]));
+  }
+  memset(file->slot, 0, sizeof(file->slot));
+  file->owner = getpid();
+  file->owner_start = start_time(getpid());
+
+  block_SIGCHLD();
+  for (int i = 0; i < CKPT_SLOTS; i++) {
+    int left = adopt(&old[i], children);
+    if (left && (!next_alarm || left < next_alarm))
+      next_alarm = left;
+  }
+  unblock_SIGCHLD();
+  free(old);
+  if (next_alarm)
+    alarm(next_alarm);
+  return (0);
+}
@@ -0,0 +1,56 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for ckpt module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _CKPT_H
+#define _CKPT_H
+
+#include "job_control.h"
+
+#define CKPT_MAGIC "JOBCKPT1"
+#define CKPT_SLOTS 256 /* Jobs kept in the file, the rest are not saved */
+#define CKPT_ARGV 256  /* Packed argv of a job (a command line fits) */
+
+/* A job as saved in the checkpoint file */
+typedef struct ckpt_record_ {
+  pid_t pgid; /* 0: free slot */
+  unsigned long long start_time; /* /proc starttime, tells a reused pid */
+  int state;
+  int inmortal;
+  int limits;
+  time_t alarm_signal; /* Deadlines (time(NULL) clock), 0 if none */
+  time_t alarm_thread;
+  pid_t alarm_pid; /* alarm-proc process, it outlives the shell */
+  unsigned long long alarm_start;
+  int argc;
+  char argv[CKPT_ARGV]; /* Arguments separated by '\0' */
+} ckpt_record;
+
+/* Two copies of a record: the one not in use is written, then cur flips */
+typedef struct ckpt_slot_ {
+  int cur;
+  ckpt_record rec[2];
+} ckpt_slot;
+
+typedef struct ckpt_file_ {
+  char magic[8];
+  int n_slots;
+  pid_t owner; /* Shell writing the file */
+  unsigned long long owner_start;
+  ckpt_slot slot[CKPT_SLOTS];
+} ckpt_file;
+
+/**
+ * Public Functions
+ **/
+int ckpt_open(const char *path);
+void ckpt_sync(job *item);
+void ckpt_drop(job *item);
+void ckpt_child_event(void);
+int ckpt_reap_orphans(void);
+
+#endif
@@ -0,0 +1,367 @@
+/**
+ * Linux Job Control Shell Project
+ * cmdlist module: command lists (; && ||) and $?
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * A line is parsed once into a list of commands joined by ; && or ||.
+ * main takes them one after another from the same buffer, without going
+ * back to the prompt, and && / || skip a command depending on the exit
+ * status of the last one that ran ($?). The operators have the same
+ * precedence and group to the left, as in sh. Variables are expanded as
+ * each command is taken, so a; b sees what a did to them. Then the words
+ * with * ? or [...] become the paths they match, in an argv that grows as
+ * needed: a pattern can give many more arguments than a line has tokens.
+ *
+ * A list ending in & is one job: a child of the shell becomes its process
+ * group leader and runs the commands in turn, so jobs, fg, kill and the
+ * alarms see a single entry for the whole list.
+ **/
+#include "cmdlist.h"
+#include "ckpt.h"
+#include "env.h"
+#include "fastcmd.h"
+#include "joblimit.h"
+#include "redir.h"
+#include "trace.h"
+#include "wildcard.h"
+
+#include <ctype.h>
+#include <errno.h>
+
+static int last_status = 0; /* $? */
+
+static const struct {
+  const char *token;
+  enum list_op op;
+} list_ops[] = {{";", LIST_SEQ}, {"&&", LIST_AND}, {"||", LIST_OR}, {NULL, 0}};
+
+static int find_op(const char *arg) {
+  for (int i = 0; list_ops[i].token; i++) {
+    if (!strcmp(arg, list_ops[i].token))
+      return (i);
+  }
+  return (-1);
+}
+
+/**
+ * Exit status in sh terms of a raw wait status
+ **/
+int list_exit_code(int status) {
+  int info;
+  enum status status_res = analyze_status(status, &info);
+  if (status_res == SIGNALED || status_res == SUSPENDED)
+    return (128 + info);
+  return (info);
+}
+
+/**
+ * Sets $? (for builtins)
+ **/
+void list_set_status(int code) { last_status = code; }
+
+/**
+ * Sets $? from the raw wait status of a foreground job
+ **/
+void list_foreground(int status) { last_status = list_exit_code(status); }
+
+/**
+ * Splits the tokens of a line (as left by get_command) into commands. The
+ * tokens are copied, args can be reused. Returns -1 on a syntax error,
+ * and then nothing runs.
+ **/
+int list_parse(char **args, int background, cmd_list *list) {
+  int t = 0, start = 1;
+  enum list_op op = LIST_SEQ;
+
+  list->n = 0;
+  list->pos = 0;
+  list->background = background;
+  for (int i = 0; args[i] && t < LIST_MAX - 1; i++) {
+    int k = find_op(args[i]);
+    if (k == -1) {
+      if (start) {
+        list->elem[list->n].first = t;
+        list->elem[list->n].op = op;
+        list->n++;
+        start = 0;
+      }
+      list->tokens[t++] = args[i];
+      continue;
+    }
+    if (start) {
+      fprintf(stderr, "syntax error near %s\n", args[i]);
+      list->n = 0;
+      return (-1);
+    }
+    list->tokens[t++] = NULL;
+    op = list_ops[k].op;
+    start = 1;
+  }
+  list->tokens[t] = NULL;
+  // a; is fine, a && is not
+  if (start && op != LIST_SEQ) {
+    fprintf(stderr, "syntax error near %s\n", op == LIST_AND ? "&&" : "||");
+    list->n = 0;
+    return (-1);
+  }
+  return (0);
+}
+
+// Value of the $ reference at str ($?, $NAME or ${NAME}), NULL if str
+// is not one. *len gets the length of the reference
+static const char *lookup(const char *str, char *status, int *len) {
+  int braces = str[1] == '{', n = 0;
+  const char *name = str + 1 + braces, *value;
+
+  if (str[1] == '?') {
+    *len = 2;
+    return (status);
+  }
+  while (isalnum((unsigned char)name[n]) || name[n] == '_')
+    n++;
+  if (!n || isdigit((unsigned char)name[0]) || (braces && name[n] != '}'))
+    return NULL;
+  *len = 1 + braces + n + braces;
+  value = env_get(name, n);
+  return (value ? value : "");
+}
+
+// Appends arg to the current command (NULL only terminates it), argv
+// stays NULL terminated
+static int push_arg(cmd_list *list, char *arg) {
+  if (list->argc + 2 > list->argv_cap) {
+    int cap = list->argv_cap ? list->argv_cap * 2 : LIST_MAX;
+    char **aux = (char **)realloc(list->argv, cap * sizeof(char *));
+    if (!aux) {
+      perror("Error at realloc");
+      return (-1);
+    }
+    list->argv = aux;
+    list->argv_cap = cap;
+  }
+  list->argv[list->argc] = arg;
+  if (arg)
+    list->argc++;
+  list->argv[list->argc] = NULL;
+  return (0);
+}
+
+// Appends a string made by the expansion, freed with the command
+static int push_word(cmd_list *list, char *word) {
+  if (!word) {
+    perror("Error at malloc");
+    return (-1);
+  }
+  if (list->n_words == list->words_cap) {
+    int cap = list->words_cap ? list->words_cap * 2 : LIST_MAX;
+    char **aux = (char **)realloc(list->words, cap * sizeof(char *));
+    if (!aux) {
+      perror("Error at realloc");
+      free(word);
+      return (-1);
+    }
+    list->words = aux;
+    list->words_cap = cap;
+  }
+  list->words[list->n_words++] = word;
+  return push_arg(list, word);
+}
+
+static void add_match(char *path, void *data) {
+  push_word((cmd_list *)data, path);
+}
+
+// tok with $?, $NAME and ${NAME} replaced, in a new string
+static char *expand_vars(const char *tok, char *status) {
+  const char *value, *p;
+  size_t size = 1;
+  char *word, *out;
+  int len;
+
+  for (p = tok; *p;) {
+    if (p[0] == '$' && (value = lookup(p, status, &len))) {
+      size += strlen(value);
+      p += len;
+    } else {
+      size++;
+      p++;
+    }
+  }
+  word = out = (char *)malloc(size);
+  if (!word)
+    return NULL;
+  for (p = tok; *p;) {
+    if (p[0] == '$' && (value = lookup(p, status, &len))) {
+      out = stpcpy(out, value);
+      p += len;
+    } else
+      *out++ = *p++;
+  }
+  *out = '\0';
+  return (word);
+}
+
+// Builds argv from a command: $?, $NAME and ${NAME} are replaced, then the
+// words with * ? or [...] become the paths they match. A word made only of
+// unset variables goes away, as in sh
+static void expand(cmd_list *list, int first) {
+  char status[16];
+
+  for (int i = 0; i < list->n_words; i++)
+    free(list->words[i]);
+  list->n_words = 0;
+  list->argc = 0;
+  if (push_arg(list, NULL) == -1)
+    return;
+  snprintf(status, sizeof(status), "%d", last_status);
+  for (int i = first; list->tokens[i]; i++) {
+    char *tok = list->tokens[i];
+    char *word = tok;
+    if (strchr(tok, '$')) {
+      word = expand_vars(tok, status);
+      if (!word) {
+        perror("Error at malloc");
+        continue;
+      }
+      if (!*word) {
+        free(word);
+        continue;
+      }
+    }
+    if (wild_has_magic(word) && wild_expand(word, add_match, list) > 0) {
+      if (word != tok)
+        free(word);
+      continue;
+    }
+    // A pattern that matches nothing stays as it is
+    if (word == tok)
+      push_arg(list, tok);
+    else
+      push_word(list, word);
+  }
+}
+
+/**
+ * Leaves in list->argv the next command of the list that has to run (&&
+ * and || skip commands after the exit status in $?). Returns 0 once the
+ * list is done.
+ **/
+int list_next(cmd_list *list) {
+  while (list->pos < list->n) {
+    cmd_elem *elem = &list->elem[list->pos++];
+    if ((elem->op == LIST_AND && last_status != 0) ||
+        (elem->op == LIST_OR && last_status == 0))
+      continue;
+    expand(list, elem->first);
+    return (list->argv != NULL);
+  }
+  return (0);
+}
+
+// A command of a background list, in the job's process. Returns its exit
+// status
+static int run_command(char **args) {
+  char **envp;
+  redir_plan redir;
+  pid_t pid;
+  int status;
+
+  if (redir_parse(args, &redir) == -1)
+    return (2);
+  envp = env_prefix(args);
+  if (!args[0])
+    return (0);
+  if (!strcmp(args[0], "cd")) {
+    free(envp);
+    return (args[1] && chdir(args[1]) == -1);
+  }
+  if (fast_builtin(args, &redir)) {
+    free(envp);
+    status = fast_child(args, &redir);
+    return (status == -1 ? 1 : list_exit_code(status));
+  }
+  if (redir_open(&redir) == -1) {
+    free(envp);
+    return (1);
+  }
+  pid = fork();
+  if (pid == 0) {
+    if (redir_apply(&redir) == -1)
+      exit(EXIT_FAILURE);
+    if (envp)
+      environ = envp;
+    trace_event(TRACE_EXEC, getpid(), args[0], 0);
+    execvp(args[0], args);
+    perror("Error executing command");
+    exit(EXIT_FAILURE);
+  }
+  redir_close(&redir);
+  free(envp);
+  if (pid == -1) {
+    perror("Error at fork");
+    return (1);
+  }
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+    ;
+  return (list_exit_code(status));
+}
+
+/**
+ * Starts the whole list as one background job and adds it to tasks.
+ * Returns its pid or -1.
+ **/
+pid_t list_launch(cmd_list *list) {
+  char *name;
+  job_limits limits = {0};
+  sigset_t block_sigchld, old_mask;
+  pid_t pid_fork;
+  job *new_task;
+
+  limit_add_defaults(&limits);
+  fflush(stdout);
+  sigemptyset(&block_sigchld);
+  sigaddset(&block_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &block_sigchld, &old_mask);
+  pid_fork = fork();
+  if (pid_fork == -1) {
+    perror("Error at fork");
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return (-1);
+  } else if (pid_fork == 0) {
+    new_process_group(getpid());
+    restore_terminal_signals();
+    // The job waits for its own commands, the shell's handlers don't apply
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGALRM, SIG_DFL);
+    sigemptyset(&old_mask);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    limit_apply(&limits);
+    while (list_next(list))
+      last_status = run_command(list->argv);
+    exit(last_status);
+  }
+  new_process_group(pid_fork);
+  expand(list, 0);
+  name = list->argc ? list->argv[0] : list->tokens[0];
+  trace_event(TRACE_FORK, pid_fork, name, 0);
+  new_task = new_job(pid_fork, name, BACKGROUND);
+  new_task->inmortal = 0;
+  new_task->limits = limits.mask;
+  new_task->comm_args = cpy_args(list->argc ? list->argv : list->tokens);
+  // Its comm_args are only the first command, not what the job runs
+  new_task->start_ns = 0;
+  new_task->threadWait = NULL;
+  new_task->isProcWait = 0;
+  new_task->pid_wait = -1;
+  new_task->isAlarmSig = 0;
+  new_task->timeAlarmSig = 0;
+  new_task->initTime = 0;
+  add_job(tasks, new_task);
+  ckpt_sync(new_task);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  list->pos = list->n;
+  return (pid_fork);
+}
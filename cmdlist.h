@@ -0,0 +1,53 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for cmdlist module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _CMDLIST_H
+#define _CMDLIST_H
+
+#include "job_control.h"
+#include "shell.h"
+
+#define LIST_MAX (MAX_LINE / 2) /* Tokens of a line, as args in main */
+
+/**
+ * Enumerations
+ **/
+enum list_op { LIST_SEQ, LIST_AND, LIST_OR }; /* ; && || */
+
+/* Command of a list and the operator that joins it to the previous one */
+typedef struct cmd_elem_ {
+  int first; /* Index of its first token */
+  enum list_op op;
+} cmd_elem;
+
+/* A command line: a; b && c || d [&] */
+typedef struct cmd_list_ {
+  char *tokens[LIST_MAX]; /* NULL after every command */
+  cmd_elem elem[LIST_MAX];
+  int n;
+  int pos; /* Next command to consider */
+  int background; /* The whole list is one background job */
+  char **argv;    /* Current command after $VAR and * expansion */
+  int argc;
+  int argv_cap;
+  char **words;   /* Strings of argv made by the expansion, to free */
+  int n_words;
+  int words_cap;
+} cmd_list;
+
+/**
+ * Public Functions
+ **/
+int list_parse(char **args, int background, cmd_list *list);
+int list_next(cmd_list *list);
+pid_t list_launch(cmd_list *list);
+void list_set_status(int code);
+void list_foreground(int status);
+int list_exit_code(int status);
+
+#endif
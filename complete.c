@@ -0,0 +1,276 @@
+/**
+ * Linux Job Control Shell Project
+ * complete module: Tab completion
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Command names come from a sorted array with the executables of every PATH
+ * directory and the shell builtins, so a Tab is a binary search plus a walk
+ * over the matches. The directories are scanned once and then kept up to
+ * date with inotify: an event only stats the file it names and inserts or
+ * removes that single entry. The argument of fg / bg completes to the
+ * positions in tasks, any other argument to file names.
+ **/
+#include "complete.h"
+#include "event_loop.h"
+#include "shell.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define WATCH_EVENTS                                                           \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |           \
+   IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static char *builtins[] = {
+    "admit",        "after",        "alarm-policy", "alarm-proc",
+    "alarm-signal", "alarm-thread", "at",           "bg",
+    "bgteam",       "builtin",      "cd",           "coproc",
+    "coreq",        "currjob",      "dag",          "deljob",
+    "every",        "exit",         "export",       "fg",
+    "fico",         "hist",         "histclean",    "jobprof",
+    "jobs",         "kill",         "limit",        "mask",
+    "mydaemon",     "profdump",     "sched",        "stop",
+    "trace",        "unset",        "wait",         "zjobs",
+    NULL};
+static comp_entry *index_entries = NULL;
+static int n_entries = 0;
+static int cap_entries = 0;
+static comp_dir dirs[COMP_MAX_DIRS];
+static int n_dirs = 0;
+static int inotify_fd = -1;
+
+// First entry whose name is >= name
+static int lower_bound(const char *name) {
+  int lo = 0, hi = n_entries;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (strcmp(index_entries[mid].name, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (lo);
+}
+
+static void index_add(const char *name, unsigned long long bit) {
+  int pos = lower_bound(name);
+  if (pos < n_entries && !strcmp(index_entries[pos].name, name)) {
+    index_entries[pos].where |= bit;
+    return;
+  }
+  if (n_entries == cap_entries) {
+    cap_entries = cap_entries ? cap_entries * 2 : 1024;
+    index_entries = (comp_entry *)realloc(index_entries,
+                                          cap_entries * sizeof(comp_entry));
+    if (!index_entries) {
+      perror("Error at realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memmove(&index_entries[pos + 1], &index_entries[pos],
+          (n_entries - pos) * sizeof(comp_entry));
+  index_entries[pos].name = strdup(name);
+  index_entries[pos].where = bit;
+  n_entries++;
+}
+
+static void index_remove(const char *name, unsigned long long bit) {
+  int pos = lower_bound(name);
+  if (pos == n_entries || strcmp(index_entries[pos].name, name))
+    return;
+  index_entries[pos].where &= ~bit;
+  if (index_entries[pos].where)
+    return;
+  free(index_entries[pos].name);
+  memmove(&index_entries[pos], &index_entries[pos + 1],
+          (n_entries - pos - 1) * sizeof(comp_entry));
+  n_entries--;
+}
+
+// Is name in the directory a regular file with any x bit?
+static int is_executable(int dir_fd, const char *name) {
+  struct stat st;
+  if (fstatat(dir_fd, name, &st, 0) == -1)
+    return (0);
+  return S_ISREG(st.st_mode) && (st.st_mode & 0111);
+}
+
+// Rereads the name in directory d (after an inotify event)
+static void update_name(int d, const char *name) {
+  int dir_fd = open(dirs[d].path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd != -1 && is_executable(dir_fd, name))
+    index_add(name, 1ULL << d);
+  else
+    index_remove(name, 1ULL << d);
+  if (dir_fd != -1)
+    close(dir_fd);
+}
+
+static void scan_dir(int d) {
+  DIR *dir = opendir(dirs[d].path);
+  struct dirent *ent;
+
+  // Entries of the directory are dropped first, a rescan starts clean
+  for (int i = n_entries; i-- > 0;) {
+    if (index_entries[i].where & (1ULL << d))
+      index_remove(index_entries[i].name, 1ULL << d);
+  }
+  if (!dir)
+    return;
+  while ((ent = readdir(dir))) {
+    if (ent->d_name[0] == '.' || ent->d_type == DT_DIR)
+      continue;
+    if (is_executable(dirfd(dir), ent->d_name))
+      index_add(ent->d_name, 1ULL << d);
+  }
+  closedir(dir);
+}
+
+static void inotify_ready(int fd, short revents, void *data) {
+  char buff[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  while ((len = read(fd, buff, sizeof(buff))) > 0) {
+    for (char *p = buff; p < buff + len;) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // Events were lost, only a full scan is right
+        for (int d = 0; d < n_dirs; d++)
+          scan_dir(d);
+        continue;
+      }
+      for (int d = 0; d < n_dirs; d++) {
+        if (dirs[d].wd != ev->wd)
+          continue;
+        if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+          scan_dir(d);
+        else if (ev->len)
+          update_name(d, ev->name);
+      }
+    }
+  }
+}
+
+/**
+ * Rebuilds the index from the current PATH (call it when PATH changes)
+ **/
+void complete_rescan(void) {
+  char *path = getenv("PATH");
+  char *copy, *dir, *save;
+
+  for (int d = 0; d < n_dirs; d++) {
+    if (dirs[d].wd != -1)
+      inotify_rm_watch(inotify_fd, dirs[d].wd);
+    free(dirs[d].path);
+  }
+  n_dirs = 0;
+  for (int i = 0; i < n_entries; i++)
+    free(index_entries[i].name);
+  n_entries = 0;
+
+  for (int i = 0; builtins[i]; i++)
+    index_add(builtins[i], COMP_BUILTIN);
+  copy = strdup(path ? path : "/usr/bin:/bin");
+  for (dir = strtok_r(copy, ":", &save); dir && n_dirs < COMP_MAX_DIRS;
+       dir = strtok_r(NULL, ":", &save)) {
+    int dup = 0;
+    for (int d = 0; d < n_dirs; d++)
+      dup |= !strcmp(dirs[d].path, dir);
+    if (dup)
+      continue;
+    dirs[n_dirs].path = strdup(dir);
+    dirs[n_dirs].wd = inotify_fd == -1
+                          ? -1
+                          : inotify_add_watch(inotify_fd, dir, WATCH_EVENTS);
+    scan_dir(n_dirs++);
+  }
+  free(copy);
+}
+
+// The matches of a command prefix are a run of the sorted index, so the
+// array readline wants is built straight from it: entry 0 is the common
+// prefix of the first and last match, readline does not compare them all
+static char **command_matches(const char *text) {
+  int first = lower_bound(text), last = first;
+  size_t len = strlen(text), common;
+  char **matches;
+
+  while (last < n_entries && !strncmp(index_entries[last].name, text, len))
+    last++;
+  if (last == first)
+    return NULL;
+  matches = (char **)malloc((last - first + 2) * sizeof(char *));
+  if (!matches)
+    return NULL;
+  for (int i = first; i < last; i++)
+    matches[i - first + 1] = strdup(index_entries[i].name);
+  matches[last - first + 1] = NULL;
+  if (last - first == 1) {
+    matches[0] = matches[1];
+    matches[1] = NULL;
+    return matches;
+  }
+  for (common = len; index_entries[first].name[common] &&
+                     index_entries[first].name[common] ==
+                         index_entries[last - 1].name[common];
+       common++)
+    ;
+  matches[0] = strndup(index_entries[first].name, common);
+  return matches;
+}
+
+// Positions of tasks for fg / bg
+static char *job_generator(const char *text, int state) {
+  static int pos, n;
+  char buff[16];
+  if (!state) {
+    pos = 0;
+    block_SIGCHLD();
+    n = list_size(tasks);
+    unblock_SIGCHLD();
+  }
+  while (pos++ < n) {
+    snprintf(buff, sizeof(buff), "%d", pos);
+    if (!strncmp(buff, text, strlen(text)))
+      return strdup(buff);
+  }
+  return NULL;
+}
+
+static char **shell_completion(const char *text, int start, int end) {
+  int first = start;
+  while (first > 0 && rl_line_buffer[first - 1] == ' ')
+    first--;
+  // First word: a command
+  // The index is sorted and has no duplicates, readline need not sort it
+  rl_sort_completion_matches = first != 0;
+  if (first == 0) {
+    rl_attempted_completion_over = 1;
+    return command_matches(text);
+  }
+  if (!strncmp(rl_line_buffer, "fg ", 3) || !strncmp(rl_line_buffer, "bg ", 3))
+    return rl_completion_matches(text, job_generator);
+  // Anything else: readline's file name completion
+  return NULL;
+}
+
+/**
+ * Installs the completion and builds the index of PATH.
+ * Returns -1 if inotify is not available (completion still works, but the
+ * index is not updated).
+ **/
+int complete_init(void) {
+  rl_attempted_completion_function = shell_completion;
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd != -1)
+    loop_watch_fd(inotify_fd, POLLIN, inotify_ready, NULL);
+  complete_rescan();
+  return inotify_fd == -1 ? -1 : 0;
+}
@@ -0,0 +1,35 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for complete module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _COMPLETE_H
+#define _COMPLETE_H
+
+#include "job_control.h"
+
+#define COMP_MAX_DIRS 63 /* PATH directories indexed, one bit each */
+#define COMP_BUILTIN (1ULL << COMP_MAX_DIRS) /* Bit of the shell builtins */
+
+/* Command name of the index, sorted by name */
+typedef struct comp_entry_ {
+  char *name;
+  unsigned long long where; /* PATH directories holding it (+ builtin) */
+} comp_entry;
+
+/* Indexed PATH directory */
+typedef struct comp_dir_ {
+  char *path;
+  int wd; /* inotify watch, -1 if it could not be watched */
+} comp_dir;
+
+/**
+ * Public Functions
+ **/
+int complete_init(void);
+void complete_rescan(void);
+
+#endif
@@ -0,0 +1,379 @@
+/**
+ * Linux Job Control Shell Project
+ * coproc module: persistent workers (coproc) and their requests (coreq)
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * A worker is started once and then serves many requests, so a small
+ * calculation costs a write and a read instead of a fork and an exec.
+ * It is a background job in tasks, with its stdin and stdout on two
+ * pipes held by the shell. A request is a line. The reply is the next
+ * line, or with -d the lines up to a delimiter line. Replies come back in
+ * order, so several requests can be in flight: coreq -s only sends, and
+ * the next coreq reads every reply still owed.
+ *
+ * Both pipes are non-blocking. While a write has to wait because the
+ * worker is not reading, its output is read ahead into a buffer, so the
+ * two never block each other. The worker must flush every reply
+ * (stdbuf -oL for stdio programs). When its job ends, the notification
+ * drain closes the pipes.
+ **/
+#include "coproc.h"
+#include "notify.h"
+#include "shell.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+static coproc_t workers[COPROC_MAX];
+
+static coproc_t *find(const char *name) {
+  for (int i = 0; i < COPROC_MAX; i++) {
+    if (workers[i].name[0] && !strcmp(workers[i].name, name))
+      return (&workers[i]);
+  }
+  return NULL;
+}
+
+static void close_worker(coproc_t *co) {
+  if (co->to_fd != -1)
+    close(co->to_fd);
+  close(co->from_fd);
+  free(co->buff);
+  memset(co, 0, sizeof(*co));
+}
+
+// Its job ended: the pipes go with it
+static void coproc_event(notify_event_t *ev) {
+  if (ev->kind != NOTIFY_ENDED)
+    return;
+  for (int i = 0; i < COPROC_MAX; i++) {
+    if (workers[i].name[0] && workers[i].pid == ev->pgid)
+      close_worker(&workers[i]);
+  }
+}
+
+/**
+ * Closes the pipes of workers whose job ends
+ **/
+void coproc_init(void) { notify_subscribe(coproc_event); }
+
+// Starts cmd as the worker name. Returns -1 on error
+static int start(const char *name, const char *delim, char **cmd) {
+  sigset_t block_sigchld, old_mask;
+  int in[2], out[2];
+  coproc_t *co = NULL;
+  job *new_task;
+  pid_t pid;
+
+  if (find(name)) {
+    printf("coproc: %s is already running\n", name);
+    return (-1);
+  }
+  for (int i = 0; i < COPROC_MAX && !co; i++) {
+    if (!workers[i].name[0])
+      co = &workers[i];
+  }
+  if (!co) {
+    printf("coproc: no room for more than %d workers\n", COPROC_MAX);
+    return (-1);
+  }
+  if (pipe2(in, O_CLOEXEC) == -1) {
+    perror("Error at pipe");
+    return (-1);
+  }
+  if (pipe2(out, O_CLOEXEC) == -1) {
+    perror("Error at pipe");
+    close(in[0]);
+    close(in[1]);
+    return (-1);
+  }
+
+  fflush(stdout);
+  sigemptyset(&block_sigchld);
+  sigaddset(&block_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &block_sigchld, &old_mask);
+  pid = fork();
+  if (pid == 0) {
+    new_process_group(getpid());
+    restore_terminal_signals();
+    sigemptyset(&old_mask);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    trace_event(TRACE_EXEC, getpid(), cmd[0], 0);
+    execvp(cmd[0], cmd);
+    perror("Error executing command");
+    exit(EXIT_FAILURE);
+  }
+  close(in[0]);
+  close(out[1]);
+  if (pid == -1) {
+    perror("Error at fork");
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    close(in[1]);
+    close(out[0]);
+    return (-1);
+  }
+  new_process_group(pid);
+  trace_event(TRACE_FORK, pid, cmd[0], 0);
+  // Not checkpointed: a new shell could not get the pipes back
+  new_task = new_job(pid, name, BACKGROUND);
+  new_task->inmortal = 0;
+  new_task->limits = 0;
+  new_task->comm_args = cpy_args(cmd);
+  new_task->threadWait = NULL;
+  new_task->isProcWait = 0;
+  new_task->pid_wait = -1;
+  new_task->isAlarmSig = 0;
+  new_task->timeAlarmSig = 0;
+  new_task->initTime = 0;
+  add_job(tasks, new_task);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  memset(co, 0, sizeof(*co));
+  snprintf(co->name, sizeof(co->name), "%s", name);
+  snprintf(co->delim, sizeof(co->delim), "%s", delim ? delim : "");
+  co->pid = pid;
+  co->to_fd = in[1];
+  co->from_fd = out[0];
+  fcntl(co->to_fd, F_SETFL, O_NONBLOCK);
+  fcntl(co->from_fd, F_SETFL, O_NONBLOCK);
+  printf("Coprocess %s running... pid: %d, command: %s\n", name, pid, cmd[0]);
+  return (0);
+}
+
+// Reads what the worker has written. Returns 0 at EOF, -1 on error
+static int fill(coproc_t *co) {
+  ssize_t n;
+
+  if (co->start > 0 && co->len == co->cap) {
+    memmove(co->buff, co->buff + co->start, co->len - co->start);
+    co->len -= co->start;
+    co->start = 0;
+  }
+  if (co->len == co->cap) {
+    size_t cap = co->cap ? co->cap * 2 : 4096;
+    char *aux;
+    if (cap > COPROC_PENDING) {
+      fprintf(stderr, "coreq: %s: too much output not asked for\n",
+              co->name);
+      return (-1);
+    }
+    aux = (char *)realloc(co->buff, cap);
+    if (!aux) {
+      perror("Error at realloc");
+      return (-1);
+    }
+    co->buff = aux;
+    co->cap = cap;
+  }
+  n = read(co->from_fd, co->buff + co->len, co->cap - co->len);
+  if (n > 0)
+    co->len += n;
+  if (n == -1 && errno != EAGAIN && errno != EINTR) {
+    perror("Error at read");
+    return (-1);
+  }
+  return (n != 0);
+}
+
+// Waits for output of the worker, or with writing for room in its stdin.
+// Output that arrives is read ahead. Returns -1 on error or timeout
+static int wait_worker(coproc_t *co, int writing) {
+  struct pollfd pfd[2];
+  int ready;
+
+  pfd[0].fd = co->from_fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = co->to_fd;
+  pfd[1].events = POLLOUT;
+  ready = poll(pfd, writing ? 2 : 1, COPROC_TIMEOUT_MS);
+  if (ready == -1 && errno == EINTR)
+    return (0);
+  if (ready == -1) {
+    perror("Error at poll");
+    return (-1);
+  }
+  if (!ready) {
+    fprintf(stderr, "coreq: %s did not answer in %ds\n", co->name,
+            COPROC_TIMEOUT_MS / 1000);
+    return (-1);
+  }
+  if (pfd[0].revents) {
+    int ret = fill(co);
+    if (ret == 0)
+      fprintf(stderr, "coreq: %s has ended\n", co->name);
+    if (ret <= 0)
+      return (-1);
+  }
+  return (0);
+}
+
+static int send_line(coproc_t *co, const char *line, size_t len) {
+  struct timespec zero = {0, 0};
+  sigset_t pipe_set, old;
+  size_t off = 0;
+
+  // A worker that is gone gives EPIPE instead of killing the shell
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_set, &old);
+  while (off < len) {
+    ssize_t n = write(co->to_fd, line + off, len - off);
+    if (n > 0) {
+      off += n;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN) {
+      if (wait_worker(co, 1) == 0)
+        continue;
+    } else if (errno == EPIPE)
+      fprintf(stderr, "coreq: %s has ended\n", co->name);
+    else
+      perror("Error at write");
+    break;
+  }
+  while (sigtimedwait(&pipe_set, NULL, &zero) > 0)
+    ;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return (off == len ? 0 : -1);
+}
+
+// Prints the next reply: a line, or the lines before the delimiter
+static int read_reply(coproc_t *co) {
+  size_t delim_len = strlen(co->delim);
+
+  for (;;) {
+    char *line = co->buff + co->start;
+    char *nl = co->len > co->start
+                   ? memchr(line, '\n', co->len - co->start)
+                   : NULL;
+    size_t line_len;
+    int end;
+    if (!nl) {
+      if (wait_worker(co, 0) == -1)
+        return (-1);
+      continue;
+    }
+    line_len = nl - line;
+    end = !delim_len ||
+          (line_len == delim_len && !memcmp(line, co->delim, delim_len));
+    if (!delim_len || !end)
+      fwrite(line, 1, line_len + 1, stdout);
+    co->start += line_len + 1;
+    if (co->start == co->len)
+      co->start = co->len = 0;
+    if (end)
+      return (0);
+  }
+}
+
+/**
+ * coproc [-d delimiter] name cmd [args...] starts a worker, coproc lists
+ * them and coproc -c name closes the stdin of one (it ends once it sees
+ * EOF)
+ **/
+void coproc_builtin(char **args) {
+  const char *delim = NULL;
+  int i = 1;
+
+  if (!args[1]) {
+    for (int k = 0; k < COPROC_MAX; k++) {
+      coproc_t *co = &workers[k];
+      if (!co->name[0])
+        continue;
+      printf("[%s] pid: %d, requests: %ld, outstanding: %d%s%s%s\n",
+             co->name, co->pid, co->requests, co->outstanding,
+             co->delim[0] ? ", delimiter: " : "", co->delim,
+             co->to_fd == -1 ? ", closed" : "");
+    }
+    return;
+  }
+  if (!strcmp(args[1], "-c") && args[2] && !args[3]) {
+    coproc_t *co = find(args[2]);
+    if (!co) {
+      printf("coproc: no worker %s\n", args[2]);
+      return;
+    }
+    if (co->to_fd != -1)
+      close(co->to_fd);
+    co->to_fd = -1;
+    return;
+  }
+  if (!strcmp(args[1], "-d") && args[2]) {
+    delim = args[2];
+    i = 3;
+  }
+  if (!args[i] || !args[i + 1] || strlen(args[i]) >= COPROC_NAME ||
+      (delim && strlen(delim) >= COPROC_DELIM)) {
+    printf("Usage: coproc [-d delimiter] name cmd [args...] | coproc -c "
+           "name\n");
+    return;
+  }
+  start(args[i], delim, &args[i + 1]);
+}
+
+/**
+ * coreq name words... sends them as a line and prints the reply (and any
+ * reply still owed before it). coreq -s only sends, coreq -r name only
+ * reads what is owed. Returns the exit status.
+ **/
+int coreq_builtin(char **args) {
+  int send_only = 0, read_only = 0, i = 1;
+  size_t len = 0;
+  coproc_t *co;
+  char *line;
+
+  if (args[1] && !strcmp(args[1], "-s"))
+    send_only = i++;
+  else if (args[1] && !strcmp(args[1], "-r"))
+    read_only = i++;
+  if (!args[i] || (read_only && args[i + 1]) || (!read_only && !args[i + 1])) {
+    printf("Usage: coreq [-s] name words... | coreq -r name\n");
+    return (2);
+  }
+  co = find(args[i]);
+  if (!co) {
+    printf("coreq: no worker %s\n", args[i]);
+    return (1);
+  }
+
+  if (!read_only) {
+    if (co->to_fd == -1) {
+      printf("coreq: the input of %s is closed\n", co->name);
+      return (1);
+    }
+    for (int k = i + 1; args[k]; k++)
+      len += strlen(args[k]) + 1;
+    line = (char *)malloc(len + 1);
+    if (!line) {
+      perror("Error at malloc");
+      return (1);
+    }
+    len = 0;
+    for (int k = i + 1; args[k]; k++)
+      len += sprintf(line + len, "%s%s", args[k], args[k + 1] ? " " : "\n");
+    if (send_line(co, line, len) == -1) {
+      free(line);
+      return (1);
+    }
+    free(line);
+    co->outstanding++;
+    co->requests++;
+    if (send_only)
+      return (0);
+  }
+  for (; co->outstanding > 0; co->outstanding--) {
+    if (read_reply(co) == -1)
+      return (1);
+  }
+  fflush(stdout);
+  return (0);
+}
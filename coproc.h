@@ -0,0 +1,42 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for coproc module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _COPROC_H
+#define _COPROC_H
+
+#include "job_control.h"
+
+#define COPROC_MAX 16                /* Workers running at the same time */
+#define COPROC_NAME 32
+#define COPROC_DELIM 32              /* Line that ends a multi-line reply */
+#define COPROC_TIMEOUT_MS 10000      /* Longest wait for a reply */
+#define COPROC_PENDING (1024 * 1024) /* Replies read ahead, not asked for */
+
+/* Persistent worker: requests go to its stdin, replies come from stdout */
+typedef struct coproc_t_ {
+  char name[COPROC_NAME]; /* "" for a free slot */
+  pid_t pid;
+  int to_fd;   /* Its stdin, -1 once closed */
+  int from_fd; /* Its stdout */
+  char delim[COPROC_DELIM]; /* "" : every line is a reply */
+  int outstanding; /* Requests sent whose reply was not read */
+  char *buff;      /* Output read ahead, unread from start to len */
+  size_t start;
+  size_t len;
+  size_t cap;
+  long requests;
+} coproc_t;
+
+/**
+ * Public Functions
+ **/
+void coproc_init(void);
+void coproc_builtin(char **args);
+int coreq_builtin(char **args);
+
+#endif
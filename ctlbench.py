@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+# Throughput of the control socket: pipelines N submit requests and counts
+# the replies.
+#
+#   ./a.out --listen /tmp/shell.sock < /dev/null &
+#   ./ctlbench.py /tmp/shell.sock [N] [command line]
+#
+# Requests go out in one stream while the replies are read back, so the
+# shell is never waiting for the client. N defaults to 100000 and the
+# command to "true". Exits with 1 if any reply is not "ok".
+import socket
+import sys
+import threading
+import time
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: ctlbench.py socket [n] [command line]")
+        return 2
+    path = sys.argv[1]
+    n = int(sys.argv[2]) if len(sys.argv) > 2 else 100000
+    command = " ".join(sys.argv[3:]) or "true"
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+    request = ("submit %s\n" % command).encode()
+
+    def writer():
+        chunk = request * 1000
+        left = n
+        while left > 0:
+            k = min(left, 1000)
+            sock.sendall(chunk if k == 1000 else request * k)
+            left -= k
+
+    start = time.monotonic()
+    threading.Thread(target=writer, daemon=True).start()
+    ok = errors = 0
+    pending = b""
+    while ok + errors < n:
+        data = sock.recv(65536)
+        if not data:
+            break
+        pending += data
+        lines = pending.split(b"\n")
+        pending = lines.pop()
+        for line in lines:
+            if line.startswith(b"ok"):
+                ok += 1
+            else:
+                errors += 1
+                if errors <= 5:
+                    print("reply: %s" % line.decode(errors="replace"))
+    secs = time.monotonic() - start
+    sock.close()
+
+    print("%d submits: %d ok, %d errors in %.1fs (%.0f jobs/s)" %
+          (n, ok, errors, secs, (ok + errors) / secs if secs else 0))
+    return 0 if ok == n else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,398 @@
+/**
+ * Linux Job Control Shell Project
+ * ctlsock module: control server on a local UNIX socket (--listen path)
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Requests are newline terminated and every reply is one line starting with
+ * "ok" or "error":
+ *   submit <command line>   --> ok <pid> (ok 0 if admission queued it)
+ *   list                    --> ok [{"pos":1,"pid":...}, ...]
+ *   signal <pid> <sig>      --> ok
+ *   wait <pid>              --> ok <Exited|Signaled> <info> (once it ends)
+ *   shutdown                --> ok, then the shell exits
+ * The socket is served from the prompt event loop. A submitted line is
+ * taken as if typed with & at the prompt: variables and wildcards are
+ * expanded, a list is one job, and a single command goes through
+ * submit_job() (VAR=x and limit prefixes, redirections, admission).
+ * ctlbench.py drives it with pipelined submits to measure throughput.
+ **/
+#include "ctlsock.h"
+#include "cmdlist.h"
+#include "event_loop.h"
+#include "jobspec.h"
+#include "notify.h"
+#include "shell.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static int listen_fd = -1;
+static pid_t listen_owner = 0;
+static char listen_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static ctl_client *clients = NULL;
+static ctl_waiter *waiters = NULL;
+
+static void client_ready(int fd, short revents, void *data);
+
+static void reply(ctl_client *client, const char *fmt, ...) {
+  va_list ap;
+  int len;
+
+  for (;;) {
+    va_start(ap, fmt);
+    len = vsnprintf(client->out + client->out_len,
+                    client->out_cap - client->out_len, fmt, ap);
+    va_end(ap);
+    if (client->out_len + len < client->out_cap)
+      break;
+    int cap = client->out_cap ? client->out_cap * 2 : CTL_BUFF;
+    while (cap <= client->out_len + len)
+      cap *= 2;
+    char *aux = (char *)realloc(client->out, cap);
+    if (!aux) {
+      perror("Error at realloc");
+      return;
+    }
+    client->out = aux;
+    client->out_cap = cap;
+  }
+  client->out_len += len;
+}
+
+static void close_client(ctl_client *client) {
+  ctl_client **aux = &clients;
+  ctl_waiter **w = &waiters;
+
+  while (*w) {
+    if ((*w)->client == client) {
+      ctl_waiter *old = *w;
+      *w = old->next;
+      free(old);
+    } else {
+      w = &(*w)->next;
+    }
+  }
+  while (*aux && *aux != client)
+    aux = &(*aux)->next;
+  if (*aux)
+    *aux = client->next;
+  loop_unwatch_fd(client->fd);
+  close(client->fd);
+  free(client->out);
+  free(client);
+}
+
+// Writes pending replies, stops reading requests while the client is slow
+// to read its replies. Returns -1 if the client went away.
+static int flush_client(ctl_client *client) {
+  while (client->out_len > 0) {
+    ssize_t n = write(client->fd, client->out, client->out_len);
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      if (errno == EINTR)
+        continue;
+      close_client(client);
+      return (-1);
+    }
+    memmove(client->out, client->out + n, client->out_len - n);
+    client->out_len -= n;
+  }
+  if (client->out_len == 0)
+    loop_modify_fd(client->fd, POLLIN);
+  else if (client->out_len > 16 * CTL_BUFF)
+    loop_modify_fd(client->fd, POLLOUT);
+  else
+    loop_modify_fd(client->fd, POLLIN | POLLOUT);
+  return (0);
+}
+
+static void reply_status(ctl_client *client, int status) {
+  int info;
+  enum status status_res = analyze_status(status, &info);
+  reply(client, "ok %s %d\n", status_strings[status_res], info);
+}
+
+// Every ended job: answer the clients waiting for it
+static void job_event(notify_event_t *ev) {
+  ctl_waiter **w = &waiters;
+
+  if (ev->kind != NOTIFY_ENDED)
+    return;
+
+  while (*w) {
+    if ((*w)->pid == ev->pgid) {
+      ctl_waiter *old = *w;
+      *w = old->next;
+      reply_status(old->client, ev->info);
+      // Flushed by the loop: writing here could close clients under us
+      loop_modify_fd(old->client->fd, POLLIN | POLLOUT);
+      free(old);
+    } else {
+      w = &(*w)->next;
+    }
+  }
+}
+
+static void json_string(ctl_client *client, const char *str) {
+  reply(client, "\"");
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\')
+      reply(client, "\\%c", *str);
+    else if ((unsigned char)*str < 0x20)
+      reply(client, "\\u%04x", *str);
+    else
+      reply(client, "%c", *str);
+  }
+  reply(client, "\"");
+}
+
+static void do_submit(ctl_client *client, char *line) {
+  static cmd_list cmds; // Owns the words of the last expansion
+  char inputBuffer[MAX_LINE];
+  char *args[MAX_LINE / 2];
+  const char *err = "launch failed";
+  int background;
+  int len = strlen(line);
+  pid_t pid;
+
+  if (len == 0 || len >= MAX_LINE - 1) {
+    reply(client, "error bad command length\n");
+    return;
+  }
+  memcpy(inputBuffer, line, len);
+  inputBuffer[len] = '\n';
+  inputBuffer[len + 1] = '\0';
+  get_command(inputBuffer, MAX_LINE, args, &background);
+  if (args[0] == NULL) {
+    reply(client, "error empty command\n");
+    return;
+  }
+  if (list_parse(args, 1, &cmds) == -1) {
+    reply(client, "error syntax error\n");
+    return;
+  }
+  if (cmds.n > 1)
+    pid = list_launch(&cmds);
+  else if (list_next(&cmds))
+    pid = submit_job(cmds.argv, &err);
+  else {
+    reply(client, "error empty command\n");
+    return;
+  }
+  if (pid == -1)
+    reply(client, "error %s\n", err);
+  else
+    reply(client, "ok %d\n", pid);
+}
+
+static void do_list(ctl_client *client) {
+  int n = 1;
+
+  reply(client, "ok [");
+  block_SIGCHLD();
+  for (job *item = get_iterator(tasks); item; item = item->next, n++) {
+    reply(client, "%s{\"pos\":%d,\"pid\":%d,\"command\":", n > 1 ? "," : "",
+          n, item->pgid);
+    json_string(client, item->command);
+    reply(client, ",\"state\":\"%s\",\"inmortal\":%s}",
+          state_strings[item->state], item->inmortal ? "true" : "false");
+  }
+  unblock_SIGCHLD();
+  reply(client, "]\n");
+}
+
+static void do_signal(ctl_client *client, char *arg) {
+  char *sig_str;
+  pid_t pid = strtol(arg, &sig_str, 10);
+  int sig;
+  job *item;
+
+  while (*sig_str == ' ')
+    sig_str++;
+  sig = spec_signal(sig_str);
+  if (pid <= 0 || sig <= 0) {
+    reply(client, "error usage: signal <pid> <sig>\n");
+    return;
+  }
+  block_SIGCHLD();
+  item = get_item_bypid(tasks, pid);
+  if (item)
+    killpg(item->pgid, sig);
+  unblock_SIGCHLD();
+  if (item)
+    reply(client, "ok\n");
+  else
+    reply(client, "error no such job %d\n", pid);
+}
+
+static void do_wait(ctl_client *client, char *arg) {
+  pid_t pid = atoi(arg);
+  int status;
+  job *item;
+
+  // Events not drained yet would be missing from tasks and recent exits
+  notify_drain();
+  block_SIGCHLD();
+  item = get_item_bypid(tasks, pid);
+  unblock_SIGCHLD();
+  if (item) {
+    ctl_waiter *w = (ctl_waiter *)malloc(sizeof(ctl_waiter));
+    if (!w) {
+      reply(client, "error out of memory\n");
+      return;
+    }
+    w->client = client;
+    w->pid = pid;
+    w->next = waiters;
+    waiters = w;
+    return;
+  }
+  // It may have ended after the first drain
+  notify_drain();
+  if (notify_recent_status(pid, &status))
+    reply_status(client, status);
+  else
+    reply(client, "error no such job %d\n", pid);
+}
+
+static void handle_line(ctl_client *client, char *line) {
+  if (!strncmp(line, "submit ", 7))
+    do_submit(client, line + 7);
+  else if (!strcmp(line, "list"))
+    do_list(client);
+  else if (!strncmp(line, "signal ", 7))
+    do_signal(client, line + 7);
+  else if (!strncmp(line, "wait ", 5))
+    do_wait(client, line + 5);
+  else if (!strcmp(line, "shutdown")) {
+    reply(client, "ok\n");
+    fcntl(client->fd, F_SETFL, 0);
+    flush_client(client);
+    printf("Bye\n");
+    exit(EXIT_SUCCESS);
+  } else
+    reply(client, "error unknown request\n");
+}
+
+static void client_ready(int fd, short revents, void *data) {
+  ctl_client *client = (ctl_client *)data;
+  char *start, *end;
+  ssize_t n;
+
+  if ((revents & POLLOUT) && flush_client(client) == -1)
+    return;
+  if (!(revents & (POLLIN | POLLHUP | POLLERR)))
+    return;
+
+  n = read(fd, client->in + client->in_len, CTL_BUFF - client->in_len);
+  if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+    close_client(client);
+    return;
+  }
+  if (n > 0)
+    client->in_len += n;
+
+  start = client->in;
+  while ((end = memchr(start, '\n', client->in + client->in_len - start))) {
+    *end = '\0';
+    if (end > start && end[-1] == '\r')
+      end[-1] = '\0';
+    handle_line(client, start);
+    start = end + 1;
+  }
+  client->in_len -= start - client->in;
+  memmove(client->in, start, client->in_len);
+  if (client->in_len == CTL_BUFF) {
+    reply(client, "error request too long\n");
+    client->in_len = 0;
+  }
+  flush_client(client);
+}
+
+static void listen_ready(int fd, short revents, void *data) {
+  int client_fd;
+
+  while ((client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) !=
+         -1) {
+    ctl_client *client = (ctl_client *)calloc(1, sizeof(ctl_client));
+    if (!client || loop_watch_fd(client_fd, POLLIN, client_ready, client)) {
+      fprintf(stderr, "Too many control clients\n");
+      free(client);
+      close(client_fd);
+      continue;
+    }
+    client->fd = client_fd;
+    client->next = clients;
+    clients = client;
+  }
+}
+
+static void ctl_cleanup(void) {
+  // Children that fail to exec also run atexit handlers
+  if (listen_fd != -1 && getpid() == listen_owner)
+    unlink(listen_path);
+}
+
+/**
+ * Starts listening on a UNIX socket at path. Returns -1 on error.
+ **/
+int ctl_listen(const char *path) {
+  struct sockaddr_un addr;
+  struct stat st;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return (-1);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  // A socket left behind by a previous shell is replaced
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1) {
+    perror("Error at socket");
+    return (-1);
+  }
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(listen_fd, SOMAXCONN) == -1) {
+    perror("Error listening on control socket");
+    close(listen_fd);
+    listen_fd = -1;
+    return (-1);
+  }
+  strcpy(listen_path, path);
+  listen_owner = getpid();
+  atexit(ctl_cleanup);
+  notify_subscribe(job_event);
+  return loop_watch_fd(listen_fd, POLLIN, listen_ready, NULL);
+}
+
+/**
+ * Returns 1 if the control socket is open
+ **/
+int ctl_active(void) { return listen_fd != -1; }
+
+/**
+ * Serves only the control socket, used once stdin is closed. Returns when a
+ * client sends shutdown (which exits) or on a poll error.
+ **/
+void ctl_serve(void) {
+  for (;;) {
+    if (loop_poll_once(-1) == -1 && errno != EINTR) {
+      perror("Error at poll");
+      return;
+    }
+  }
+}
@@ -0,0 +1,41 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for ctlsock module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _CTLSOCK_H
+#define _CTLSOCK_H
+
+#include "job_control.h"
+
+#define CTL_BUFF 4096 /* Longest request line */
+
+/* Connected client of the control socket */
+typedef struct ctl_client_ {
+  int fd;
+  char in[CTL_BUFF]; /* Partial request line */
+  int in_len;
+  char *out; /* Pending replies */
+  int out_len;
+  int out_cap;
+  struct ctl_client_ *next;
+} ctl_client;
+
+/* Pending wait request */
+typedef struct ctl_waiter_ {
+  ctl_client *client;
+  pid_t pid;
+  struct ctl_waiter_ *next;
+} ctl_waiter;
+
+/**
+ * Public Functions
+ **/
+int ctl_listen(const char *path);
+int ctl_active(void);
+void ctl_serve(void);
+
+#endif
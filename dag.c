@@ -0,0 +1,471 @@
+/**
+ * Linux Job Control Shell Project
+ * dag module: after builtin and dependency graph runs
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * A run is a set of nodes; a node turns into a background job in tasks
+ * once every dependency has exited with status 0. Like inmortal relaunch,
+ * ready nodes are released from the prompt loop when the NOTIFY_ENDED of a
+ * dependency is drained, never from the SIGCHLD handler, which only reaps.
+ * The final report is printed when NOTIFY_DAG_DONE is drained.
+ *
+ * DAG file format, one node per line ('#' starts a comment):
+ *   <name> [<dependency> ...] : <command> [args...]
+ **/
+#include "dag.h"
+#include "jobsched.h"
+#include "notify.h"
+#include "shell.h"
+
+#include <ctype.h>
+
+static dag_run *runs = NULL;
+static int next_run_id = 1;
+
+static int depends_on(dag_node *node, int parent) {
+  for (int i = 0; i < node->n_deps; i++) {
+    if (node->deps[i] == parent)
+      return 1;
+  }
+  return 0;
+}
+
+// A node did not succeed: nothing that depends on it will ever run
+static void cancel_descendants(dag_run *run, int failed) {
+  for (int i = 0; i < run->n_nodes; i++) {
+    dag_node *node = &run->nodes[i];
+    if (node->state == DAG_WAITING && depends_on(node, failed)) {
+      node->state = DAG_CANCELLED;
+      run->finished++;
+      cancel_descendants(run, i);
+    }
+  }
+}
+
+// Launches every node without pending dependencies, up to the cap
+static void release_ready(dag_run *run) {
+  for (int i = 0; i < run->n_nodes; i++) {
+    dag_node *node = &run->nodes[i];
+    if (run->max_running && run->running >= run->max_running)
+      return;
+    if (node->state != DAG_WAITING || node->pending)
+      continue;
+    node->pid = launch_background(node->comm_args);
+    node->start_ns = monotonic_ns();
+    if (node->pid == -1) {
+      node->state = DAG_FAILED;
+      node->end_ns = node->start_ns;
+      run->finished++;
+      cancel_descendants(run, i);
+      continue;
+    }
+    node->state = DAG_RUNNING;
+    run->running++;
+  }
+}
+
+static int succeeded(int status) {
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void node_finished(dag_run *run, int n, int status) {
+  dag_node *node = &run->nodes[n];
+
+  node->end_ns = monotonic_ns();
+  node->status = status;
+  node->state = succeeded(status) ? DAG_DONE : DAG_FAILED;
+  run->running--;
+  run->finished++;
+  if (node->state == DAG_FAILED) {
+    cancel_descendants(run, n);
+    return;
+  }
+  for (int i = 0; i < run->n_nodes; i++) {
+    if (run->nodes[i].state == DAG_WAITING && depends_on(&run->nodes[i], n))
+      run->nodes[i].pending--;
+  }
+}
+
+// An external dependency (after) has ended
+static void ext_dep_finished(dag_run *run, int n, int status) {
+  dag_node *node = &run->nodes[n];
+  if (succeeded(status)) {
+    node->pending--;
+    return;
+  }
+  node->state = DAG_CANCELLED;
+  run->finished++;
+  cancel_descendants(run, n);
+}
+
+// A job ended: updates the nodes waiting for it and releases the ones that
+// became ready
+static void dependency_ended(pid_t pid, int status) {
+  for (dag_run *run = runs; run; run = run->next) {
+    int touched = 0;
+    for (int i = 0; i < run->n_nodes; i++) {
+      dag_node *node = &run->nodes[i];
+      if (node->state == DAG_RUNNING && node->pid == pid) {
+        node_finished(run, i, status);
+        touched = 1;
+        continue;
+      }
+      for (int e = 0; e < node->n_ext_deps; e++) {
+        if (node->state == DAG_WAITING && node->ext_deps[e] == pid) {
+          ext_dep_finished(run, i, status);
+          touched = 1;
+        }
+      }
+    }
+    if (!touched)
+      continue;
+    release_ready(run);
+    if (run->finished == run->n_nodes)
+      notify_push(NOTIFY_DAG_DONE, run->id, NULL, 0);
+  }
+}
+
+static void free_run(dag_run *run) {
+  for (int i = 0; i < run->n_nodes; i++) {
+    free(run->nodes[i].name);
+    // Nodes of a DAG file that failed to parse may have no command yet
+    if (run->nodes[i].comm_args)
+      free_pp_char(run->nodes[i].comm_args);
+  }
+  free(run->nodes);
+  free(run);
+}
+
+// Longest chain of nodes that actually ran, following the parent that
+// finished last (the one that released each node)
+static void print_critical_path(dag_run *run) {
+  int path[run->n_nodes];
+  int len = 0;
+  int last = -1;
+
+  for (int i = 0; i < run->n_nodes; i++) {
+    dag_node *node = &run->nodes[i];
+    if ((node->state == DAG_DONE || node->state == DAG_FAILED) &&
+        (last == -1 || node->end_ns > run->nodes[last].end_ns))
+      last = i;
+  }
+  while (last != -1) {
+    int parent = -1;
+    path[len++] = last;
+    for (int d = 0; d < run->nodes[last].n_deps; d++) {
+      int dep = run->nodes[last].deps[d];
+      if (parent == -1 || run->nodes[dep].end_ns > run->nodes[parent].end_ns)
+        parent = dep;
+    }
+    last = parent;
+  }
+  if (!len)
+    return;
+  printf("Critical path (%.3fs):",
+         (run->nodes[path[0]].end_ns - run->nodes[path[len - 1]].start_ns) /
+             1e9);
+  for (int i = len - 1; i >= 0; i--)
+    printf(" %s%s", run->nodes[path[i]].name, i ? " ->" : "\n");
+}
+
+static void report_run(dag_run *run) {
+  int count[DAG_CANCELLED + 1] = {0};
+
+  for (int i = 0; i < run->n_nodes; i++)
+    count[run->nodes[i].state]++;
+  printf("DAG [%d] finished in %.3fs: %d done, %d failed, %d cancelled\n",
+         run->id, (monotonic_ns() - run->start_ns) / 1e9, count[DAG_DONE],
+         count[DAG_FAILED], count[DAG_CANCELLED]);
+  print_critical_path(run);
+}
+
+// Prompt loop side: report and free finished runs
+static void dag_event(notify_event_t *ev) {
+  if (ev->kind == NOTIFY_ENDED) {
+    dependency_ended(ev->pgid, ev->info);
+    return;
+  }
+  if (ev->kind != NOTIFY_DAG_DONE)
+    return;
+  for (;;) {
+    dag_run **aux = &runs;
+    block_SIGCHLD();
+    while (*aux && (*aux)->finished < (*aux)->n_nodes)
+      aux = &(*aux)->next;
+    dag_run *run = *aux;
+    if (run)
+      *aux = run->next;
+    unblock_SIGCHLD();
+    if (!run)
+      return;
+    report_run(run);
+    free_run(run);
+  }
+}
+
+/**
+ * Registers the dag module in the notification drain
+ **/
+void dag_init(void) { notify_subscribe(dag_event); }
+
+// Links a new run and releases its first nodes, SIGCHLD must be blocked
+static void start_run(dag_run *run) {
+  run->id = next_run_id++;
+  run->start_ns = monotonic_ns();
+  run->next = runs;
+  runs = run;
+  release_ready(run);
+  if (run->finished == run->n_nodes)
+    notify_push(NOTIFY_DAG_DONE, run->id, NULL, 0);
+}
+
+static dag_run *new_run(int n_nodes) {
+  dag_run *run = (dag_run *)calloc(1, sizeof(dag_run));
+  if (run)
+    run->nodes = (dag_node *)calloc(n_nodes, sizeof(dag_node));
+  if (!run || !run->nodes) {
+    perror("Error at calloc");
+    free(run);
+    return NULL;
+  }
+  run->n_nodes = n_nodes;
+  return run;
+}
+
+static int is_number(const char *str) {
+  if (!*str)
+    return 0;
+  for (; *str; str++) {
+    if (!isdigit((unsigned char)*str))
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * after <pid | %pos> ... cmd [args...]
+ * Launches cmd in background once every listed job has exited with 0.
+ **/
+void after_builtin(char **args) {
+  int i = 1;
+  int status;
+
+  while (args[i] && (is_number(args[i]) ||
+                     (args[i][0] == '%' && is_number(&args[i][1]))))
+    i++;
+  if (i == 1 || !args[i] || i - 1 > DAG_MAX_DEPS) {
+    printf("Usage: after <pid | %%pos> ... cmd [args...]\n");
+    return;
+  }
+
+  dag_run *run = new_run(1);
+  if (!run)
+    return;
+  dag_node *node = &run->nodes[0];
+  node->name = strdup(args[i]);
+  node->comm_args = cpy_args(&args[i]);
+
+  // Jobs that ended a moment ago must be in the recent exits already
+  notify_drain();
+  block_SIGCHLD();
+  for (int d = 1; d < i; d++) {
+    job *item;
+    pid_t pid;
+    if (args[d][0] == '%') {
+      item = get_item_bypos(tasks, atoi(&args[d][1]));
+      pid = item ? item->pgid : -1;
+    } else {
+      pid = atoi(args[d]);
+      item = get_item_bypid(tasks, pid);
+    }
+    if (item) {
+      node->ext_deps[node->n_ext_deps++] = pid;
+      node->pending++;
+    } else if (pid > 0 && notify_recent_status(pid, &status)) {
+      if (!succeeded(status)) {
+        printf("after: job %d did not succeed, %s cancelled\n", pid,
+               node->name);
+        node->state = DAG_CANCELLED;
+        run->finished = 1;
+      }
+    } else {
+      unblock_SIGCHLD();
+      printf("after: no such job %s\n", args[d]);
+      free_run(run);
+      return;
+    }
+  }
+  start_run(run);
+  printf("DAG [%d]: %s waits for %d job(s)\n", run->id, node->name,
+         node->pending);
+  unblock_SIGCHLD();
+}
+
+static int find_node(dag_run *run, int n, const char *name) {
+  for (int i = 0; i < n; i++) {
+    if (!strcmp(run->nodes[i].name, name))
+      return i;
+  }
+  return -1;
+}
+
+// Kahn's algorithm: returns 1 if every node can eventually run
+static int is_acyclic(dag_run *run) {
+  int pending[run->n_nodes];
+  int removed = 0, progress = 1;
+
+  for (int i = 0; i < run->n_nodes; i++)
+    pending[i] = run->nodes[i].n_deps;
+  while (progress) {
+    progress = 0;
+    for (int i = 0; i < run->n_nodes; i++) {
+      if (pending[i] != 0)
+        continue;
+      pending[i] = -1;
+      removed++;
+      progress = 1;
+      for (int c = 0; c < run->n_nodes; c++) {
+        if (depends_on(&run->nodes[c], i))
+          pending[c]--;
+      }
+    }
+  }
+  return removed == run->n_nodes;
+}
+
+// Parses a DAG file into a new run. Returns NULL on error
+static dag_run *load_dag(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[1024];
+  char *toks[MAX_LINE / 2];
+  char **lines = NULL;
+  int n = 0, cap = 0, lineno = 0;
+  dag_run *run = NULL;
+
+  if (!f) {
+    perror("Error opening dag file");
+    return NULL;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    char *p = line;
+    while (isspace((unsigned char)*p))
+      p++;
+    if (!*p || *p == '#')
+      continue;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 16;
+      lines = (char **)realloc(lines, cap * sizeof(char *));
+    }
+    lines[n++] = strdup(p);
+  }
+  fclose(f);
+  if (!n) {
+    printf("dag: %s has no nodes\n", path);
+    free(lines);
+    return NULL;
+  }
+
+  run = new_run(n);
+  if (!run)
+    goto out;
+  // First pass: names, so dependencies may be declared in any order
+  for (int i = 0; i < n; i++) {
+    char *save;
+    char *copy = strdup(lines[i]);
+    run->nodes[i].name = strdup(strtok_r(copy, " \t\n", &save));
+    free(copy);
+    if (find_node(run, i, run->nodes[i].name) != -1) {
+      printf("dag: duplicated node %s\n", run->nodes[i].name);
+      goto fail;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    dag_node *node = &run->nodes[i];
+    char *save;
+    int ntok = 0, colon = -1;
+    lineno = i + 1;
+    for (char *t = strtok_r(lines[i], " \t\n", &save);
+         t && ntok < MAX_LINE / 2 - 1; t = strtok_r(NULL, " \t\n", &save)) {
+      if (colon == -1 && !strcmp(t, ":"))
+        colon = ntok;
+      toks[ntok++] = t;
+    }
+    toks[ntok] = NULL;
+    if (colon == -1 || colon == ntok - 1 || colon - 1 > DAG_MAX_DEPS) {
+      printf("dag: node %d: expected <name> [deps...] : <command>\n", lineno);
+      goto fail;
+    }
+    for (int d = 1; d < colon; d++) {
+      int dep = find_node(run, n, toks[d]);
+      if (dep == -1 || dep == i) {
+        printf("dag: node %s: bad dependency %s\n", node->name, toks[d]);
+        goto fail;
+      }
+      node->deps[node->n_deps++] = dep;
+    }
+    node->pending = node->n_deps;
+    node->comm_args = cpy_args(&toks[colon + 1]);
+  }
+  if (!is_acyclic(run)) {
+    printf("dag: %s has a dependency cycle\n", path);
+    goto fail;
+  }
+  goto out;
+
+fail:
+  free_run(run);
+  run = NULL;
+out:
+  for (int i = 0; i < n; i++)
+    free(lines[i]);
+  free(lines);
+  return run;
+}
+
+static void print_runs(void) {
+  printf("DAG runs:\n");
+  block_SIGCHLD();
+  for (dag_run *run = runs; run; run = run->next) {
+    printf(" [%d] nodes: %d, running: %d, finished: %d, max running: %d\n",
+           run->id, run->n_nodes, run->running, run->finished,
+           run->max_running);
+    for (int i = 0; i < run->n_nodes; i++) {
+      dag_node *node = &run->nodes[i];
+      printf("   %s: %s", node->name, dag_state_strings[node->state]);
+      if (node->state != DAG_WAITING && node->state != DAG_CANCELLED)
+        printf(", pid: %d", node->pid);
+      printf("\n");
+    }
+  }
+  unblock_SIGCHLD();
+}
+
+/**
+ * dag <file> [-j N]  --> runs a dependency graph, at most N nodes at once
+ * dag                --> lists the runs in progress
+ **/
+void dag_builtin(char **args) {
+  int max_running = 0;
+
+  if (!args[1]) {
+    print_runs();
+    return;
+  }
+  if (args[2] && !strcmp(args[2], "-j")) {
+    if (!args[3] || (max_running = atoi(args[3])) <= 0) {
+      printf("Usage: dag <file> [-j N]\n");
+      return;
+    }
+  }
+  dag_run *run = load_dag(args[1]);
+  if (!run)
+    return;
+  run->max_running = max_running;
+  block_SIGCHLD();
+  start_run(run);
+  printf("DAG [%d] started: %d nodes\n", run->id, run->n_nodes);
+  unblock_SIGCHLD();
+}
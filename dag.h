@@ -0,0 +1,58 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for dag module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _DAG_H
+#define _DAG_H
+
+#include "job_control.h"
+
+#define DAG_MAX_DEPS 16 /* Dependencies of a single node */
+
+/**
+ * Enumerations
+ **/
+enum dag_state { DAG_WAITING, DAG_RUNNING, DAG_DONE, DAG_FAILED, DAG_CANCELLED };
+static char *dag_state_strings[] = {"Waiting", "Running", "Done", "Failed",
+                                    "Cancelled"};
+
+/* Node of a run: becomes a job in tasks once its dependencies succeed */
+typedef struct dag_node_ {
+  char *name;
+  char **comm_args;
+  int deps[DAG_MAX_DEPS]; /* Parent nodes (index in the run) */
+  int n_deps;
+  pid_t ext_deps[DAG_MAX_DEPS]; /* Jobs already in tasks (after builtin) */
+  int n_ext_deps;
+  int pending; /* Dependencies not finished yet */
+  enum dag_state state;
+  pid_t pid;
+  int status; /* Raw wait status */
+  long long start_ns;
+  long long end_ns;
+} dag_node;
+
+/* Set of nodes released together with an optional concurrency cap */
+typedef struct dag_run_ {
+  int id;
+  dag_node *nodes;
+  int n_nodes;
+  int max_running; /* 0 means no cap */
+  int running;
+  int finished;
+  long long start_ns;
+  struct dag_run_ *next;
+} dag_run;
+
+/**
+ * Public Functions
+ **/
+void dag_init(void);
+void after_builtin(char **args);
+void dag_builtin(char **args);
+
+#endif
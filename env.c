@@ -0,0 +1,251 @@
+/**
+ * Linux Job Control Shell Project
+ * env module: shell variables, export and the environment of the jobs
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Variables are kept as "NAME=value" strings. The exported ones form an
+ * envp array that is built again only when one of them changes, and
+ * environ points to it: every execvp of the shell passes it as it is, with
+ * no work per launch. A string is never written once it is in the array.
+ * A new value is a new string, and the old one is freed only after the
+ * new array has replaced the old one. readline is kept from calling
+ * setenv, which would make its own copy of environ.
+ *
+ * VAR=x cmd builds an array for that command only, from the cached one
+ * plus the assignments, without touching the variables of the shell.
+ **/
+#include "env.h"
+#include "complete.h"
+
+#include <ctype.h>
+
+static env_var *vars = NULL;
+static int n_vars = 0;
+static int cap_vars = 0;
+static char **envp_cache = NULL; /* Exported entries, NULL terminated */
+static int n_exported = 0;
+
+static int find(const char *name, int len) {
+  for (int i = 0; i < n_vars; i++) {
+    if (vars[i].name_len == len && !strncmp(vars[i].entry, name, len))
+      return (i);
+  }
+  return (-1);
+}
+
+// Length of the name at the start of str, 0 if it does not start with one
+static int name_length(const char *str) {
+  int len = 0;
+  if (!isalpha((unsigned char)str[0]) && str[0] != '_')
+    return (0);
+  while (isalnum((unsigned char)str[len]) || str[len] == '_')
+    len++;
+  return (len);
+}
+
+// New envp from the exported variables, environ moves to it
+static void rebuild(void) {
+  char **envp = (char **)malloc((n_vars + 1) * sizeof(char *));
+  int n = 0;
+
+  if (!envp) {
+    perror("Error at malloc");
+    return;
+  }
+  for (int i = 0; i < n_vars; i++) {
+    if (vars[i].exported)
+      envp[n++] = vars[i].entry;
+  }
+  envp[n] = NULL;
+  environ = envp;
+  free(envp_cache);
+  envp_cache = envp;
+  n_exported = n;
+}
+
+static int add_var(char *entry, int len, int exported) {
+  if (n_vars == cap_vars) {
+    int cap = cap_vars ? cap_vars * 2 : 64;
+    env_var *aux = (env_var *)realloc(vars, cap * sizeof(env_var));
+    if (!aux) {
+      perror("Error at realloc");
+      free(entry);
+      return (-1);
+    }
+    vars = aux;
+    cap_vars = cap;
+  }
+  vars[n_vars].entry = entry;
+  vars[n_vars].name_len = len;
+  vars[n_vars].exported = exported;
+  n_vars++;
+  return (0);
+}
+
+/**
+ * Takes the environment the shell was started with
+ **/
+void env_init(void) {
+  for (int i = 0; environ[i]; i++) {
+    char *eq = strchr(environ[i], '=');
+    char *entry;
+    if (!eq || find(environ[i], eq - environ[i]) != -1)
+      continue;
+    entry = strdup(environ[i]);
+    if (entry)
+      add_var(entry, eq - environ[i], 1);
+  }
+  rebuild();
+  rl_change_environment = 0;
+}
+
+/**
+ * Value of the variable name (len chars), NULL if unset
+ **/
+const char *env_get(const char *name, int len) {
+  int i = find(name, len);
+  return (i == -1 ? NULL : vars[i].entry + len + 1);
+}
+
+/**
+ * Is arg a NAME=value assignment?
+ **/
+int env_is_assignment(const char *arg) {
+  int len = name_length(arg);
+  return (len && arg[len] == '=');
+}
+
+/**
+ * Sets a variable from "NAME=value". It keeps being exported if it was,
+ * export also puts it in the environment.
+ **/
+void env_set(const char *assign, int export) {
+  int len = name_length(assign);
+  char *entry = strdup(assign);
+  char *old = NULL;
+  int i;
+
+  if (!entry) {
+    perror("Error at strdup");
+    return;
+  }
+  i = find(assign, len);
+  if (i == -1) {
+    if (add_var(entry, len, export) == -1)
+      return;
+    i = n_vars - 1;
+  } else {
+    old = vars[i].entry;
+    vars[i].entry = entry;
+    vars[i].exported |= export;
+  }
+  if (vars[i].exported)
+    rebuild();
+  free(old);
+  // execvp and the completion index search the new PATH
+  if (len == 4 && !strncmp(assign, "PATH", 4) && vars[i].exported)
+    complete_rescan();
+}
+
+/**
+ * Removes a variable
+ **/
+void env_unset(const char *name) {
+  int i = find(name, strlen(name));
+  char *old;
+  int exported;
+
+  if (i == -1)
+    return;
+  old = vars[i].entry;
+  exported = vars[i].exported;
+  vars[i] = vars[--n_vars];
+  if (exported)
+    rebuild();
+  free(old);
+  if (exported && !strcmp(name, "PATH"))
+    complete_rescan();
+}
+
+/**
+ * Takes the VAR=x words that start args. Alone they set shell variables
+ * and leave args empty. Before a command they are the environment of that
+ * command only: the array returned (free it, not its strings) goes to
+ * environ in the child. NULL if there is no prefix.
+ **/
+char **env_prefix(char **args) {
+  char **envp;
+  int n = 0, k;
+
+  while (args[n] && env_is_assignment(args[n]))
+    n++;
+  if (!n)
+    return NULL;
+  if (!args[n]) {
+    for (int i = 0; i < n; i++)
+      env_set(args[i], 0);
+    args[0] = NULL;
+    return NULL;
+  }
+  envp = (char **)malloc((n_exported + n + 1) * sizeof(char *));
+  if (!envp) {
+    perror("Error at malloc");
+    return NULL;
+  }
+  // The assignments first, the cached entries they don't replace after
+  for (k = 0; k < n; k++)
+    envp[k] = args[k];
+  for (int i = 0; i < n_exported; i++) {
+    int len = strchr(envp_cache[i], '=') - envp_cache[i], j;
+    for (j = 0; j < n; j++) {
+      if (!strncmp(args[j], envp_cache[i], len + 1))
+        break;
+    }
+    if (j == n)
+      envp[k++] = envp_cache[i];
+  }
+  envp[k] = NULL;
+  k = 0;
+  do
+    args[k] = args[k + n];
+  while (args[k++]);
+  return (envp);
+}
+
+/**
+ * export [NAME[=value]...] and unset NAME...
+ **/
+void env_builtin(char **args) {
+  if (!strcmp(args[0], "unset")) {
+    for (int i = 1; args[i]; i++)
+      env_unset(args[i]);
+    return;
+  }
+  if (!args[1]) {
+    for (int i = 0; envp_cache[i]; i++)
+      printf("export %s\n", envp_cache[i]);
+    return;
+  }
+  for (int i = 1; args[i]; i++) {
+    int len = name_length(args[i]), k;
+    if (!len || (args[i][len] && args[i][len] != '=')) {
+      fprintf(stderr, "export: bad variable name: %s\n", args[i]);
+      continue;
+    }
+    if (args[i][len] == '=') {
+      env_set(args[i], 1);
+      continue;
+    }
+    // export NAME: a shell variable goes to the environment
+    k = find(args[i], len);
+    if (k != -1 && !vars[k].exported) {
+      vars[k].exported = 1;
+      rebuild();
+      if (!strcmp(args[i], "PATH"))
+        complete_rescan();
+    }
+  }
+}
@@ -0,0 +1,32 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for env module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _ENV_H
+#define _ENV_H
+
+#include "job_control.h"
+
+/* Shell variable */
+typedef struct env_var_ {
+  char *entry;  /* "NAME=value", replaced (never written) on a change */
+  int name_len;
+  int exported; /* Part of the environment of the jobs */
+} env_var;
+
+/**
+ * Public Functions
+ **/
+void env_init(void);
+const char *env_get(const char *name, int len);
+int env_is_assignment(const char *arg);
+void env_set(const char *assign, int export);
+void env_unset(const char *name);
+char **env_prefix(char **args);
+void env_builtin(char **args);
+
+#endif
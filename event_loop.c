@@ -0,0 +1,180 @@
+/**
+ * Linux Job Control Shell Project
+ * event_loop module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * The prompt is read with the readline callback interface so the shell can
+ * keep serving other descriptors (job notifications, timers...) while the
+ * user is typing.
+ **/
+#include "event_loop.h"
+
+#include <errno.h>
+
+typedef struct loop_watch_s {
+  int fd;
+  short events;
+  loop_fd_cb cb;
+  void *data;
+} loop_watch_t;
+
+static loop_watch_t watches[LOOP_MAX_FDS];
+static int n_watches = 0;
+
+static char *line_read = NULL;
+static int line_done = 0;
+static int reading_line = 0;
+static int print_depth = 0;
+
+/**
+ * Starts watching a descriptor. The callback runs from loop_poll_once().
+ * Returns -1 if there is no room left for another descriptor.
+ **/
+int loop_watch_fd(int fd, short events, loop_fd_cb cb, void *data) {
+  if (n_watches == LOOP_MAX_FDS)
+    return -1;
+  watches[n_watches].fd = fd;
+  watches[n_watches].events = events;
+  watches[n_watches].cb = cb;
+  watches[n_watches].data = data;
+  n_watches++;
+  return 0;
+}
+
+/**
+ * Stops watching a descriptor. It does not close it.
+ **/
+void loop_unwatch_fd(int fd) {
+  for (int i = 0; i < n_watches; i++) {
+    if (watches[i].fd == fd) {
+      watches[i] = watches[n_watches - 1];
+      n_watches--;
+      return;
+    }
+  }
+}
+
+/**
+ * Changes the events a watched descriptor is polled for
+ **/
+void loop_modify_fd(int fd, short events) {
+  for (int i = 0; i < n_watches; i++) {
+    if (watches[i].fd == fd)
+      watches[i].events = events;
+  }
+}
+
+// Is the descriptor still watched by the same callback?
+static int still_watched(int fd, loop_fd_cb cb) {
+  for (int i = 0; i < n_watches; i++) {
+    if (watches[i].fd == fd && watches[i].cb == cb)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Waits up to timeout_ms (-1 forever) for any watched descriptor and runs
+ * the callbacks of the ready ones.
+ * Returns the number of ready descriptors, 0 on timeout or -1 on error
+ * (EINTR when a signal arrived).
+ **/
+int loop_poll_once(int timeout_ms) {
+  struct pollfd pfds[LOOP_MAX_FDS];
+  loop_watch_t snap[LOOP_MAX_FDS];
+  int n = n_watches;
+  int ready;
+
+  // Callbacks may watch or unwatch descriptors, so we work on a copy
+  memcpy(snap, watches, n * sizeof(loop_watch_t));
+  for (int i = 0; i < n; i++) {
+    pfds[i].fd = snap[i].fd;
+    pfds[i].events = snap[i].events;
+    pfds[i].revents = 0;
+  }
+
+  ready = poll(pfds, n, timeout_ms);
+  if (ready <= 0)
+    return ready;
+
+  for (int i = 0; i < n; i++) {
+    if (pfds[i].revents && still_watched(snap[i].fd, snap[i].cb))
+      snap[i].cb(snap[i].fd, pfds[i].revents, snap[i].data);
+  }
+  return ready;
+}
+
+/**
+ * wait4() for a foreground job that keeps serving the watched descriptors
+ * meanwhile (the job may be writing into a pipe relayed by the loop).
+ * SIGCHLD interrupts the poll, the timeout only covers a SIGCHLD that
+ * arrives right before it.
+ **/
+pid_t loop_waitpid(pid_t pid, int *status, int options, struct rusage *ru) {
+  pid_t ret;
+  while ((ret = wait4(pid, status, options | WNOHANG, ru)) == 0)
+    loop_poll_once(LOOP_WAIT_MS);
+  return ret;
+}
+
+// Readline calls this once a whole line (or ^D) has been typed
+static void line_handler(char *line) {
+  line_read = line;
+  line_done = 1;
+  rl_callback_handler_remove();
+}
+
+static void stdin_ready(int fd, short revents, void *data) {
+  rl_callback_read_char();
+}
+
+/**
+ * Returns 1 while the prompt is on screen waiting for user input
+ **/
+int loop_reading_line(void) { return reading_line; }
+
+/**
+ * Brackets output printed while the prompt may be on screen: the output
+ * starts on a fresh line and the prompt with the typed text is redrawn
+ * below it at the end. Calls can be nested.
+ **/
+void loop_print_begin(void) {
+  if (print_depth++ == 0 && reading_line)
+    rl_crlf();
+}
+
+void loop_print_end(void) {
+  if (--print_depth > 0)
+    return;
+  fflush(stdout);
+  if (reading_line) {
+    rl_on_new_line();
+    rl_forced_update_display();
+  }
+}
+
+/**
+ * Same contract as readline(): returns a malloc'ed line or NULL on ^D, but
+ * the rest of watched descriptors are served while the user types.
+ **/
+char *loop_readline(const char *prompt) {
+  line_read = NULL;
+  line_done = 0;
+  rl_callback_handler_install(prompt, line_handler);
+  loop_watch_fd(STDIN_FILENO, POLLIN, stdin_ready, NULL);
+  reading_line = 1;
+  while (!line_done) {
+    if (loop_poll_once(-1) == -1 && errno != EINTR) {
+      perror("Error at poll");
+      break;
+    }
+  }
+  reading_line = 0;
+  loop_unwatch_fd(STDIN_FILENO);
+  if (!line_done)
+    rl_callback_handler_remove();
+  return line_read;
+}
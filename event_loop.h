@@ -0,0 +1,36 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for event_loop module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+#include "job_control.h"
+
+#include <poll.h>
+#include <sys/resource.h>
+
+#define LOOP_MAX_FDS 64 /* Descriptors watched at the same time */
+#define LOOP_WAIT_MS 100 /* Longest poll of loop_waitpid() */
+
+/* Callback invoked when a watched descriptor becomes ready */
+typedef void (*loop_fd_cb)(int fd, short revents, void *data);
+
+/**
+ * Public Functions
+ **/
+int loop_watch_fd(int fd, short events, loop_fd_cb cb, void *data);
+void loop_unwatch_fd(int fd);
+void loop_modify_fd(int fd, short events);
+int loop_poll_once(int timeout_ms);
+pid_t loop_waitpid(pid_t pid, int *status, int options, struct rusage *ru);
+int loop_reading_line(void);
+void loop_print_begin(void);
+void loop_print_end(void);
+char *loop_readline(const char *prompt);
+
+#endif
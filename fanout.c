@@ -0,0 +1,321 @@
+/**
+ * Linux Job Control Shell Project
+ * fanout module: output redirection to several files (> a > b, >+ a b c)
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * The job writes into a pipe and the prompt loop relays it without copying
+ * the data to user space. Each round tee()s what is in the job's pipe into
+ * the pipe of every target but the last one, then splice()s every pipe into
+ * its file and the job's pipe into the last file, which consumes the round.
+ * A new round only starts once every file has taken the previous one, so a
+ * slow target stops the reads and the job blocks on its full pipe.
+ *
+ * The job's pipe keeps its slot of the loop while reads are stopped (no
+ * events), so resuming can't fail. A file that would block is watched for
+ * POLLOUT; with the loop full the shell waits for it in place instead.
+ **/
+#include "fanout.h"
+#include "event_loop.h"
+#include "jobsched.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+
+static void relay(fanout *f);
+
+static void in_ready(int fd, short revents, void *data) {
+  fanout *f = (fanout *)data;
+
+  // The job is gone and reads are stopped: what is left is read once the
+  // files take it, the slot is not needed for that
+  if ((revents & POLLHUP) && !f->reading) {
+    loop_unwatch_fd(f->in_r);
+    f->watched = 0;
+    return;
+  }
+  relay(f);
+}
+
+static void out_ready(int fd, short revents, void *data) {
+  fanout *f = (fanout *)data;
+  for (int i = 0; i < f->n_targets; i++) {
+    if (f->targets[i].out_fd == fd && f->targets[i].waiting) {
+      loop_unwatch_fd(fd);
+      f->targets[i].waiting = 0;
+    }
+  }
+  relay(f);
+}
+
+static void set_reading(fanout *f, int on) {
+  if (f->watched && on != f->reading)
+    loop_modify_fd(f->in_r, on ? POLLIN : 0);
+  f->reading = on;
+}
+
+// Reads and drops len bytes of a pipe
+static void discard(int fd, int len) {
+  char buff[4096];
+  while (len > 0) {
+    ssize_t n = read(fd, buff, len < sizeof(buff) ? len : sizeof(buff));
+    if (n <= 0)
+      break;
+    len -= n;
+  }
+}
+
+static int source_of(fanout *f, fanout_target *t) {
+  return t->pipe_r != -1 ? t->pipe_r : f->in_r;
+}
+
+// A file could not be written: report it later and drop its data
+static void target_failed(fanout *f, fanout_target *t, int err) {
+  if (!t->error)
+    t->error = err;
+  if (t->waiting)
+    loop_unwatch_fd(t->out_fd);
+  t->waiting = 0;
+  close(t->out_fd);
+  t->out_fd = -1;
+  discard(source_of(f, t), t->pending);
+  t->pending = 0;
+}
+
+// Writes what the target owes of the current round. Returns 1 if the file
+// would block (it is then watched for POLLOUT), 0 once it is up to date
+static int flush_target(fanout *f, fanout_target *t) {
+  while (t->pending > 0) {
+    ssize_t n = splice(source_of(f, t), NULL, t->out_fd, NULL, t->pending,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      t->pending -= n;
+    } else if (n == -1 && errno == EAGAIN) {
+      struct pollfd pfd = {t->out_fd, POLLOUT, 0};
+      if (t->waiting ||
+          loop_watch_fd(t->out_fd, POLLOUT, out_ready, f) == 0) {
+        t->waiting = 1;
+        return (1);
+      }
+      // No room in the loop: a plain blocking write
+      while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+        ;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else {
+      target_failed(f, t, n == -1 ? errno : EPIPE);
+    }
+  }
+  return (0);
+}
+
+// The job closed its end and everything was written
+static void finish(fanout *f) {
+  double secs = (monotonic_ns() - f->start_ns) / 1e9;
+
+  if (f->watched)
+    loop_unwatch_fd(f->in_r);
+  close(f->in_r);
+  loop_print_begin();
+  printf("Fan-out of pid: %d, command: %s: %llu bytes to %d files, %.2f "
+         "MB/s\n",
+         f->pid, f->command, f->bytes, f->n_targets,
+         secs > 0 ? f->bytes / secs / 1e6 : 0.0);
+  for (int i = 0; i < f->n_targets; i++) {
+    fanout_target *t = &f->targets[i];
+    if (t->error)
+      printf("  %s: %s\n", t->path, strerror(t->error));
+    if (t->waiting)
+      loop_unwatch_fd(t->out_fd);
+    if (t->out_fd != -1)
+      close(t->out_fd);
+    if (t->pipe_r != -1) {
+      close(t->pipe_r);
+      close(t->pipe_w);
+    }
+    free(t->path);
+  }
+  loop_print_end();
+  free(f->targets);
+  free(f->command);
+  free(f);
+}
+
+// Starts a round: returns its length, 0 at EOF or -1 if the job's pipe is
+// empty for now
+static int next_round(fanout *f) {
+  fanout_target *last = &f->targets[f->n_targets - 1];
+  ssize_t n = -2;
+
+  for (int i = 0; i < f->n_targets - 1; i++) {
+    fanout_target *t = &f->targets[i];
+    ssize_t m;
+    if (t->out_fd == -1)
+      continue;
+    // The first tee sets the round, the rest copy that same data
+    m = tee(f->in_r, t->pipe_w, n == -2 ? f->pipe_size : n,
+            SPLICE_F_NONBLOCK);
+    if (n == -2) {
+      if (m == -1 && errno == EAGAIN)
+        return (-1);
+      if (m <= 0)
+        return (0);
+      n = m;
+    } else if (m != n) {
+      // Pipes of the same size that were empty: it does not happen
+      t->pending = m > 0 ? m : 0;
+      target_failed(f, t, m == -1 ? errno : EIO);
+      continue;
+    }
+    t->pending = n;
+  }
+  if (n == -2) {
+    // Every tee target failed: the last file takes what there is
+    n = splice(f->in_r, NULL, last->out_fd, NULL, f->pipe_size,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n == -1 && errno == EAGAIN)
+      return (-1);
+    if (n <= 0 && last->out_fd != -1)
+      target_failed(f, last, n == -1 ? errno : EPIPE);
+    if (n <= 0)
+      return (0);
+    f->bytes += n;
+    return (n);
+  }
+  if (last->out_fd == -1)
+    discard(f->in_r, n);
+  else
+    last->pending = n;
+  f->bytes += n;
+  return (n);
+}
+
+static void relay(fanout *f) {
+  for (;;) {
+    int blocked = 0;
+    for (int i = 0; i < f->n_targets; i++) {
+      if (f->targets[i].out_fd != -1)
+        blocked |= flush_target(f, &f->targets[i]);
+    }
+    if (blocked) {
+      set_reading(f, 0);
+      return;
+    }
+    switch (next_round(f)) {
+    case 0:
+      finish(f);
+      return;
+    case -1:
+      set_reading(f, 1);
+      return;
+    }
+  }
+}
+
+/**
+ * Opens (truncates) every file and creates the pipes of a fan-out. The child
+ * must dup2 in_w into its stdout. Returns NULL on error.
+ **/
+fanout *fanout_open(char **paths, int n_paths) {
+  fanout *f = (fanout *)calloc(1, sizeof(fanout));
+  int fds[2];
+  int i;
+
+  if (!f || !(f->targets = (fanout_target *)calloc(n_paths,
+                                                   sizeof(fanout_target)))) {
+    perror("Error at calloc");
+    free(f);
+    return NULL;
+  }
+  f->in_r = f->in_w = -1;
+  f->pipe_size = FANOUT_PIPE_SIZE;
+  for (i = 0; i < n_paths; i++) {
+    fanout_target *t = &f->targets[i];
+    t->pipe_r = t->pipe_w = -1;
+    t->out_fd =
+        open(paths[i], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (t->out_fd == -1) {
+      fprintf(stderr, "Error opening out file %s: %s\n", paths[i],
+              strerror(errno));
+      break;
+    }
+    t->path = strdup(paths[i]);
+    f->n_targets++;
+    if (i == n_paths - 1)
+      continue;
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+      perror("Error at pipe");
+      break;
+    }
+    t->pipe_r = fds[0];
+    t->pipe_w = fds[1];
+    // The job's pipe is sized last to the smallest one, so a tee into an
+    // empty target pipe always takes a whole round
+    int size = fcntl(t->pipe_w, F_SETPIPE_SZ, f->pipe_size);
+    if (size == -1)
+      size = fcntl(t->pipe_w, F_GETPIPE_SZ);
+    if (size < f->pipe_size)
+      f->pipe_size = size;
+  }
+  if (i == n_paths && pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1)
+    perror("Error at pipe");
+  else if (i == n_paths) {
+    f->in_r = fds[0];
+    f->in_w = fds[1];
+    if (fcntl(f->in_r, F_SETPIPE_SZ, f->pipe_size) == -1)
+      f->pipe_size = fcntl(f->in_r, F_GETPIPE_SZ);
+    // The job itself must see a blocking stdout
+    fcntl(f->in_w, F_SETFL, 0);
+    return f;
+  }
+  fanout_abort(f);
+  return NULL;
+}
+
+/**
+ * Called by the parent after fork: closes its copy of the write end and
+ * starts relaying. Returns -1 on error (the fan-out is released, the job
+ * gets SIGPIPE).
+ **/
+int fanout_start(fanout *f, pid_t pid, const char *command) {
+  close(f->in_w);
+  f->in_w = -1;
+  if (loop_watch_fd(f->in_r, POLLIN, in_ready, f) == -1) {
+    fprintf(stderr, "Error: no room in the event loop for the fan-out of "
+                    "pid: %d\n",
+            pid);
+    fanout_abort(f);
+    return (-1);
+  }
+  f->watched = 1;
+  f->reading = 1;
+  f->pid = pid;
+  f->command = strdup(command);
+  f->start_ns = monotonic_ns();
+  return (0);
+}
+
+/**
+ * Releases a fan-out whose job could not be launched
+ **/
+void fanout_abort(fanout *f) {
+  for (int i = 0; i < f->n_targets; i++) {
+    fanout_target *t = &f->targets[i];
+    close(t->out_fd);
+    if (t->pipe_r != -1) {
+      close(t->pipe_r);
+      close(t->pipe_w);
+    }
+    free(t->path);
+  }
+  if (f->in_r != -1)
+    close(f->in_r);
+  if (f->in_w != -1)
+    close(f->in_w);
+  free(f->targets);
+  free(f->command);
+  free(f);
+}
@@ -0,0 +1,50 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for fanout module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _FANOUT_H
+#define _FANOUT_H
+
+#include "job_control.h"
+
+#define FANOUT_PIPE_SIZE (1024 * 1024) /* Requested size of the relay pipes */
+
+/* Output file of a fan-out. All but the last one are fed through their own
+ * pipe with tee(2), the last one is spliced straight from the job's pipe */
+typedef struct fanout_target_ {
+  char *path;
+  int out_fd;
+  int pipe_r; /* -1 for the last target */
+  int pipe_w;
+  int pending; /* Bytes of the current round not written to out_fd yet */
+  int waiting; /* out_fd is watched for POLLOUT */
+  int error;   /* errno of the first failed write, 0 if none */
+} fanout_target;
+
+/* stdout of a job copied to several files by the prompt loop */
+typedef struct fanout_ {
+  int in_r; /* The job writes into in_w */
+  int in_w;
+  int pipe_size;
+  fanout_target *targets;
+  int n_targets;
+  int watched; /* in_r holds a slot of the loop, from start to EOF */
+  int reading; /* ... and is polled for POLLIN */
+  pid_t pid;
+  char *command;
+  unsigned long long bytes;
+  long long start_ns;
+} fanout;
+
+/**
+ * Public Functions
+ **/
+fanout *fanout_open(char **paths, int n_paths);
+int fanout_start(fanout *f, pid_t pid, const char *command);
+void fanout_abort(fanout *f);
+
+#endif
@@ -0,0 +1,376 @@
+/**
+ * Linux Job Control Shell Project
+ * fastcmd module: in-process true, false, echo, sleep, test / [, pwd and cat
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * These utilities do next to nothing, so most of their cost was the fork,
+ * exec and wait around them. In the foreground they run inside the shell on
+ * descriptors the shell opens for < > >>. In the background the job is still
+ * forked, so jobs, fg and wait see it as usual, but the child runs the code
+ * below instead of execvp. Any form not handled here (unknown options,
+ * compound tests, cat of anything but regular files, a FIFO in a
+ * redirection) goes to the real binary, and
+ * "builtin -x cmd" always does.
+ **/
+#include "fastcmd.h"
+#include "event_loop.h"
+#include "jobsched.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#define COPY_CHUNK (1 << 30)
+
+static volatile sig_atomic_t fast_interrupted = 0;
+
+static void sigint_fast(int signal) { fast_interrupted = 1; }
+
+// Writes all of buff, returns -1 on error
+static int write_all(int fd, const char *buff, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buff, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return (-1);
+    buff += n;
+    len -= n;
+  }
+  return (0);
+}
+
+static int run_true(char **args, const int *fd, int in_shell) {
+  return (0);
+}
+
+static int run_false(char **args, const int *fd, int in_shell) {
+  return (1);
+}
+
+static int run_echo(char **args, const int *fd, int in_shell) {
+  int i = 1, newline = 1, ret;
+  size_t len = 1;
+  char *buff, *p;
+
+  if (args[1] && !strcmp(args[1], "-n")) {
+    newline = 0;
+    i++;
+  }
+  for (int j = i; args[j]; j++)
+    len += strlen(args[j]) + 1;
+  buff = p = (char *)malloc(len);
+  if (!buff)
+    return (1);
+  for (int j = i; args[j]; j++) {
+    if (j > i)
+      *p++ = ' ';
+    p = stpcpy(p, args[j]);
+  }
+  if (newline)
+    *p++ = '\n';
+  ret = write_all(fd[1], buff, p - buff) == -1 ? 1 : 0;
+  free(buff);
+  return (ret);
+}
+
+static int run_pwd(char **args, const int *fd, int in_shell) {
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd) - 1)) {
+    dprintf(fd[2], "pwd: %s\n", strerror(errno));
+    return (1);
+  }
+  strcat(cwd, "\n");
+  return write_all(fd[1], cwd, strlen(cwd)) == -1 ? 1 : 0;
+}
+
+// The shell keeps serving the event loop while it sleeps and ^C ends the
+// sleep. A forked child has the default SIGINT and just nanosleeps
+static int run_sleep(char **args, const int *fd, int in_shell) {
+  long long total = 0, ns, deadline;
+  struct sigaction sa, old_sa;
+
+  for (int i = 1; args[i]; i++) {
+    parse_duration(args[i], &ns);
+    total += ns;
+  }
+  if (!in_shell) {
+    struct timespec ts = {total / 1000000000LL, total % 1000000000LL};
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+      ;
+    return (0);
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sigint_fast;
+  sigemptyset(&sa.sa_mask);
+  fast_interrupted = 0;
+  sigaction(SIGINT, &sa, &old_sa);
+  deadline = monotonic_ns() + total;
+  while (!fast_interrupted) {
+    long long left = deadline - monotonic_ns();
+    if (left <= 0)
+      break;
+    loop_poll_once((left + 999999) / 1000000);
+  }
+  sigaction(SIGINT, &old_sa, NULL);
+  return fast_interrupted ? 128 + SIGINT : 0;
+}
+
+// Copies in to out: copy_file_range between files, sendfile from a file to
+// anything else, read / write when neither works (pipes, /proc, O_APPEND)
+static int copy_fd(int in, int out) {
+  struct stat st;
+  int mode = 0;
+  char buff[65536];
+
+  // Special files may report a size of 0 and be copied as empty
+  if (fstat(in, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    mode = 2;
+  for (;;) {
+    ssize_t n;
+    if (mode == 0)
+      n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+    else if (mode == 1)
+      n = sendfile(out, in, NULL, COPY_CHUNK);
+    else if ((n = read(in, buff, sizeof(buff))) > 0)
+      n = write_all(out, buff, n) == -1 ? -1 : n;
+    if (n == 0)
+      return (0);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && mode < 2 &&
+        (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+         errno == EOPNOTSUPP || errno == EBADF)) {
+      mode++;
+      continue;
+    }
+    if (n == -1)
+      return (-1);
+  }
+}
+
+static int run_cat(char **args, const int *fd, int in_shell) {
+  int ret = 0;
+
+  if (!args[1])
+    return copy_fd(fd[0], fd[1]) == -1 ? 1 : 0;
+  for (int i = 1; args[i]; i++) {
+    int in = strcmp(args[i], "-") ? open(args[i], O_RDONLY | O_CLOEXEC)
+                                  : fd[0];
+    if (in == -1 || copy_fd(in, fd[1]) == -1) {
+      dprintf(fd[2], "cat: %s: %s\n", args[i], strerror(errno));
+      ret = 1;
+    }
+    if (in != -1 && in != fd[0])
+      close(in);
+  }
+  return (ret);
+}
+
+// test with one primary: 0 true, 1 false, -1 for the forms left to the real
+// binary (-a, -o, parentheses, bad integers)
+static int test_eval(char **argv, int argc) {
+  struct stat st;
+  long long a, b;
+  char *end_a, *end_b;
+
+  if (argc > 1 && !strcmp(argv[0], "!")) {
+    int ret = test_eval(argv + 1, argc - 1);
+    return ret == -1 ? -1 : !ret;
+  }
+  if (argc == 0)
+    return (1);
+  if (argc == 1)
+    return argv[0][0] ? 0 : 1;
+  if (argc == 2) {
+    const char *op = argv[0], *arg = argv[1];
+    if (!strcmp(op, "-z"))
+      return arg[0] ? 1 : 0;
+    if (!strcmp(op, "-n"))
+      return arg[0] ? 0 : 1;
+    if (!strcmp(op, "-L") || !strcmp(op, "-h"))
+      return !(lstat(arg, &st) == 0 && S_ISLNK(st.st_mode));
+    if (!strcmp(op, "-r"))
+      return access(arg, R_OK) ? 1 : 0;
+    if (!strcmp(op, "-w"))
+      return access(arg, W_OK) ? 1 : 0;
+    if (!strcmp(op, "-x"))
+      return access(arg, X_OK) ? 1 : 0;
+    if (strlen(op) != 2 || op[0] != '-' || !strchr("efdsbcpS", op[1]))
+      return (-1);
+    if (stat(arg, &st) == -1)
+      return (1);
+    switch (op[1]) {
+    case 'f':
+      return !S_ISREG(st.st_mode);
+    case 'd':
+      return !S_ISDIR(st.st_mode);
+    case 's':
+      return !(st.st_size > 0);
+    case 'b':
+      return !S_ISBLK(st.st_mode);
+    case 'c':
+      return !S_ISCHR(st.st_mode);
+    case 'p':
+      return !S_ISFIFO(st.st_mode);
+    case 'S':
+      return !S_ISSOCK(st.st_mode);
+    }
+    return (0);
+  }
+  if (argc == 3) {
+    const char *op = argv[1];
+    if (!strcmp(op, "=") || !strcmp(op, "=="))
+      return strcmp(argv[0], argv[2]) ? 1 : 0;
+    if (!strcmp(op, "!="))
+      return strcmp(argv[0], argv[2]) ? 0 : 1;
+    if (op[0] != '-')
+      return (-1);
+    a = strtoll(argv[0], &end_a, 10);
+    b = strtoll(argv[2], &end_b, 10);
+    if (!argv[0][0] || *end_a || !argv[2][0] || *end_b)
+      return (-1);
+    if (!strcmp(op, "-eq"))
+      return !(a == b);
+    if (!strcmp(op, "-ne"))
+      return !(a != b);
+    if (!strcmp(op, "-lt"))
+      return !(a < b);
+    if (!strcmp(op, "-le"))
+      return !(a <= b);
+    if (!strcmp(op, "-gt"))
+      return !(a > b);
+    if (!strcmp(op, "-ge"))
+      return !(a >= b);
+  }
+  return (-1);
+}
+
+// Operands of test / [ (without the closing ]), -1 if [ is not closed
+static int test_argc(char **args) {
+  int argc = 0;
+  while (args[argc + 1])
+    argc++;
+  if (!strcmp(args[0], "[")) {
+    if (!argc || strcmp(args[argc], "]"))
+      return (-1);
+    argc--;
+  }
+  return (argc);
+}
+
+static int run_test(char **args, const int *fd, int in_shell) {
+  return test_eval(args + 1, test_argc(args));
+}
+
+static fast_cmd commands[] = {
+    {"true", run_true}, {"false", run_false}, {"echo", run_echo},
+    {"sleep", run_sleep}, {"test", run_test}, {"[", run_test},
+    {"pwd", run_pwd},   {"cat", run_cat},     {NULL, NULL}};
+
+static fast_cmd *find_cmd(const char *name) {
+  for (int i = 0; commands[i].name; i++) {
+    if (!strcmp(commands[i].name, name))
+      return &commands[i];
+  }
+  return NULL;
+}
+
+/**
+ * Returns 1 if args can be served by the shell itself, 0 if it must be
+ * executed (unknown command or a form this module does not handle)
+ **/
+int fast_builtin(char **args, const redir_plan *redir) {
+  fast_cmd *cmd = find_cmd(args[0]);
+  long long ns;
+  int argc;
+
+  if (!cmd)
+    return (0);
+  // The shell would wait for the other end of a FIFO without a way out
+  if (redir && redir_has_fifo(redir))
+    return (0);
+  if (cmd->run == run_echo)
+    return !(args[1] && (!strcmp(args[1], "-e") || !strcmp(args[1], "-E")));
+  if (cmd->run == run_sleep) {
+    if (!args[1])
+      return (0);
+    for (int i = 1; args[i]; i++) {
+      if (parse_duration(args[i], &ns) == -1)
+        return (0);
+    }
+    return (1);
+  }
+  if (cmd->run == run_test) {
+    argc = test_argc(args);
+    return argc != -1 && test_eval(args + 1, argc) != -1;
+  }
+  // The shell can't be stopped or interrupted while it reads a terminal,
+  // pipe or FIFO that may never end: only regular files are read here
+  if (cmd->run == run_cat) {
+    struct stat st;
+    int reads_stdin = !args[1];
+    for (int i = 1; args[i]; i++) {
+      if (args[i][0] == '-' && args[i][1])
+        return (0);
+      if (!strcmp(args[i], "-"))
+        reads_stdin = 1;
+      else if (stat(args[i], &st) == -1 || !S_ISREG(st.st_mode))
+        return (0);
+    }
+    return !reads_stdin || redir_is_regular(redir, STDIN_FILENO);
+  }
+  if (cmd->run == run_pwd)
+    return !args[1];
+  return (1);
+}
+
+// Runs args on the descriptors of the plan (opened and closed here).
+// Returns the wait status the command would have had or -1 if a
+// redirection failed
+static int run_on_plan(char **args, redir_plan *redir, int in_shell) {
+  int fd[3], code;
+
+  if (redir_open(redir) == -1)
+    return (-1);
+  for (int i = 0; i < 3; i++)
+    fd[i] = redir_fd(redir, i);
+  // Whatever the shell printed must come out before the command's output
+  fflush(stdout);
+  code = find_cmd(args[0])->run(args, fd, in_shell);
+  redir_close(redir);
+  // An interrupted sleep looks like a job killed by SIGINT
+  if (code > 128)
+    return (code - 128);
+  return (code << 8);
+}
+
+/**
+ * Runs args inside the shell on the descriptors of the plan (opened and
+ * closed here). Returns the wait status the command would have had or -1
+ * if a redirection failed
+ **/
+int fast_foreground(char **args, redir_plan *redir) {
+  return run_on_plan(args, redir, 1);
+}
+
+/**
+ * Like fast_foreground() but in a forked child of the shell (a background
+ * list): the event loop it inherited belongs to the shell and is left alone
+ **/
+int fast_child(char **args, redir_plan *redir) {
+  return run_on_plan(args, redir, 0);
+}
+
+/**
+ * Runs args in a forked child in place of execvp, stdin and stdout are
+ * already redirected. Returns the exit code
+ **/
+int fast_exec(char **args) {
+  int fd[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  return find_cmd(args[0])->run(args, fd, 0);
+}
@@ -0,0 +1,29 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for fastcmd module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _FASTCMD_H
+#define _FASTCMD_H
+
+#include "job_control.h"
+#include "redir.h"
+
+/* Utility served by the shell itself, returns its exit code */
+typedef struct fast_cmd_ {
+  char *name;
+  int (*run)(char **args, const int *fd, int in_shell); /* fd: 0, 1, 2 */
+} fast_cmd;
+
+/**
+ * Public Functions
+ **/
+int fast_builtin(char **args, const redir_plan *redir);
+int fast_foreground(char **args, redir_plan *redir);
+int fast_child(char **args, redir_plan *redir);
+int fast_exec(char **args);
+
+#endif
@@ -11,6 +11,13 @@
  **/
 #include "job_control.h"
 
+// ; && or || at position i of the line
+static int list_separator(const char *line, int i) {
+  if (line[i] == ';')
+    return (1);
+  return (line[i] == '|' || line[i] == '&') && line[i + 1] == line[i];
+}
+
 /**
  *  get_command() reads in the next command line, separating it into distinct
  *  tokens using whitespace as delimiters. setup() sets the args parameter as a
@@ -76,7 +83,27 @@ void get_command(char inputBuffer[], int size, char *args[], int *background) {
       end = 1;
       break;
     default:                     /* Some other character */
-      if (inputBuffer[i] == '&') /* Background indicator */
+      /* Command list separators (; && ||) are tokens of their own, not in
+         the buffer: "a;b" has no room for another '\0' */
+      if (list_separator(inputBuffer, i)) {
+        char *sep = inputBuffer[i] == ';'   ? ";"
+                    : inputBuffer[i] == '|' ? "||"
+                                            : "&&";
+        if (start != -1) {
+          args[ct] = &inputBuffer[start];
+          ct++;
+        }
+        if (ct < size / 2 - 1)
+          args[ct++] = sep;
+        inputBuffer[i - iesc] = '\0';
+        i += strlen(sep) - 1; /* Second char of && or || */
+        start = -1;
+        iesc = 0;
+        break;
+      }
+      /* Background indicator, unless part of 2>&1, &> or &>> */
+      if (inputBuffer[i] == '&' && !(i > 0 && inputBuffer[i - 1] == '>') &&
+          inputBuffer[i + 1] != '>')
       {
         *background = 1;
         if (start != -1) {
@@ -155,6 +182,7 @@ void parse_redirections(char **args, char **file_in, char **file_out) {
  * Returns NULL if memory allocation fails
  **/
 job *new_job(pid_t pid, const char *command, enum job_state state) {
+  struct timespec now;
   job *aux;
   aux = (job *)malloc(sizeof(job));
   if (!aux)
@@ -163,6 +191,14 @@ job *new_job(pid_t pid, const char *command, enum job_state state) {
   aux->state = state;
   aux->command = strdup(command);
   aux->next = NULL;
+  aux->proc_fd[0] = aux->proc_fd[1] = aux->proc_fd[2] = -1;
+  aux->cpu_ticks = 0;
+  aux->sample_ns = 0;
+  aux->limits = 0;
+  aux->ckpt_slot = -1;
+  aux->pidfd = -1;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  aux->start_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
   return aux;
 }
 
@@ -177,23 +213,45 @@ void add_job(job *list, job *item) {
 }
 
 /**
- * Deletes from the list the item passed as second argument.
- * Returns 0 if the item does not exist.
+ * Takes out of the list the item passed as second argument, without
+ * freeing it. Returns 0 if the item does not exist.
  **/
-int delete_job(job *list, job *item) {
+int remove_job(job *list, job *item) {
   job *aux = list;
   while (aux->next != NULL && aux->next != item)
     aux = aux->next;
   if (aux->next) {
     aux->next = item->next;
-    free(item->command);
-    free(item);
+    item->next = NULL;
     list->pgid--;
     return 1;
   } else
     return 0;
 }
 
+/**
+ * Frees an item that is no longer in a list
+ **/
+void free_job(job *item) {
+  for (int i = 0; i < 3; i++) {
+    if (item->proc_fd[i] != -1)
+      close(item->proc_fd[i]);
+  }
+  free(item->command);
+  free(item);
+}
+
+/**
+ * Deletes from the list the item passed as second argument.
+ * Returns 0 if the item does not exist.
+ **/
+int delete_job(job *list, job *item) {
+  if (!remove_job(list, item))
+    return 0;
+  free_job(item);
+  return 1;
+}
+
 /**
  * Looks an item up by its PID and returns it.
  * Returns NULL if the item is not found.
@@ -33,14 +33,19 @@
  * Enumerations
  **/
 enum status { SUSPENDED, SIGNALED, EXITED, CONTINUED };
-enum job_state { FOREGROUND, BACKGROUND, STOPPED };
+enum job_state { FOREGROUND, BACKGROUND, STOPPED, QUEUED };
 static char *status_strings[] = {"Suspended", "Signaled", "Exited",
                                  "Continued"};
-static char *state_strings[] = {"Foreground", "Background", "Stopped"};
+static char *state_strings[] = {"Foreground", "Background", "Stopped",
+                                "Queued"};
 
+/* Alarm of alarm-thread, shared by its thread and the job it kills */
 typedef struct waitThread_s {
   int wait;
   pid_t pid;
+  int wake_fd; /* eventfd written to cancel the alarm */
+  time_t deadline; /* When it fires (time(NULL) clock) */
+  int refs;    /* Thread + job, the last one to let go frees it */
 } waitThread_t;
 
 /* Job type for job list */
@@ -51,12 +56,19 @@ typedef struct job_ {
   struct job_ *next; /* Next job in the list */
   int inmortal;
   char **comm_args;
-  pthread_t *threadWait;
+  waitThread_t *threadWait;
   int isProcWait;
   pid_t pid_wait;
   int isAlarmSig;
   int timeAlarmSig;
   time_t initTime;
+  int proc_fd[3]; /* /proc/<pid>/{stat,statm,io} during jobs --watch */
+  unsigned long long cpu_ticks; /* utime + stime at the last sample */
+  long long sample_ns;          /* Time of the last sample */
+  int limits; /* Mask of the resource limits it was started with */
+  int ckpt_slot; /* Slot in the checkpoint file, -1 if none */
+  int pidfd; /* Adopted from a previous shell (not a child): its pidfd */
+  long long start_ns; /* CLOCK_MONOTONIC launch time, 0: not profiled */
 } job;
 
 /* Type for job list iterator */
@@ -69,6 +81,8 @@ void get_command(char inputBuffer[], int size, char *args[], int *background);
 void parse_redirections(char **args, char **file_in, char **file_out);
 job *new_job(pid_t pid, const char *command, enum job_state state);
 void add_job(job *list, job *item);
+int remove_job(job *list, job *item);
+void free_job(job *item);
 int delete_job(job *list, job *item);
 job *get_item_bypid(job *list, pid_t pid);
 job *get_item_bypos(job *list, int n);
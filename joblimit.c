@@ -0,0 +1,198 @@
+/**
+ * Linux Job Control Shell Project
+ * joblimit module: limit prefix and default limits of background jobs
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Limits are set with setrlimit() in the child right before execvp. Each
+ * job keeps the mask of limits it was started with, so when it ends the
+ * shell can tell a limit hit (SIGXCPU, SIGXFSZ, a crash under an address
+ * space or stack cap) from any other death.
+ **/
+#include "joblimit.h"
+#include "jobsched.h"
+
+#include <errno.h>
+
+static const int resources[] = {RLIMIT_CPU,   RLIMIT_AS,    RLIMIT_NOFILE,
+                                RLIMIT_NPROC, RLIMIT_FSIZE, RLIMIT_CORE,
+                                RLIMIT_STACK};
+
+static job_limits defaults; /* Background jobs without their own value */
+
+// Parses the value of a limit: cpu takes a duration (seconds by default),
+// sizes take K/M/G suffixes, "unlimited" is accepted by all of them
+static int parse_value(enum job_limit limit, const char *str, rlim_t *value) {
+  char *end;
+  double number;
+  long long ns;
+
+  if (!strcmp(str, "unlimited")) {
+    *value = RLIM_INFINITY;
+    return (0);
+  }
+  if (limit == LIMIT_CPU) {
+    if (parse_duration(str, &ns) == -1)
+      return (-1);
+    // Whole seconds, a CPU limit of 0 would kill the job at once
+    *value = ns < 1000000000LL ? 1 : (ns + 999999999LL) / 1000000000LL;
+    return (0);
+  }
+  number = strtod(str, &end);
+  if (end == str || number < 0)
+    return (-1);
+  if (limit == LIMIT_NOFILE || limit == LIMIT_NPROC) {
+    if (*end)
+      return (-1);
+  } else if (*end == 'K' || *end == 'k') {
+    number *= 1024, end++;
+  } else if (*end == 'M' || *end == 'm') {
+    number *= 1024 * 1024, end++;
+  } else if (*end == 'G' || *end == 'g') {
+    number *= 1024 * 1024 * 1024, end++;
+  }
+  if (*end)
+    return (-1);
+  *value = (rlim_t)number;
+  return (0);
+}
+
+// Parses one "name=value". Returns -1 if arg is not a limit
+static int parse_limit(const char *arg, job_limits *limits) {
+  const char *eq = strchr(arg, '=');
+  if (!eq)
+    return (-1);
+  for (int i = 0; i < N_LIMITS; i++) {
+    if (strlen(limit_strings[i]) == eq - arg &&
+        !strncmp(arg, limit_strings[i], eq - arg)) {
+      if (parse_value(i, eq + 1, &limits->value[i]) == -1)
+        return (-1);
+      limits->mask |= 1 << i;
+      return (0);
+    }
+  }
+  return (-1);
+}
+
+/**
+ * Parses "limit name=value ... cmd". Returns the index of cmd in args or -1
+ * on error (the error is printed).
+ **/
+int limit_parse(char **args, job_limits *limits) {
+  int i = 1;
+  memset(limits, 0, sizeof(job_limits));
+  for (; args[i] && strchr(args[i], '='); i++) {
+    if (parse_limit(args[i], limits) == -1) {
+      printf("limit: invalid limit %s\n", args[i]);
+      return (-1);
+    }
+  }
+  if (!args[i]) {
+    printf("Usage: limit name=value... cmd [args...] (names: cpu as nofile "
+           "nproc fsize core stack)\n");
+    return (-1);
+  }
+  return (i);
+}
+
+/**
+ * Adds the default background limits that the job does not set itself
+ **/
+void limit_add_defaults(job_limits *limits) {
+  for (int i = 0; i < N_LIMITS; i++) {
+    if ((defaults.mask & (1 << i)) && !(limits->mask & (1 << i))) {
+      limits->value[i] = defaults.value[i];
+      limits->mask |= 1 << i;
+    }
+  }
+}
+
+/**
+ * Sets the limits on the calling process (the child, before execvp).
+ * A hard limit is only lowered. Returns -1 if any of them failed.
+ **/
+int limit_apply(const job_limits *limits) {
+  int ret = 0;
+  for (int i = 0; i < N_LIMITS; i++) {
+    struct rlimit rl;
+    rlim_t value = limits->value[i];
+    if (!(limits->mask & (1 << i)) || getrlimit(resources[i], &rl) == -1)
+      continue;
+    // The CPU hard limit is a second later so the job gets SIGXCPU first
+    if (i == LIMIT_CPU && value != RLIM_INFINITY)
+      value++;
+    if (value < rl.rlim_max || rl.rlim_max == RLIM_INFINITY)
+      rl.rlim_max = value;
+    rl.rlim_cur = limits->value[i] < rl.rlim_max ? limits->value[i]
+                                                  : rl.rlim_max;
+    if (setrlimit(resources[i], &rl) == -1) {
+      fprintf(stderr, "limit %s: %s\n", limit_strings[i], strerror(errno));
+      ret = -1;
+    }
+  }
+  return (ret);
+}
+
+/**
+ * Why a job that ran with the given limit mask ended, from its raw wait
+ * status: a text like " (CPU time limit)" or "" when no limit explains it.
+ * Only signals tell: an error exit looks the same with or without a limit
+ **/
+const char *limit_explain(int status, int mask) {
+  if (WIFSIGNALED(status)) {
+    int sig = WTERMSIG(status);
+    if (sig == SIGXCPU)
+      return " (CPU time limit exceeded)";
+    if (sig == SIGXFSZ)
+      return " (file size limit exceeded)";
+    if (sig == SIGKILL && (mask & (1 << LIMIT_CPU)))
+      return " (killed, maybe at the CPU time hard limit)";
+    if ((sig == SIGSEGV || sig == SIGABRT || sig == SIGBUS) &&
+        (mask & (1 << LIMIT_AS)))
+      return " (out of memory under the address space limit?)";
+    if ((sig == SIGSEGV || sig == SIGBUS) && (mask & (1 << LIMIT_STACK)))
+      return " (stack limit?)";
+  }
+  return "";
+}
+
+static void print_limits(const job_limits *limits) {
+  for (int i = 0; i < N_LIMITS; i++) {
+    if (!(limits->mask & (1 << i)))
+      continue;
+    if (limits->value[i] == RLIM_INFINITY)
+      printf(" %s=unlimited", limit_strings[i]);
+    else
+      printf(" %s=%llu", limit_strings[i],
+             (unsigned long long)limits->value[i]);
+  }
+}
+
+/**
+ * limit                       prints the default limits of background jobs
+ * limit -d name=value...      sets them (limit -d off clears them)
+ * The "limit name=value... cmd" prefix is handled by the prompt loop.
+ **/
+void limit_builtin(char **args) {
+  job_limits new_defaults = defaults;
+
+  if (!args[1]) {
+    printf("Background job limits:");
+    if (!defaults.mask)
+      printf(" none");
+    print_limits(&defaults);
+    printf("\n");
+    return;
+  }
+  for (int i = 2; args[i]; i++) {
+    if (!strcmp(args[i], "off")) {
+      memset(&new_defaults, 0, sizeof(new_defaults));
+    } else if (parse_limit(args[i], &new_defaults) == -1) {
+      printf("limit: invalid limit %s\n", args[i]);
+      return;
+    }
+  }
+  defaults = new_defaults;
+}
@@ -0,0 +1,47 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for joblimit module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _JOBLIMIT_H
+#define _JOBLIMIT_H
+
+#include "job_control.h"
+
+#include <sys/resource.h>
+
+/**
+ * Enumerations
+ **/
+enum job_limit {
+  LIMIT_CPU,
+  LIMIT_AS,
+  LIMIT_NOFILE,
+  LIMIT_NPROC,
+  LIMIT_FSIZE,
+  LIMIT_CORE,
+  LIMIT_STACK,
+  N_LIMITS
+};
+static char *limit_strings[] = {"cpu",   "as",   "nofile", "nproc",
+                                "fsize", "core", "stack"};
+
+/* Resource limits of a job, bit i of mask set when value[i] is used */
+typedef struct job_limits_ {
+  int mask;
+  rlim_t value[N_LIMITS];
+} job_limits;
+
+/**
+ * Public Functions
+ **/
+int limit_parse(char **args, job_limits *limits);
+void limit_add_defaults(job_limits *limits);
+int limit_apply(const job_limits *limits);
+const char *limit_explain(int status, int mask);
+void limit_builtin(char **args);
+
+#endif
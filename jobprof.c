@@ -0,0 +1,271 @@
+/**
+ * Linux Job Control Shell Project
+ * jobprof module: run time profile of the command lines
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Every job that ends adds its wall time and the rusage given by wait4()
+ * to the entry of its command line. The line is normalized as the program
+ * name without its directory followed by the arguments, one space apart.
+ * Background jobs are reaped by the SIGCHLD handler, so entries live in a
+ * fixed table and recording only does arithmetic and string copies. The
+ * table is only touched with SIGCHLD blocked, as tasks is.
+ *
+ * The expected time of a line is a moving average of its last runs, so it
+ * follows a command that gets slower. With --jobprof the table is loaded
+ * from a text file and written back through a temporary file and a
+ * rename(), at most once every PROF_SAVE_NS and on exit.
+ **/
+#include "jobprof.h"
+#include "notify.h"
+#include "shell.h"
+
+#include <errno.h>
+#include <limits.h>
+
+static prof_entry table[PROF_ENTRIES];
+static prof_entry snapshot[PROF_ENTRIES]; /* Copy being written or sorted */
+static char *store = NULL;
+static int dirty = 0;
+static long long saved_ns = 0;
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+// "prog arg1 arg2" from argv, truncated to the size of a key
+static void normalize(char **args, char *key) {
+  size_t len = 0;
+
+  for (int i = 0; args[i] && len < PROF_KEY_LEN - 1; i++) {
+    const char *word = args[i];
+    if (i == 0 && strrchr(word, '/'))
+      word = strrchr(word, '/') + 1;
+    if (i > 0)
+      key[len++] = ' ';
+    while (*word && len < PROF_KEY_LEN - 1)
+      key[len++] = *word++;
+  }
+  key[len] = '\0';
+}
+
+// FNV-1a, 0 marks a free entry
+static unsigned int hash_key(const char *key) {
+  unsigned int hash = 2166136261u;
+  for (; *key; key++)
+    hash = (hash ^ (unsigned char)*key) * 16777619u;
+  return (hash ? hash : 1);
+}
+
+static prof_entry *find(const char *key, unsigned int hash) {
+  for (int i = 0; i < PROF_ENTRIES; i++) {
+    if (table[i].hash == hash && !strcmp(table[i].key, key))
+      return (&table[i]);
+  }
+  return NULL;
+}
+
+// A free entry or the one that ran longest ago
+static prof_entry *take(void) {
+  prof_entry *oldest = &table[0];
+  for (int i = 0; i < PROF_ENTRIES; i++) {
+    if (!table[i].hash)
+      return (&table[i]);
+    if (table[i].last_run < oldest->last_run)
+      oldest = &table[i];
+  }
+  return (oldest);
+}
+
+static long long timeval_ns(struct timeval tv) {
+  return (tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL);
+}
+
+/**
+ * Adds a run of args that started at start_ns (CLOCK_MONOTONIC) and ended
+ * now. Safe in the SIGCHLD handler, call it with SIGCHLD blocked.
+ **/
+void prof_record(char **args, long long start_ns, const struct rusage *ru) {
+  char key[PROF_KEY_LEN];
+  long long wall = now_ns() - start_ns;
+  unsigned int hash;
+  prof_entry *entry;
+
+  if (!args || !args[0] || start_ns <= 0)
+    return;
+  normalize(args, key);
+  hash = hash_key(key);
+  entry = find(key, hash);
+  if (!entry) {
+    entry = take();
+    memset(entry, 0, sizeof(*entry));
+    entry->hash = hash;
+    memcpy(entry->key, key, sizeof(key));
+    entry->expected_ns = wall;
+  }
+  // The last runs weigh more: 1/4 of the new one
+  entry->expected_ns += (wall - entry->expected_ns) / 4;
+  entry->runs++;
+  entry->wall_ns += wall;
+  if (wall > entry->max_wall_ns)
+    entry->max_wall_ns = wall;
+  if (ru) {
+    entry->user_ns += timeval_ns(ru->ru_utime);
+    entry->sys_ns += timeval_ns(ru->ru_stime);
+    if (ru->ru_maxrss > entry->max_rss_kb)
+      entry->max_rss_kb = ru->ru_maxrss;
+  }
+  entry->last_run = time(NULL);
+  dirty = 1;
+}
+
+/**
+ * Expected wall time of args in ns, -1 if it never ran. Safe in the SIGCHLD
+ * handler, call it with SIGCHLD blocked.
+ **/
+long long prof_expected(char **args) {
+  char key[PROF_KEY_LEN];
+  prof_entry *entry;
+
+  if (!args || !args[0])
+    return (-1);
+  normalize(args, key);
+  entry = find(key, hash_key(key));
+  return (entry ? entry->expected_ns : -1);
+}
+
+// Copy of the table to read without SIGCHLD blocked. Saving it clears the
+// changes
+static void take_snapshot(int saving) {
+  block_SIGCHLD();
+  memcpy(snapshot, table, sizeof(table));
+  if (saving)
+    dirty = 0;
+  unblock_SIGCHLD();
+}
+
+/**
+ * Writes the table to the --jobprof file if it changed, at most once every
+ * PROF_SAVE_NS unless force is set
+ **/
+void prof_save(int force) {
+  char tmp[PATH_MAX];
+  FILE *fp;
+
+  if (!store || !dirty || (!force && now_ns() - saved_ns < PROF_SAVE_NS))
+    return;
+  take_snapshot(1);
+  saved_ns = now_ns();
+  snprintf(tmp, sizeof(tmp), "%s.tmp", store);
+  fp = fopen(tmp, "w");
+  if (!fp) {
+    perror("Error at fopen");
+    return;
+  }
+  fprintf(fp, "# jobprof: runs expected_ns wall_ns max_wall_ns user_ns "
+              "sys_ns max_rss_kb last_run command\n");
+  for (int i = 0; i < PROF_ENTRIES; i++) {
+    prof_entry *e = &snapshot[i];
+    if (!e->hash)
+      continue;
+    fprintf(fp, "%ld %lld %lld %lld %lld %lld %ld %lld %s\n", e->runs,
+            e->expected_ns, e->wall_ns, e->max_wall_ns, e->user_ns,
+            e->sys_ns, e->max_rss_kb, (long long)e->last_run, e->key);
+  }
+  if (fclose(fp) == EOF || rename(tmp, store) == -1) {
+    perror("Error saving the job profile");
+    unlink(tmp);
+  }
+}
+
+static void save_at_exit(void) { prof_save(1); }
+
+static void prof_event(notify_event_t *ev) {
+  if (ev->kind == NOTIFY_ENDED)
+    prof_save(0);
+}
+
+/**
+ * --jobprof file: loads the profile kept by previous shells and saves it
+ * as jobs end. Returns -1 on error.
+ **/
+int prof_open(const char *path) {
+  char line[PROF_KEY_LEN + 256];
+  FILE *fp;
+  int n = 0;
+
+  store = strdup(path);
+  if (!store) {
+    perror("Error at strdup");
+    return (-1);
+  }
+  fp = fopen(path, "r");
+  if (!fp && errno != ENOENT) {
+    perror("Error opening the job profile");
+    return (-1);
+  }
+  while (fp && n < PROF_ENTRIES && fgets(line, sizeof(line), fp)) {
+    prof_entry *e = &table[n];
+    long long last_run;
+    int pos;
+    if (line[0] == '#')
+      continue;
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "%ld %lld %lld %lld %lld %lld %ld %lld %n", &e->runs,
+               &e->expected_ns, &e->wall_ns, &e->max_wall_ns, &e->user_ns,
+               &e->sys_ns, &e->max_rss_kb, &last_run, &pos) != 8 ||
+        !line[pos])
+      continue;
+    e->last_run = last_run;
+    snprintf(e->key, sizeof(e->key), "%s", line + pos);
+    e->hash = hash_key(e->key);
+    n++;
+  }
+  if (fp)
+    fclose(fp);
+  notify_subscribe(prof_event);
+  atexit(save_at_exit);
+  return (0);
+}
+
+static int by_expected(const void *a, const void *b) {
+  const prof_entry *x = (const prof_entry *)a, *y = (const prof_entry *)b;
+  if (x->hash == 0 || y->hash == 0)
+    return ((x->hash == 0) - (y->hash == 0));
+  return ((y->expected_ns > x->expected_ns) -
+          (y->expected_ns < x->expected_ns));
+}
+
+/**
+ * jobprof [count | clear]: the slowest command lines by expected time
+ **/
+void prof_builtin(char **args) {
+  int top = PROF_TOP;
+
+  if (args[1] && !strcmp(args[1], "clear")) {
+    block_SIGCHLD();
+    memset(table, 0, sizeof(table));
+    dirty = 1;
+    unblock_SIGCHLD();
+    prof_save(1);
+    return;
+  }
+  if (args[1] && (top = atoi(args[1])) <= 0) {
+    printf("Usage: jobprof [count | clear]\n");
+    return;
+  }
+  take_snapshot(0);
+  qsort(snapshot, PROF_ENTRIES, sizeof(prof_entry), by_expected);
+  printf("%6s %10s %10s %10s %9s  %s\n", "runs", "expected", "max",
+         "cpu/run", "max rss", "command");
+  for (int i = 0; i < top && i < PROF_ENTRIES && snapshot[i].hash; i++) {
+    prof_entry *e = &snapshot[i];
+    printf("%6ld %9.2fs %9.2fs %9.2fs %7ldkB  %s\n", e->runs,
+           e->expected_ns / 1e9, e->max_wall_ns / 1e9,
+           (e->user_ns + e->sys_ns) / 1e9 / e->runs, e->max_rss_kb, e->key);
+  }
+}
@@ -0,0 +1,44 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for jobprof module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _JOBPROF_H
+#define _JOBPROF_H
+
+#include "job_control.h"
+
+#include <sys/resource.h>
+
+#define PROF_ENTRIES 256 /* Command lines profiled, the oldest one makes room */
+#define PROF_KEY_LEN 128 /* Normalized command line kept in each entry */
+#define PROF_SAVE_NS 5000000000LL /* Least time between two saves */
+#define PROF_TOP 10 /* Lines printed by jobprof without a count */
+
+/* Run times of one command line */
+typedef struct prof_entry_ {
+  unsigned int hash; /* 0: free entry */
+  char key[PROF_KEY_LEN];
+  long runs;
+  long long expected_ns; /* Moving average of the wall time */
+  long long wall_ns;     /* Totals of every run */
+  long long max_wall_ns;
+  long long user_ns;
+  long long sys_ns;
+  long max_rss_kb;
+  time_t last_run;
+} prof_entry;
+
+/**
+ * Public Functions
+ **/
+int prof_open(const char *path);
+void prof_save(int force);
+void prof_record(char **args, long long start_ns, const struct rusage *ru);
+long long prof_expected(char **args);
+void prof_builtin(char **args);
+
+#endif
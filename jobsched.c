@@ -0,0 +1,358 @@
+/**
+ * Linux Job Control Shell Project
+ * jobsched module: every / at / sched builtins
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Scheduled commands live in a queue sorted by absolute deadline and a single
+ * timerfd is armed to the earliest one. Periodic deadlines advance by whole
+ * intervals from the previous deadline, never from the launch time, so they
+ * do not drift. Launched instances are regular background jobs in tasks.
+ **/
+#include "jobsched.h"
+#include "event_loop.h"
+#include "shell.h"
+
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+static sched_entry *queue = NULL; /* Sorted by deadline */
+static int next_id = 1;
+static int timer_fd = -1;
+
+/**
+ * Current CLOCK_MONOTONIC time in ns
+ **/
+long long monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Parses durations like "10", "1.5s", "250ms", "5m", "2h" or "1d" (seconds
+ * when there is no suffix). Returns -1 if the string is not valid.
+ **/
+int parse_duration(const char *str, long long *ns) {
+  char *end;
+  double value = strtod(str, &end);
+  double unit = 1e9;
+
+  if (end == str || value < 0)
+    return (-1);
+  if (!strcmp(end, "ms"))
+    unit = 1e6;
+  else if (!strcmp(end, "m"))
+    unit = 60e9;
+  else if (!strcmp(end, "h"))
+    unit = 3600e9;
+  else if (!strcmp(end, "d"))
+    unit = 86400e9;
+  else if (*end && strcmp(end, "s"))
+    return (-1);
+  *ns = (long long)(value * unit);
+  return (0);
+}
+
+// Arms the timerfd for the head of the queue (or disarms it)
+static void rearm_timer(void) {
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  if (queue) {
+    // A zero it_value disarms, deadlines are always > 0 on CLOCK_MONOTONIC
+    its.it_value.tv_sec = queue->deadline / 1000000000LL;
+    its.it_value.tv_nsec = queue->deadline % 1000000000LL;
+  }
+  timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void insert_entry(sched_entry *entry) {
+  sched_entry **aux = &queue;
+  while (*aux && (*aux)->deadline <= entry->deadline)
+    aux = &(*aux)->next;
+  entry->next = *aux;
+  *aux = entry;
+}
+
+static void unlink_entry(sched_entry *entry) {
+  sched_entry **aux = &queue;
+  while (*aux && *aux != entry)
+    aux = &(*aux)->next;
+  if (*aux)
+    *aux = entry->next;
+}
+
+static void forget_instance(sched_entry *entry) {
+  if (entry->pidfd != -1) {
+    loop_unwatch_fd(entry->pidfd);
+    close(entry->pidfd);
+    entry->pidfd = -1;
+  }
+  entry->last_pid = 0;
+}
+
+static void free_entry(sched_entry *entry) {
+  forget_instance(entry);
+  free_pp_char(entry->comm_args);
+  free(entry);
+}
+
+static void launch_instance(sched_entry *entry);
+
+// The pidfd of the running instance became readable: it has ended
+static void instance_done(int fd, short revents, void *data) {
+  sched_entry *entry = (sched_entry *)data;
+  forget_instance(entry);
+  if (entry->queued > 0) {
+    entry->queued--;
+    launch_instance(entry);
+  } else if (!entry->periodic) {
+    // One-shot entries are kept until their only run has ended
+    free_entry(entry);
+  }
+}
+
+static void launch_instance(sched_entry *entry) {
+  pid_t pid = launch_background(entry->comm_args);
+  if (pid == -1)
+    return;
+  entry->runs++;
+  entry->last_pid = pid;
+  entry->pidfd = syscall(SYS_pidfd_open, pid, 0);
+  // No room in the loop: the job is looked up in tasks, as without pidfds
+  if (entry->pidfd != -1 &&
+      loop_watch_fd(entry->pidfd, POLLIN, instance_done, entry) == -1) {
+    close(entry->pidfd);
+    entry->pidfd = -1;
+  }
+}
+
+// Is the last launched instance still running?
+static int instance_running(sched_entry *entry) {
+  int running;
+  if (entry->pidfd != -1)
+    return (1);
+  if (entry->last_pid <= 0)
+    return (0);
+  // No pidfd support: look the job up in tasks
+  block_SIGCHLD();
+  running = get_item_bypid(tasks, entry->last_pid) != NULL;
+  unblock_SIGCHLD();
+  return (running);
+}
+
+static void fire_entry(sched_entry *entry) {
+  if (instance_running(entry)) {
+    switch (entry->policy) {
+    case OVERLAP_SKIP:
+      entry->skipped++;
+      return;
+    case OVERLAP_QUEUE:
+      entry->queued++;
+      return;
+    case OVERLAP_KILL:
+      killpg(entry->last_pid, SIGCONT);
+      killpg(entry->last_pid, SIGKILL);
+      forget_instance(entry);
+      break;
+    }
+  }
+  launch_instance(entry);
+}
+
+// The timerfd expired: launch every entry whose deadline has passed
+static void timer_ready(int fd, short revents, void *data) {
+  unsigned long long expirations;
+  long long now = monotonic_ns();
+  ssize_t ignored = read(fd, &expirations, sizeof(expirations));
+  (void)ignored;
+
+  while (queue && queue->deadline <= now) {
+    sched_entry *entry = queue;
+    queue = entry->next;
+    if (entry->periodic) {
+      // Periods that went by while we were busy (foreground job...) are
+      // counted as missed, the next deadline stays on the original grid
+      long long late = (now - entry->deadline) / entry->interval;
+      entry->missed += late;
+      entry->deadline += (late + 1) * entry->interval;
+      fire_entry(entry);
+      insert_entry(entry);
+    } else {
+      fire_entry(entry);
+      if (entry->pidfd == -1)
+        free_entry(entry);
+    }
+  }
+  rearm_timer();
+}
+
+/**
+ * Creates the timerfd of the queue and registers it in the event loop.
+ * Returns -1 on error.
+ **/
+int sched_init(void) {
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd == -1) {
+    perror("Error at timerfd_create");
+    return (-1);
+  }
+  return loop_watch_fd(timer_fd, POLLIN, timer_ready, NULL);
+}
+
+static sched_entry *new_entry(char **args, enum overlap_policy policy) {
+  sched_entry *entry = (sched_entry *)calloc(1, sizeof(sched_entry));
+  if (!entry) {
+    perror("Error at calloc");
+    return NULL;
+  }
+  entry->id = next_id++;
+  entry->policy = policy;
+  entry->comm_args = cpy_args(args);
+  entry->pidfd = -1;
+  return entry;
+}
+
+// Parses the optional "-p skip|queue|kill", returns the index of the next
+// argument or -1 on syntax error
+static int parse_policy(char **args, int i, enum overlap_policy *policy) {
+  *policy = OVERLAP_SKIP;
+  if (args[i] && !strcmp(args[i], "-p")) {
+    if (!args[i + 1])
+      return (-1);
+    if (!strcmp(args[i + 1], "skip"))
+      *policy = OVERLAP_SKIP;
+    else if (!strcmp(args[i + 1], "queue"))
+      *policy = OVERLAP_QUEUE;
+    else if (!strcmp(args[i + 1], "kill"))
+      *policy = OVERLAP_KILL;
+    else
+      return (-1);
+    i += 2;
+  }
+  return (i);
+}
+
+/**
+ * every [-p skip|queue|kill] <interval> [-p ...] cmd [args...]
+ **/
+void sched_every(char **args) {
+  enum overlap_policy policy;
+  long long interval;
+  int i = parse_policy(args, 1, &policy);
+  int cmd = -1;
+
+  // The policy may also come right after the interval
+  if (i != -1 && args[i] && parse_duration(args[i], &interval) != -1 &&
+      interval > 0)
+    cmd = (i == 1) ? parse_policy(args, 2, &policy) : i + 1;
+  if (cmd == -1 || !args[cmd]) {
+    printf("Usage: every [-p skip|queue|kill] <interval> cmd [args...]\n");
+    return;
+  }
+  sched_entry *entry = new_entry(&args[cmd], policy);
+  if (!entry)
+    return;
+  entry->periodic = 1;
+  entry->interval = interval;
+  entry->deadline = monotonic_ns() + interval;
+  insert_entry(entry);
+  rearm_timer();
+  printf("Scheduled [%d] every %s: %s\n", entry->id, args[i], args[cmd]);
+}
+
+// Seconds until a wall clock time "HH:MM[:SS]" (tomorrow if already passed)
+static int parse_clock_time(const char *str, long long *ns) {
+  int hour, min, sec = 0;
+  time_t now = time(NULL);
+  struct tm when;
+
+  if (sscanf(str, "%d:%d:%d", &hour, &min, &sec) < 2 || hour < 0 ||
+      hour > 23 || min < 0 || min > 59 || sec < 0 || sec > 59)
+    return (-1);
+  localtime_r(&now, &when);
+  when.tm_hour = hour;
+  when.tm_min = min;
+  when.tm_sec = sec;
+  when.tm_isdst = -1;
+  time_t target = mktime(&when);
+  if (target <= now) {
+    when.tm_mday++;
+    when.tm_isdst = -1;
+    target = mktime(&when);
+  }
+  *ns = (long long)(target - now) * 1000000000LL;
+  return (0);
+}
+
+/**
+ * at <HH:MM[:SS] | +delay> cmd [args...]
+ **/
+void sched_at(char **args) {
+  long long delay;
+  int ok;
+
+  if (!args[1] || !args[2]) {
+    printf("Usage: at <HH:MM[:SS] | +delay> cmd [args...]\n");
+    return;
+  }
+  if (args[1][0] == '+')
+    ok = parse_duration(&args[1][1], &delay);
+  else
+    ok = parse_clock_time(args[1], &delay);
+  if (ok == -1) {
+    printf("at: invalid time %s\n", args[1]);
+    return;
+  }
+  sched_entry *entry = new_entry(&args[2], OVERLAP_SKIP);
+  if (!entry)
+    return;
+  entry->deadline = monotonic_ns() + delay;
+  insert_entry(entry);
+  rearm_timer();
+  printf("Scheduled [%d] at %s: %s\n", entry->id, args[1], args[2]);
+}
+
+static void print_entry(sched_entry *entry, long long now) {
+  if (entry->periodic)
+    printf(" [%d] every %.3fs, next in %.3fs, ", entry->id,
+           entry->interval / 1e9, (entry->deadline - now) / 1e9);
+  else
+    printf(" [%d] at, next in %.3fs, ", entry->id,
+           (entry->deadline - now) / 1e9);
+  printf("runs: %d, skipped: %d, queued: %d, missed: %d, policy: %s, "
+         "command: %s\n",
+         entry->runs, entry->skipped, entry->queued, entry->missed,
+         overlap_strings[entry->policy], entry->comm_args[0]);
+}
+
+/**
+ * sched          --> lists upcoming launches
+ * sched -c <id>  --> cancels a scheduled command (running instances go on)
+ **/
+void sched_builtin(char **args) {
+  sched_entry *entry;
+
+  if (args[1] && !strcmp(args[1], "-c")) {
+    int id = args[2] ? atoi(args[2]) : 0;
+    for (entry = queue; entry && entry->id != id; entry = entry->next)
+      ;
+    if (!entry) {
+      printf("sched: no scheduled command %d\n", id);
+      return;
+    }
+    unlink_entry(entry);
+    free_entry(entry);
+    rearm_timer();
+    return;
+  }
+
+  long long now = monotonic_ns();
+  printf("Scheduled commands:\n");
+  for (entry = queue; entry; entry = entry->next)
+    print_entry(entry, now);
+}
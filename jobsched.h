@@ -0,0 +1,48 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for jobsched module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _JOBSCHED_H
+#define _JOBSCHED_H
+
+#include "job_control.h"
+
+/**
+ * Enumerations
+ **/
+/* What to do when a deadline arrives and the previous run is still alive */
+enum overlap_policy { OVERLAP_SKIP, OVERLAP_QUEUE, OVERLAP_KILL };
+static char *overlap_strings[] = {"skip", "queue", "kill"};
+
+/* Entry of the timer queue, sorted by deadline */
+typedef struct sched_entry_ {
+  int id;
+  int periodic;       /* 1 for every, 0 for at */
+  long long interval; /* Period in ns (every) */
+  long long deadline; /* Next launch, absolute CLOCK_MONOTONIC ns */
+  enum overlap_policy policy;
+  char **comm_args;
+  pid_t last_pid; /* Last launched instance, 0 once it has ended */
+  int pidfd;      /* pidfd of last_pid while it is alive, -1 otherwise */
+  int queued;     /* Launches waiting for the running instance */
+  int runs;
+  int skipped;
+  int missed; /* Periods that passed while the shell could not launch */
+  struct sched_entry_ *next;
+} sched_entry;
+
+/**
+ * Public Functions
+ **/
+int sched_init(void);
+void sched_every(char **args);
+void sched_at(char **args);
+void sched_builtin(char **args);
+int parse_duration(const char *str, long long *ns);
+long long monotonic_ns(void);
+
+#endif
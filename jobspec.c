@@ -0,0 +1,300 @@
+/**
+ * Linux Job Control Shell Project
+ * jobspec module: job selectors for bg, stop, kill and deljob
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * A spec is a list of selectors: positions as listed by jobs (3, 3-500,
+ * 7-), states (%stopped, %running), command name globs (%worker*) and all.
+ * kill follows sh instead: a bare number is a pid and positions are written
+ * %3, %3-500. The builtins walk tasks once with SIGCHLD blocked and act on
+ * every job that matches, with one killpg per job. Taking one position at a
+ * time walked the list from the head for each job, which is quadratic on a
+ * big bgteam.
+ **/
+#include "jobspec.h"
+#include "ckpt.h"
+#include "shell.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <limits.h>
+
+static struct {
+  const char *name;
+  int signal;
+} signal_names[] = {{"HUP", SIGHUP},   {"INT", SIGINT},   {"QUIT", SIGQUIT},
+                    {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+                    {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+                    {"TSTP", SIGTSTP}, {NULL, 0}};
+
+static struct {
+  const char *name;
+  enum job_state state;
+} state_names[] = {{"stopped", STOPPED},
+                   {"running", BACKGROUND},
+                   {"background", BACKGROUND},
+                   {NULL, 0}};
+
+/**
+ * Signal given by number or name, with or without SIG (9, KILL, SIGKILL).
+ * Returns -1 if unknown.
+ **/
+int spec_signal(const char *str) {
+  if (str[0] >= '0' && str[0] <= '9')
+    return atoi(str);
+  if (!strncmp(str, "SIG", 3))
+    str += 3;
+  for (int i = 0; signal_names[i].name; i++) {
+    if (!strcmp(str, signal_names[i].name))
+      return signal_names[i].signal;
+  }
+  return (-1);
+}
+
+// Positions: n, n-m or n- (to the end of the list)
+static int parse_range(const char *arg, job_sel *sel) {
+  char *end;
+
+  sel->from = strtol(arg, &end, 10);
+  sel->to = sel->from;
+  if (end == arg || sel->from < 1)
+    return (-1);
+  if (*end == '-' && !end[1]) {
+    sel->to = INT_MAX;
+    return (0);
+  }
+  if (*end == '-') {
+    arg = end + 1;
+    sel->to = strtol(arg, &end, 10);
+    if (end == arg || sel->to < sel->from)
+      return (-1);
+  }
+  return (*end ? -1 : 0);
+}
+
+static int parse_sel(const char *arg, job_sel *sel) {
+  if (!strcmp(arg, "all")) {
+    sel->kind = SPEC_ALL;
+    return (0);
+  }
+  if (arg[0] != '%') {
+    sel->kind = SPEC_RANGE;
+    return parse_range(arg, sel);
+  }
+  arg++;
+  // %3 is the job at position 3, as in sh
+  if (arg[0] >= '0' && arg[0] <= '9') {
+    sel->kind = SPEC_RANGE;
+    return parse_range(arg, sel);
+  }
+  for (int i = 0; state_names[i].name; i++) {
+    if (!strcmp(arg, state_names[i].name)) {
+      sel->kind = SPEC_STATE;
+      sel->state = state_names[i].state;
+      return (0);
+    }
+  }
+  if (!*arg)
+    return (-1);
+  sel->kind = SPEC_GLOB;
+  sel->glob = arg;
+  return (0);
+}
+
+/**
+ * Parses the selectors in args (NULL terminated, they are not copied).
+ * Prints the first bad one and returns -1.
+ **/
+int spec_parse(char **args, job_spec *spec) {
+  int n = 0;
+
+  while (args[n])
+    n++;
+  spec->n = 0;
+  spec->last = 0;
+  spec->sel = (job_sel *)malloc((n ? n : 1) * sizeof(job_sel));
+  if (!spec->sel) {
+    perror("Error at malloc");
+    return (-1);
+  }
+  for (int i = 0; i < n; i++) {
+    job_sel *sel = &spec->sel[spec->n];
+    if (parse_sel(args[i], sel) == -1) {
+      fprintf(stderr, "bad job spec: %s\n", args[i]);
+      spec_free(spec);
+      return (-1);
+    }
+    // Only ranges bound how far the walk has to go
+    if (sel->kind != SPEC_RANGE)
+      spec->last = INT_MAX;
+    else if (sel->to > spec->last)
+      spec->last = sel->to;
+    spec->n++;
+  }
+  return (0);
+}
+
+void spec_free(job_spec *spec) {
+  free(spec->sel);
+  spec->sel = NULL;
+  spec->n = 0;
+}
+
+static int spec_match(const job_spec *spec, job *item, int pos) {
+  for (int i = 0; i < spec->n; i++) {
+    const job_sel *sel = &spec->sel[i];
+    switch (sel->kind) {
+    case SPEC_ALL:
+      return (1);
+    case SPEC_RANGE:
+      if (pos >= sel->from && pos <= sel->to)
+        return (1);
+      break;
+    case SPEC_STATE:
+      if (item->state == sel->state)
+        return (1);
+      break;
+    case SPEC_GLOB:
+      if (!fnmatch(sel->glob, item->command, 0))
+        return (1);
+      break;
+    }
+  }
+  return (0);
+}
+
+/**
+ * Calls fn on every job of tasks that matches, in a single pass. fn may
+ * delete the job it gets. Call with SIGCHLD blocked. Returns the number of
+ * jobs matched.
+ **/
+int spec_each(const job_spec *spec, void (*fn)(job *item, void *data),
+              void *data) {
+  job *item = get_iterator(tasks);
+  int pos = 0, n = 0;
+
+  while (item && pos < spec->last) {
+    job *cur = next(item);
+    if (spec_match(spec, cur, ++pos)) {
+      fn(cur, data);
+      n++;
+    }
+  }
+  return (n);
+}
+
+static void do_bg(job *item, void *data) {
+  item->state = BACKGROUND;
+  ckpt_sync(item);
+  killpg(item->pgid, SIGCONT);
+  trace_event(TRACE_BG, item->pgid, item->command, 0);
+}
+
+static void do_stop(job *item, void *data) {
+  killpg(item->pgid, SIGSTOP);
+  // Not a child, the handler won't hear about it
+  if (item->pidfd != -1) {
+    item->state = STOPPED;
+    ckpt_sync(item);
+  }
+}
+
+static void do_kill(job *item, void *data) {
+  int sig = *(int *)data;
+
+  killpg(item->pgid, sig);
+  // A stopped job only gets the signal once it runs again. A stop signal
+  // is what it asked for, it stays stopped
+  if (item->state == STOPPED && sig != SIGKILL && sig != SIGCONT &&
+      sig != SIGSTOP && sig != SIGTSTP && sig != SIGTTIN && sig != SIGTTOU)
+    killpg(item->pgid, SIGCONT);
+}
+
+static void do_deljob(job *item, void *data) {
+  if (item->state == STOPPED) {
+    printf("No se permiten borrar trabajos en segundo plano suspendido\n");
+    return;
+  }
+  printf("Borrando trabajo de la lista de jobs: PID=%d command=%s\n",
+         item->pgid, item->command);
+  // Its alarm-thread, if any, still kills it
+  if (item->threadWait)
+    alarm_thread_put(item->threadWait);
+  ckpt_drop(item);
+  free_pp_char(item->comm_args);
+  delete_job(tasks, item);
+}
+
+// kill: signals the bare pids in sel and leaves the rest of the selectors
+// in it. Returns -1 for a position written without %
+static int kill_pids(char **sel, int sig) {
+  int k = 0;
+
+  for (int i = 0; sel[i]; i++) {
+    char *end;
+    long pid = strtol(sel[i], &end, 10);
+    if (sel[i][0] < '0' || sel[i][0] > '9') {
+      sel[k++] = sel[i];
+      continue;
+    }
+    if (*end || pid <= 0) {
+      fprintf(stderr, "kill: %s: a pid, or %%%s for job positions\n", sel[i],
+              sel[i]);
+      return (-1);
+    }
+    if (kill(pid, sig) == -1)
+      fprintf(stderr, "kill: %ld: %s\n", pid, strerror(errno));
+  }
+  sel[k] = NULL;
+  return (0);
+}
+
+/**
+ * bg, stop, kill [-sig] and deljob over a job spec. Without one, bg, stop
+ * and deljob take the current job (position 1). kill also takes pids.
+ **/
+void spec_builtin(char **args) {
+  char *current[] = {"1", NULL};
+  char **sel = &args[1];
+  void (*fn)(job *, void *) = NULL;
+  job_spec spec;
+  int sig = SIGTERM;
+  int n;
+
+  if (!strcmp(args[0], "bg"))
+    fn = do_bg;
+  else if (!strcmp(args[0], "stop"))
+    fn = do_stop;
+  else if (!strcmp(args[0], "deljob"))
+    fn = do_deljob;
+  else if (!strcmp(args[0], "kill")) {
+    fn = do_kill;
+    if (sel[0] && sel[0][0] == '-') {
+      sig = spec_signal(&sel[0][1]);
+      sel++;
+    }
+    if (sig <= 0 || !sel[0]) {
+      printf("Usage: kill [-sig] pid | job_spec...\n");
+      return;
+    }
+    if (kill_pids(sel, sig) == -1 || !sel[0])
+      return;
+  }
+  if (!fn)
+    return;
+  if (!sel[0])
+    sel = current;
+  if (spec_parse(sel, &spec) == -1)
+    return;
+
+  block_SIGCHLD();
+  n = spec_each(&spec, fn, &sig);
+  unblock_SIGCHLD();
+  spec_free(&spec);
+  if (!n)
+    printf("No hay trabajos que coincidan\n");
+}
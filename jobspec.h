@@ -0,0 +1,44 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for jobspec module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _JOBSPEC_H
+#define _JOBSPEC_H
+
+#include "job_control.h"
+
+/**
+ * Enumerations
+ **/
+enum spec_kind { SPEC_ALL, SPEC_RANGE, SPEC_STATE, SPEC_GLOB };
+
+/* One selector of a job spec: all, 3, 3-500, 7-, %stopped, %worker* */
+typedef struct job_sel_ {
+  enum spec_kind kind;
+  int from, to; /* Positions as listed by jobs, inclusive */
+  enum job_state state;
+  const char *glob; /* Matched against the command name */
+} job_sel;
+
+/* A job matches the spec if it matches any of its selectors */
+typedef struct job_spec_ {
+  int n;
+  job_sel *sel;
+  int last; /* No job past this position can match */
+} job_spec;
+
+/**
+ * Public Functions
+ **/
+int spec_parse(char **args, job_spec *spec);
+void spec_free(job_spec *spec);
+int spec_each(const job_spec *spec, void (*fn)(job *item, void *data),
+              void *data);
+int spec_signal(const char *str);
+void spec_builtin(char **args);
+
+#endif
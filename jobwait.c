@@ -0,0 +1,190 @@
+/**
+ * Linux Job Control Shell Project
+ * jobwait module: wait builtin
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * wait blocks in the event loop, so timers, the control socket and job
+ * notifications keep being served. Ends are learnt from the notification
+ * drain (the SIGCHLD path), the same place that removes jobs from tasks.
+ **/
+#include "jobwait.h"
+#include "event_loop.h"
+#include "jobsched.h"
+#include "notify.h"
+#include "shell.h"
+
+#include <errno.h>
+
+static wait_target *targets = NULL;
+static int n_targets = 0;
+static int n_done = 0;
+static int first_done = -1;
+static volatile sig_atomic_t wait_interrupted = 0;
+
+static void wait_event(notify_event_t *ev) {
+  if (ev->kind != NOTIFY_ENDED)
+    return;
+  for (int i = 0; i < n_targets; i++) {
+    if (!targets[i].done && targets[i].pid == ev->pgid) {
+      targets[i].done = 1;
+      targets[i].status = ev->info;
+      if (first_done == -1)
+        first_done = i;
+      n_done++;
+    }
+  }
+}
+
+static void sigint_wait(int signal) { wait_interrupted = 1; }
+
+/**
+ * Registers the wait builtin in the notification drain
+ **/
+void wait_init(void) { notify_subscribe(wait_event); }
+
+static void add_target(pid_t pid, int done, int status) {
+  targets = (wait_target *)realloc(targets,
+                                     (n_targets + 1) * sizeof(wait_target));
+  if (!targets) {
+    perror("Error at realloc");
+    exit(EXIT_FAILURE);
+  }
+  targets[n_targets].pid = pid;
+  targets[n_targets].done = done;
+  targets[n_targets].status = status;
+  if (done) {
+    if (first_done == -1)
+      first_done = n_targets;
+    n_done++;
+  }
+  n_targets++;
+}
+
+// Adds the job of a "pid" or "%pos" spec. Returns -1 if there is no such job
+static int add_spec(const char *spec) {
+  job *item;
+  pid_t pid;
+  int status;
+
+  block_SIGCHLD();
+  if (spec[0] == '%') {
+    item = get_item_bypos(tasks, atoi(&spec[1]));
+    pid = item ? item->pgid : -1;
+  } else {
+    pid = atoi(spec);
+    item = get_item_bypid(tasks, pid);
+  }
+  if (item)
+    add_target(pid, 0, 0);
+  unblock_SIGCHLD();
+  if (item)
+    return (0);
+  // Not in tasks: it was already reaped, so its event is queued or drained
+  notify_drain();
+  if (pid > 0 && notify_recent_status(pid, &status)) {
+    add_target(pid, 1, status);
+    return (0);
+  }
+  return (-1);
+}
+
+// Shell style exit status of a raw wait status
+static int exit_code(int status) {
+  int info;
+  enum status status_res = analyze_status(status, &info);
+  return status_res == SIGNALED ? 128 + info : info;
+}
+
+static void print_target(wait_target *target) {
+  int info;
+  enum status status_res = analyze_status(target->status, &info);
+  printf("Waited pid: %d, %s, info: %d\n", target->pid,
+         status_strings[status_res], info);
+}
+
+/**
+ * wait [-n] [-t timeout] [pid | %pos ...]
+ * Blocks until the given jobs (every background job without arguments)
+ * end, or just the first of them with -n. Returns the shell exit status of
+ * the last job (the first one with -n), 124 on timeout or interrupt (^C)
+ * and 127 if a job does not exist.
+ **/
+int wait_builtin(char **args) {
+  long long timeout = -1, deadline = 0;
+  int any = 0, i = 1, ret = 0;
+  struct sigaction sa, old_sa;
+
+  for (; args[i] && args[i][0] == '-'; i++) {
+    if (!strcmp(args[i], "-n"))
+      any = 1;
+    else if (!strcmp(args[i], "-t") && args[i + 1] &&
+             parse_duration(args[i + 1], &timeout) != -1)
+      i++;
+    else {
+      printf("Usage: wait [-n] [-t timeout] [pid | %%pos ...]\n");
+      return (2);
+    }
+  }
+
+  n_targets = n_done = 0;
+  first_done = -1;
+  if (!args[i]) {
+    notify_drain();
+    block_SIGCHLD();
+    for (job *item = get_iterator(tasks); item; item = item->next) {
+      if (item->state == BACKGROUND)
+        add_target(item->pgid, 0, 0);
+    }
+    unblock_SIGCHLD();
+  }
+  for (; args[i]; i++) {
+    if (add_spec(args[i]) == -1) {
+      printf("wait: no such job %s\n", args[i]);
+      ret = 127;
+    }
+  }
+  if (!n_targets)
+    return (ret);
+
+  // ^C stops waiting (the shell ignores SIGINT otherwise)
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sigint_wait;
+  sigemptyset(&sa.sa_mask);
+  wait_interrupted = 0;
+  sigaction(SIGINT, &sa, &old_sa);
+
+  if (timeout >= 0)
+    deadline = monotonic_ns() + timeout;
+  while (!(any ? n_done > 0 : n_done == n_targets) && !wait_interrupted) {
+    int timeout_ms = -1;
+    if (timeout >= 0) {
+      long long left = deadline - monotonic_ns();
+      if (left <= 0)
+        break;
+      timeout_ms = (left + 999999) / 1000000;
+    }
+    if (loop_poll_once(timeout_ms) == -1 && errno != EINTR) {
+      perror("Error at poll");
+      break;
+    }
+  }
+  sigaction(SIGINT, &old_sa, NULL);
+
+  if (any && n_done > 0) {
+    print_target(&targets[first_done]);
+    ret = exit_code(targets[first_done].status);
+  } else if (!any && n_done == n_targets) {
+    for (i = 0; i < n_targets; i++)
+      print_target(&targets[i]);
+    ret = exit_code(targets[n_targets - 1].status);
+  } else {
+    printf("wait: %s, %d of %d jobs ended\n",
+           wait_interrupted ? "interrupted" : "timed out", n_done, n_targets);
+    ret = 124;
+  }
+  n_targets = 0;
+  return (ret);
+}
@@ -0,0 +1,27 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for jobwait module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _JOBWAIT_H
+#define _JOBWAIT_H
+
+#include "job_control.h"
+
+/* Job a wait builtin is blocked on */
+typedef struct wait_target_ {
+  pid_t pid;
+  int done;
+  int status; /* Raw wait status once done */
+} wait_target;
+
+/**
+ * Public Functions
+ **/
+void wait_init(void);
+int wait_builtin(char **args);
+
+#endif
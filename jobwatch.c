@@ -0,0 +1,220 @@
+/**
+ * Linux Job Control Shell Project
+ * jobwatch module: jobs --watch
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * While jobs --watch runs, each job keeps /proc/<pid>/stat, statm and io
+ * open the first time it is sampled and later samples just pread() them
+ * again from offset 0. A refresh costs three syscalls per job and no memory
+ * allocation. They are closed when the watch stops, and if the shell runs
+ * out of descriptors the watch goes on opening and closing them each time.
+ **/
+#include "jobwatch.h"
+#include "jobsched.h"
+#include "shell.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+enum proc_file { PROC_STAT, PROC_STATM, PROC_IO };
+static const char *proc_names[] = {"stat", "statm", "io"};
+
+// Set when the descriptors ran out: files are opened for each read
+static int no_cache = 0;
+
+// Closes the files kept open for every job. Call with SIGCHLD blocked
+static void close_proc_fds(void) {
+  for (job *item = get_iterator(tasks); item; item = item->next) {
+    for (int i = 0; i < 3; i++) {
+      if (item->proc_fd[i] != -1)
+        close(item->proc_fd[i]);
+      item->proc_fd[i] = -1;
+    }
+  }
+}
+
+// Reads a /proc file of the job into buff, opening it the first time
+static int read_proc(job *item, enum proc_file file, char *buff, int size) {
+  char path[64];
+  ssize_t n;
+  int fd = item->proc_fd[file];
+
+  if (fd == -1) {
+    snprintf(path, sizeof(path), "/proc/%d/%s", item->pgid, proc_names[file]);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 && (errno == EMFILE || errno == ENFILE) && !no_cache) {
+      // Too many jobs to keep three files each: give them all back
+      no_cache = 1;
+      close_proc_fds();
+      fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd == -1)
+      return (-1);
+    if (!no_cache)
+      item->proc_fd[file] = fd;
+  }
+  n = pread(fd, buff, size - 1, 0);
+  if (no_cache)
+    close(fd);
+  if (n < 0)
+    return (-1);
+  buff[n] = '\0';
+  return (n);
+}
+
+// Value of a "key: value" line of /proc/<pid>/io
+static unsigned long long io_field(const char *buff, const char *key) {
+  const char *p = strstr(buff, key);
+  if (!p)
+    return (0);
+  return strtoull(p + strlen(key), NULL, 10);
+}
+
+/**
+ * Samples the job leader. Returns -1 if the process is already gone.
+ **/
+int sample_job(job *item, proc_sample_t *sample) {
+  static long clk_tck = 0;
+  static long page_kb = 0;
+  char buff[1024];
+  char *p;
+  unsigned long long ticks;
+  long long now;
+
+  if (!clk_tck) {
+    clk_tck = sysconf(_SC_CLK_TCK);
+    page_kb = sysconf(_SC_PAGESIZE) / 1024;
+  }
+
+  // stat: "pid (comm) state ppid ..." comm may hold spaces or ')'
+  if (read_proc(item, PROC_STAT, buff, sizeof(buff)) == -1)
+    return (-1);
+  p = strrchr(buff, ')');
+  if (!p || !p[1])
+    return (-1);
+  p += 2;
+  sample->state = *p++;
+  // Fields 4..13 are skipped, 14 utime, 15 stime, 20 num_threads
+  for (int field = 4; field < 14; field++)
+    strtoll(p, &p, 10);
+  ticks = strtoull(p, &p, 10);
+  ticks += strtoull(p, &p, 10);
+  for (int field = 16; field < 20; field++)
+    strtoll(p, &p, 10);
+  sample->threads = strtol(p, &p, 10);
+
+  now = monotonic_ns();
+  sample->cpu = 0;
+  if (item->sample_ns && now > item->sample_ns)
+    sample->cpu = 100.0 * (ticks - item->cpu_ticks) / clk_tck /
+                  ((now - item->sample_ns) / 1e9);
+  item->cpu_ticks = ticks;
+  item->sample_ns = now;
+
+  // statm: "size resident shared ..." in pages
+  sample->rss_kb = 0;
+  if (read_proc(item, PROC_STATM, buff, sizeof(buff)) != -1) {
+    strtol(buff, &p, 10);
+    sample->rss_kb = strtol(p, NULL, 10) * page_kb;
+  }
+
+  // io: rchar / wchar count every byte read or written, pipes included
+  sample->read_bytes = sample->write_bytes = 0;
+  if (read_proc(item, PROC_IO, buff, sizeof(buff)) != -1) {
+    sample->read_bytes = io_field(buff, "rchar: ");
+    sample->write_bytes = io_field(buff, "wchar: ");
+  }
+  return (0);
+}
+
+static void print_watch(long long interval) {
+  proc_sample_t sample;
+  int n = 1;
+
+  printf("\033[H\033[2J");
+  block_SIGCHLD();
+  printf("Every %.1fs, press any key to stop. Jobs: %d\n", interval / 1e9,
+         list_size(tasks));
+  for (job *item = get_iterator(tasks); item; item = item->next, n++) {
+    if (sample_job(item, &sample) == -1) {
+      printf(" [%d] pid: %d, command: %s, state: %s, gone\n", n, item->pgid,
+             item->command, state_strings[item->state]);
+      continue;
+    }
+    printf(" [%d] pid: %d, command: %s, state: %s (%c), cpu: %.1f%%, rss: "
+           "%ld KiB, threads: %d, read: %llu, write: %llu\n",
+           n, item->pgid, item->command, state_strings[item->state],
+           sample.state, sample.cpu, sample.rss_kb, sample.threads,
+           sample.read_bytes, sample.write_bytes);
+  }
+  unblock_SIGCHLD();
+  fflush(stdout);
+}
+
+/**
+ * jobs --watch [interval] [count]
+ * Refreshes the job list every interval (1s) until a key is pressed or count
+ * refreshes have been shown.
+ **/
+void jobs_watch(char **args) {
+  long long interval = 1000000000LL;
+  int count = -1;
+  int tty = isatty(STDIN_FILENO);
+  struct termios saved, raw;
+
+  if (args[2] && (parse_duration(args[2], &interval) == -1 || interval <= 0)) {
+    printf("Usage: jobs --watch [interval] [count]\n");
+    return;
+  }
+  if (args[2] && args[3])
+    count = atoi(args[3]);
+  // Without a terminal stdin holds the next commands, don't eat them
+  if (!tty && count < 0)
+    count = 1;
+
+  if (tty) {
+    tcgetattr(STDIN_FILENO, &saved);
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+  }
+
+  while (count != 0) {
+    long long deadline = monotonic_ns() + interval;
+    int key = 0;
+
+    print_watch(interval);
+    if (count > 0 && --count == 0)
+      break;
+    // SIGCHLD interrupts poll(), keep waiting until the deadline
+    for (long long now = monotonic_ns(); now < deadline;
+         now = monotonic_ns()) {
+      struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+      int ready = poll(&pfd, tty, (deadline - now + 999999) / 1000000);
+      if (ready > 0) {
+        char c;
+        ssize_t ignored = read(STDIN_FILENO, &c, 1);
+        (void)ignored;
+        key = 1;
+        break;
+      }
+      if (ready == -1 && errno != EINTR)
+        break;
+    }
+    if (key)
+      break;
+  }
+
+  if (tty)
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+  block_SIGCHLD();
+  close_proc_fds();
+  unblock_SIGCHLD();
+  no_cache = 0;
+}
@@ -0,0 +1,30 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for jobwatch module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _JOBWATCH_H
+#define _JOBWATCH_H
+
+#include "job_control.h"
+
+/* One sample of a job taken from /proc */
+typedef struct proc_sample_s {
+  char state;
+  double cpu; /* % of one CPU since the previous sample */
+  long rss_kb;
+  int threads;
+  unsigned long long read_bytes;
+  unsigned long long write_bytes;
+} proc_sample_t;
+
+/**
+ * Public Functions
+ **/
+int sample_job(job *item, proc_sample_t *sample);
+void jobs_watch(char **args);
+
+#endif
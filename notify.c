@@ -0,0 +1,256 @@
+/**
+ * Linux Job Control Shell Project
+ * notify module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Job state changes are detected inside signal handlers, where printf is not
+ * allowed. Handlers push fixed size records into a single producer / single
+ * consumer ring and the prompt loop renders them above the readline line.
+ * Besides the SIGCHLD and SIGALRM handlers, the main thread pushes too (jobs
+ * ended in the foreground or watched through a pidfd, dag runs). Every push
+ * holds both signals off, so only one producer writes at a time.
+ **/
+#include "notify.h"
+#include "event_loop.h"
+#include "joblimit.h"
+#include "termpol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+static notify_event_t ring[NOTIFY_RING_SIZE];
+static unsigned int ring_head = 0; /* Next slot to write (producers) */
+static unsigned int ring_tail = 0; /* Next slot to read (prompt loop) */
+
+// Set when the reaper left children unwaited because the ring was full
+static volatile sig_atomic_t reap_pending = 0;
+
+static notify_cb subscribers[NOTIFY_MAX_SUBS];
+static int n_subscribers = 0;
+
+// Ring of the last drained NOTIFY_ENDED: pid and raw wait status
+static pid_t recent_pid[NOTIFY_RECENT];
+static int recent_status[NOTIFY_RECENT];
+static unsigned int recent_next = 0;
+
+// Self-pipe used to wake up the poll() of the prompt loop
+static int wake_pipe[2] = {-1, -1};
+
+static void wake_ready(int fd, short revents, void *data) { notify_drain(); }
+
+/**
+ * Creates the wake up pipe and registers it in the event loop.
+ * Returns -1 on error.
+ **/
+int notify_init(void) {
+  if (pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+    perror("Error at pipe");
+    return -1;
+  }
+  return loop_watch_fd(wake_pipe[0], POLLIN, wake_ready, NULL);
+}
+
+/**
+ * Free slots in the ring. Safe to call from a signal handler.
+ **/
+int notify_space(void) {
+  unsigned int head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+  unsigned int tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+  return NOTIFY_RING_SIZE - (head - tail);
+}
+
+static int push_event(const notify_event_t *rec, const char *command) {
+  sigset_t producers, old;
+  int saved_errno = errno;
+  int i;
+
+  // A handler must not run in the middle of a push from the main thread
+  sigemptyset(&producers);
+  sigaddset(&producers, SIGCHLD);
+  sigaddset(&producers, SIGALRM);
+  pthread_sigmask(SIG_BLOCK, &producers, &old);
+
+  unsigned int head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+  unsigned int tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+  if (head - tail == NOTIFY_RING_SIZE) {
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return 0;
+  }
+
+  notify_event_t *ev = &ring[head & (NOTIFY_RING_SIZE - 1)];
+  *ev = *rec;
+  for (i = 0; command && command[i] && i < NOTIFY_CMD_LEN - 1; i++)
+    ev->command[i] = command[i];
+  ev->command[i] = '\0';
+  __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  // A full pipe (EAGAIN) already means a pending wake up
+  ssize_t ignored = write(wake_pipe[1], "", 1);
+  (void)ignored;
+  errno = saved_errno;
+  return 1;
+}
+
+/**
+ * Queues an event. Safe to call from a signal handler and from the main
+ * thread. Returns 0 if the ring is full: the reaper checks notify_space()
+ * first and leaves the job unreaped, other callers drain first.
+ **/
+int notify_push(enum notify_kind kind, pid_t pgid, const char *command,
+                int info) {
+  notify_event_t rec = {.kind = kind, .pgid = pgid, .info = info};
+  return push_event(&rec, command);
+}
+
+/**
+ * Same as notify_push() for NOTIFY_ENDED of a job already out of tasks,
+ * with the limits it had so a limit hit can be reported, and the stage of
+ * its alarm that ended it. A quiet event is not printed, only given to the
+ * subscribers. The job is freed by the shell once the event is drained.
+ **/
+int notify_push_ended(job *item, int status, int alarm, int quiet) {
+  notify_event_t rec = {.kind = NOTIFY_ENDED,
+                        .pgid = item->pgid,
+                        .info = status,
+                        .limits = item->limits,
+                        .alarm = alarm,
+                        .quiet = quiet,
+                        .item = item};
+  return push_event(&rec, item->command);
+}
+
+/**
+ * Registers a callback run for every event when it is drained.
+ * Returns -1 if there is no room for another subscriber.
+ **/
+int notify_subscribe(notify_cb cb) {
+  if (n_subscribers == NOTIFY_MAX_SUBS)
+    return -1;
+  subscribers[n_subscribers++] = cb;
+  return 0;
+}
+
+/**
+ * Looks up the wait status of a job that has already been reaped (call
+ * notify_drain() first). Returns 0 if the pid is not remembered.
+ **/
+int notify_recent_status(pid_t pid, int *status) {
+  for (unsigned int i = recent_next;
+       i-- > 0 && recent_next - i <= NOTIFY_RECENT;) {
+    if (recent_pid[i % NOTIFY_RECENT] == pid) {
+      *status = recent_status[i % NOTIFY_RECENT];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Called by the SIGCHLD handler when it stops reaping due to a full ring
+ **/
+void notify_overflow(void) { reap_pending = 1; }
+
+// Appends the text for an event to buff, returns the written length
+static int render_event(notify_event_t *ev, char *buff, int size) {
+  switch (ev->kind) {
+  case NOTIFY_ENDED:
+    if (ev->quiet)
+      return 0;
+    if (*limit_explain(ev->info, ev->limits) || ev->alarm) {
+      int info;
+      enum status status_res = analyze_status(ev->info, &info);
+      return snprintf(buff, size,
+                      "Background job %s ended, %s, info: %d%s%s\n",
+                      ev->command, status_strings[status_res], info,
+                      limit_explain(ev->info, ev->limits),
+                      term_explain(ev->alarm, ev->info));
+    }
+    return snprintf(buff, size, "Background job %s ended correctly\n",
+                    ev->command);
+  case NOTIFY_STOPPED:
+    return snprintf(buff, size, "Job %s, running at background stopped\n",
+                    ev->command);
+  case NOTIFY_CONTINUED:
+    return snprintf(buff, size, "Stopped job %s launched\n", ev->command);
+  case NOTIFY_RELAUNCHED:
+    return snprintf(buff, size, "Inmortal job %s relaunched, pid: %d\n",
+                    ev->command, ev->pgid);
+  case NOTIFY_ALARM:
+    return snprintf(buff, size, "Alarm expired, killing pid: %d, command: %s\n",
+                    ev->pgid, ev->command);
+  case NOTIFY_DAG_DONE:
+    return 0; // Reported by the dag module
+  }
+  return 0;
+}
+
+/**
+ * Renders every queued event, NOTIFY_BATCH at a time, above the prompt line.
+ * Must only be called from the main thread outside signal context.
+ **/
+void notify_drain(void) {
+  char buff[NOTIFY_BATCH * NOTIFY_LINE_LEN];
+  char dummy[256];
+  int printed = 0;
+
+  // Empty the wake up pipe before reading so no wake up is missed
+  while (read(wake_pipe[0], dummy, sizeof(dummy)) > 0)
+    ;
+
+  for (;;) {
+    notify_event_t batch[NOTIFY_BATCH];
+    unsigned int tail = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+    unsigned int head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    int len = 0, written;
+    int n = 0;
+
+    if (head == tail)
+      break;
+    while (tail != head && n < NOTIFY_BATCH) {
+      notify_event_t *ev = &batch[n];
+      *ev = ring[tail & (NOTIFY_RING_SIZE - 1)];
+      if (!printed)
+        loop_print_begin();
+      printed = 1;
+      if (ev->kind == NOTIFY_ENDED) {
+        recent_pid[recent_next % NOTIFY_RECENT] = ev->pgid;
+        recent_status[recent_next % NOTIFY_RECENT] = ev->info;
+        recent_next++;
+      }
+      // A line that does not fit goes after the ones before it, cut to the
+      // whole buffer at worst
+      written = render_event(ev, buff + len, sizeof(buff) - len);
+      if (written >= (int)sizeof(buff) - len) {
+        fwrite(buff, 1, len, stdout);
+        len = 0;
+        written = render_event(ev, buff, sizeof(buff));
+        if (written >= (int)sizeof(buff))
+          written = sizeof(buff) - 1;
+      }
+      len += written;
+      tail++;
+      n++;
+    }
+    fwrite(buff, 1, len, stdout);
+    // The slots are free before the subscribers run, they push events too
+    __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+    // Subscribers may print too, after the lines of their batch
+    for (int e = 0; e < n; e++) {
+      for (int i = 0; i < n_subscribers; i++)
+        subscribers[i](&batch[e]);
+    }
+  }
+
+  if (printed)
+    loop_print_end();
+
+  // Now that there is room again, reap what was left behind
+  if (reap_pending) {
+    reap_pending = 0;
+    raise(SIGCHLD);
+  }
+}
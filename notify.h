@@ -0,0 +1,61 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for notify module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _NOTIFY_H
+#define _NOTIFY_H
+
+#include "job_control.h"
+
+#define NOTIFY_RING_SIZE 4096 /* Must be a power of two */
+#define NOTIFY_BATCH 64       /* Events rendered with a single write */
+#define NOTIFY_CMD_LEN 48     /* Command name kept in each event */
+#define NOTIFY_LINE_LEN 256   /* Room for a rendered event, explanations too */
+#define NOTIFY_MAX_SUBS 8     /* Modules told about every drained event */
+#define NOTIFY_RECENT 4096    /* Ended jobs remembered after being reaped */
+
+/**
+ * Enumerations
+ **/
+enum notify_kind {
+  NOTIFY_ENDED,
+  NOTIFY_STOPPED,
+  NOTIFY_CONTINUED,
+  NOTIFY_RELAUNCHED,
+  NOTIFY_ALARM,
+  NOTIFY_DAG_DONE /* pgid holds the id of the finished run */
+};
+
+/* Fixed size record pushed from signal context */
+typedef struct notify_event_s {
+  enum notify_kind kind;
+  pid_t pgid;
+  int info;   /* Raw waitpid() status for NOTIFY_ENDED and NOTIFY_STOPPED */
+  int limits; /* Resource limits mask of the job for NOTIFY_ENDED */
+  int alarm;  /* term_forget() code of the job for NOTIFY_ENDED */
+  int quiet;  /* NOTIFY_ENDED of a job that fg already reported */
+  job *item;  /* NOTIFY_ENDED: the job, out of tasks, freed by a subscriber */
+  char command[NOTIFY_CMD_LEN];
+} notify_event_t;
+
+/* Called from the prompt loop for every drained event */
+typedef void (*notify_cb)(notify_event_t *ev);
+
+/**
+ * Public Functions
+ **/
+int notify_init(void);
+int notify_space(void);
+int notify_push(enum notify_kind kind, pid_t pgid, const char *command,
+                int info);
+int notify_push_ended(job *item, int status, int alarm, int quiet);
+void notify_overflow(void);
+int notify_subscribe(notify_cb cb);
+int notify_recent_status(pid_t pid, int *status);
+void notify_drain(void);
+
+#endif
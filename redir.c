@@ -0,0 +1,254 @@
+/**
+ * Linux Job Control Shell Project
+ * redir module: redirection planner
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * The operators of a command line (< > >> <> 2> 2>> 2>&1 &> &>>) become a
+ * plan of steps kept in command line order, so "> f 2>&1" and "2>&1 > f"
+ * differ as they do in sh. The shell opens every file of the plan with
+ * O_CLOEXEC before it forks: a bad path is reported without creating a
+ * process, and the child only has to dup2 the descriptors it inherits.
+ * FIFOs are the exception: their open waits for the other end, and the
+ * shell can't be interrupted while it waits, so the child opens them.
+ **/
+#include "redir.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Operator of the command line */
+typedef struct redir_op_ {
+  char *token;
+  int fd;
+  enum redir_kind kind;
+  int with_stderr; /* &> and &>> also send stderr there */
+} redir_op;
+
+static const redir_op ops[] = {
+    {"<", STDIN_FILENO, REDIR_IN, 0},
+    {"<>", STDIN_FILENO, REDIR_RW, 0},
+    {">", STDOUT_FILENO, REDIR_OUT, 0},
+    {">>", STDOUT_FILENO, REDIR_APPEND, 0},
+    {"2>", STDERR_FILENO, REDIR_OUT, 0},
+    {"2>>", STDERR_FILENO, REDIR_APPEND, 0},
+    {"2>&1", STDERR_FILENO, REDIR_DUP, 0},
+    {"&>", STDOUT_FILENO, REDIR_OUT, 1},
+    {"&>>", STDOUT_FILENO, REDIR_APPEND, 1},
+    {NULL, 0, 0, 0}};
+
+static const redir_op *find_op(const char *arg) {
+  for (int i = 0; ops[i].token; i++) {
+    if (!strcmp(ops[i].token, arg))
+      return &ops[i];
+  }
+  return NULL;
+}
+
+/**
+ * Is arg one of the operators handled here?
+ **/
+int redir_is_operator(const char *arg) { return find_op(arg) != NULL; }
+
+/**
+ * Appends a step to the plan, path is not copied (a REDIR_DUP step makes
+ * fd a copy of stdout). Returns -1 if the plan is full.
+ **/
+int redir_add(redir_plan *plan, int fd, enum redir_kind kind, char *path) {
+  if (plan->n == REDIR_MAX) {
+    fprintf(stderr, "too many redirections\n");
+    return (-1);
+  }
+  plan->act[plan->n].fd = fd;
+  plan->act[plan->n].kind = kind;
+  plan->act[plan->n].path = path;
+  plan->act[plan->n].src = kind == REDIR_DUP ? STDOUT_FILENO : -1;
+  plan->n++;
+  return (0);
+}
+
+/**
+ * Builds the plan of args and removes the operators and their files from
+ * it. Nothing is opened yet. Returns -1 on a syntax error.
+ **/
+int redir_parse(char **args, redir_plan *plan) {
+  int w = 0;
+
+  plan->n = 0;
+  for (int i = 0; args[i];) {
+    const redir_op *op = find_op(args[i]);
+    if (!op) {
+      args[w++] = args[i++];
+      continue;
+    }
+    if (op->kind != REDIR_DUP && !args[i + 1]) {
+      fprintf(stderr, "syntax error in redirection\n");
+      return (-1);
+    }
+    if (redir_add(plan, op->fd, op->kind,
+                  op->kind == REDIR_DUP ? NULL : args[i + 1]) == -1)
+      return (-1);
+    if (op->with_stderr &&
+        redir_add(plan, STDERR_FILENO, REDIR_DUP, NULL) == -1)
+      return (-1);
+    i += op->kind == REDIR_DUP ? 1 : 2;
+  }
+  args[w] = NULL;
+  return (0);
+}
+
+/**
+ * Does the plan change the descriptor fd of the job?
+ **/
+int redir_sets(const redir_plan *plan, int fd) {
+  for (int i = 0; i < plan->n; i++) {
+    if (plan->act[i].fd == fd)
+      return (1);
+  }
+  return (0);
+}
+
+// open() flags for the file of an action
+static int open_flags(enum redir_kind kind) {
+  if (kind == REDIR_IN)
+    return (O_RDONLY | O_CLOEXEC);
+  if (kind == REDIR_OUT)
+    return (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+  if (kind == REDIR_APPEND)
+    return (O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC);
+  return (O_RDWR | O_CREAT | O_CLOEXEC);
+}
+
+static int is_fifo(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static void open_error(const redir_action *act) {
+  fprintf(stderr, "Error opening %s file %s: %s\n",
+          act->kind == REDIR_IN ? "in" : "out", act->path, strerror(errno));
+}
+
+/**
+ * Opens the files of the plan, in order, but FIFOs (REDIR_CHILD). On error
+ * it is printed, whatever was opened is closed again and -1 is returned.
+ **/
+int redir_open(redir_plan *plan) {
+  for (int i = 0; i < plan->n; i++) {
+    redir_action *act = &plan->act[i];
+    if (act->kind == REDIR_DUP)
+      continue;
+    if (is_fifo(act->path)) {
+      act->src = REDIR_CHILD;
+      continue;
+    }
+    act->src = open(act->path, open_flags(act->kind), 0666);
+    if (act->src == -1) {
+      open_error(act);
+      redir_close(plan);
+      return (-1);
+    }
+  }
+  return (0);
+}
+
+/**
+ * Makes the redirections in the child, opening the FIFOs left to it. The
+ * opened descriptors keep O_CLOEXEC, only their copies on 0, 1 and 2 reach
+ * the new program. Returns -1 (printed) if a FIFO can't be opened.
+ **/
+int redir_apply(const redir_plan *plan) {
+  for (int i = 0; i < plan->n; i++) {
+    const redir_action *act = &plan->act[i];
+    int src = act->src;
+    if (src == REDIR_CHILD) {
+      while ((src = open(act->path, open_flags(act->kind), 0666)) == -1 &&
+             errno == EINTR)
+        ;
+      if (src == -1) {
+        open_error(act);
+        return (-1);
+      }
+    }
+    dup2(src, act->fd);
+  }
+  return (0);
+}
+
+/**
+ * Closes the descriptors the shell opened for the plan (after the fork)
+ **/
+void redir_close(redir_plan *plan) {
+  for (int i = 0; i < plan->n; i++) {
+    if (plan->act[i].kind != REDIR_DUP && plan->act[i].src >= 0) {
+      close(plan->act[i].src);
+      plan->act[i].src = -1;
+    }
+  }
+}
+
+/**
+ * Descriptor of the shell that the job would have as fd once the (opened)
+ * plan is applied, for commands run inside the shell
+ **/
+int redir_fd(const redir_plan *plan, int fd) {
+  int map[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  for (int i = 0; i < plan->n; i++) {
+    const redir_action *act = &plan->act[i];
+    map[act->fd] = act->kind == REDIR_DUP ? map[act->src] : act->src;
+  }
+  return (map[fd]);
+}
+
+/**
+ * Is what the job would have as fd a regular file? Looks at the file it is
+ * redirected from, or at the descriptor of the shell if it is not.
+ **/
+int redir_is_regular(const redir_plan *plan, int fd) {
+  const char *path[3] = {NULL, NULL, NULL};
+  int map[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  struct stat st;
+
+  for (int i = 0; i < plan->n; i++) {
+    const redir_action *act = &plan->act[i];
+    path[act->fd] = act->kind == REDIR_DUP ? path[act->src] : act->path;
+    map[act->fd] = act->kind == REDIR_DUP ? map[act->src] : -1;
+  }
+  if (path[fd])
+    return stat(path[fd], &st) == 0 && S_ISREG(st.st_mode);
+  return map[fd] != -1 && fstat(map[fd], &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/**
+ * Is a file of the plan a FIFO, which only the child may open?
+ **/
+int redir_has_fifo(const redir_plan *plan) {
+  for (int i = 0; i < plan->n; i++) {
+    if (plan->act[i].kind != REDIR_DUP && is_fifo(plan->act[i].path))
+      return (1);
+  }
+  return (0);
+}
+
+/**
+ * Copies a plan that is not open, with its own copy of the paths
+ **/
+void redir_copy(redir_plan *dst, const redir_plan *src) {
+  *dst = *src;
+  for (int i = 0; i < dst->n; i++) {
+    if (dst->act[i].path)
+      dst->act[i].path = strdup(dst->act[i].path);
+  }
+}
+
+/**
+ * Frees the paths of a plan made by redir_copy
+ **/
+void redir_free(redir_plan *plan) {
+  for (int i = 0; i < plan->n; i++)
+    free(plan->act[i].path);
+  plan->n = 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for redir module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _REDIR_H
+#define _REDIR_H
+
+#include "job_control.h"
+
+#define REDIR_MAX 16 /* Redirections of a command line */
+#define REDIR_CHILD -2 /* src of a FIFO left for the child to open */
+
+/**
+ * Enumerations
+ **/
+enum redir_kind { REDIR_IN, REDIR_OUT, REDIR_APPEND, REDIR_RW, REDIR_DUP };
+
+/* One step of a plan: descriptor fd of the job becomes src */
+typedef struct redir_action_ {
+  int fd;
+  enum redir_kind kind;
+  char *path; /* File to open (not REDIR_DUP) */
+  int src;    /* Opened descriptor, or the one copied by REDIR_DUP */
+} redir_action;
+
+/* Redirections of a command, applied in command line order */
+typedef struct redir_plan_ {
+  int n;
+  redir_action act[REDIR_MAX];
+} redir_plan;
+
+/**
+ * Public Functions
+ **/
+int redir_is_operator(const char *arg);
+int redir_parse(char **args, redir_plan *plan);
+int redir_add(redir_plan *plan, int fd, enum redir_kind kind, char *path);
+int redir_sets(const redir_plan *plan, int fd);
+int redir_open(redir_plan *plan);
+int redir_apply(const redir_plan *plan);
+void redir_close(redir_plan *plan);
+int redir_fd(const redir_plan *plan, int fd);
+int redir_is_regular(const redir_plan *plan, int fd);
+int redir_has_fifo(const redir_plan *plan);
+void redir_copy(redir_plan *dst, const redir_plan *src);
+void redir_free(redir_plan *plan);
+
+#endif
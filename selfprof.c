@@ -0,0 +1,317 @@
+/**
+ * Linux Job Control Shell Project
+ * selfprof module: sampling profiler of the shell itself (--profile)
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * A POSIX timer on the CPU clock of the main thread sends it SIGPROF
+ * SELFPROF_HZ times per second of CPU that it uses, so an idle shell takes
+ * no samples. The handler walks the frame pointer chain from the
+ * interrupted registers into a ring preallocated at start. It only reads
+ * memory inside the main thread's stack and makes no calls, so it is safe
+ * wherever the signal lands, even inside the SIGCHLD handler. Libraries
+ * built without frame pointers cut a stack short but never break it.
+ *
+ * Addresses are turned into names only when the samples are dumped: the
+ * shell's own functions, static ones included, from the .symtab of
+ * /proc/self/exe, and library ones with dladdr(). Identical stacks are
+ * counted together and written as folded stacks (root;...;leaf count),
+ * the input of flamegraph.pl.
+ **/
+#include "selfprof.h"
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+
+static uintptr_t *frames = NULL; /* SELFPROF_DEPTH per sample */
+static unsigned char *depths = NULL;
+static volatile unsigned long n_samples = 0; /* Taken, ring position */
+static uintptr_t stack_lo, stack_hi;         /* Of the main thread */
+static timer_t timer;
+static char *out_path = NULL;
+
+static selfprof_sym *syms = NULL;
+static int n_syms = 0;
+static uintptr_t exe_base, exe_end; /* Where the shell binary is loaded */
+
+// SIGPROF: the interrupted pc and the return addresses of its callers
+static void sample(int sig, siginfo_t *info, void *ctx) {
+  ucontext_t *uc = (ucontext_t *)ctx;
+  unsigned long pos = n_samples % SELFPROF_SAMPLES;
+  uintptr_t *out = &frames[pos * SELFPROF_DEPTH];
+  uintptr_t fp;
+  int n = 0;
+
+#if defined(__x86_64__)
+  out[n++] = uc->uc_mcontext.gregs[REG_RIP];
+  fp = uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+  out[n++] = uc->uc_mcontext.pc;
+  fp = uc->uc_mcontext.regs[29];
+#else
+  return;
+#endif
+  // Each frame starts with the caller's frame pointer and return address
+  while (n < SELFPROF_DEPTH && fp >= stack_lo &&
+         fp + 2 * sizeof(uintptr_t) <= stack_hi &&
+         fp % sizeof(uintptr_t) == 0) {
+    uintptr_t next = ((uintptr_t *)fp)[0];
+    uintptr_t ret = ((uintptr_t *)fp)[1];
+    if (!ret)
+      break;
+    out[n++] = ret;
+    if (next <= fp)
+      break;
+    fp = next;
+  }
+  depths[pos] = n;
+  n_samples++;
+}
+
+static int cmp_syms(const void *a, const void *b) {
+  const selfprof_sym *x = (const selfprof_sym *)a;
+  const selfprof_sym *y = (const selfprof_sym *)b;
+  return ((x->addr > y->addr) - (x->addr < y->addr));
+}
+
+// The first object is the shell binary: its load address and extent
+static int find_exe(struct dl_phdr_info *info, size_t size, void *data) {
+  exe_base = info->dlpi_addr;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+    uintptr_t end = exe_base + ph->p_vaddr + ph->p_memsz;
+    if (ph->p_type == PT_LOAD && end > exe_end)
+      exe_end = end;
+  }
+  return (1);
+}
+
+// Function symbols of .symtab (or .dynsym if stripped), kept mapped
+static void load_symbols(void) {
+  const ElfW(Shdr) *sh, *tab = NULL;
+  const ElfW(Ehdr) *eh;
+  struct stat st;
+  char *map;
+  int fd;
+
+  dl_iterate_phdr(find_exe, NULL);
+  fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+  if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(ElfW(Ehdr))) {
+    close(fd);
+    return;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return;
+  eh = (const ElfW(Ehdr) *)map;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+      eh->e_shoff + eh->e_shnum * sizeof(ElfW(Shdr)) > (size_t)st.st_size)
+    return;
+  sh = (const ElfW(Shdr) *)(map + eh->e_shoff);
+  for (int i = 0; i < eh->e_shnum; i++) {
+    if (sh[i].sh_type == SHT_SYMTAB ||
+        (sh[i].sh_type == SHT_DYNSYM && !tab))
+      tab = &sh[i];
+  }
+  if (!tab)
+    return;
+
+  const ElfW(Sym) *sym = (const ElfW(Sym) *)(map + tab->sh_offset);
+  const char *strtab = map + sh[tab->sh_link].sh_offset;
+  int n = tab->sh_size / sizeof(ElfW(Sym));
+  syms = (selfprof_sym *)malloc(n * sizeof(selfprof_sym));
+  if (!syms)
+    return;
+  for (int i = 0; i < n; i++) {
+    if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || !sym[i].st_value)
+      continue;
+    syms[n_syms].addr = sym[i].st_value;
+    syms[n_syms].size = sym[i].st_size;
+    syms[n_syms].name = strtab + sym[i].st_name;
+    n_syms++;
+  }
+  qsort(syms, n_syms, sizeof(selfprof_sym), cmp_syms);
+}
+
+// Name of the function holding addr: buff is used for unknown ones
+static const char *symbolize(uintptr_t addr, char *buff, size_t size) {
+  Dl_info dl;
+
+  if (addr >= exe_base && addr < exe_end) {
+    unsigned long off = addr - exe_base;
+    int lo = 0, hi = n_syms - 1;
+    while (lo <= hi) {
+      int mid = (lo + hi) / 2;
+      if (syms[mid].addr > off)
+        hi = mid - 1;
+      else if (off >= syms[mid].addr + (syms[mid].size ? syms[mid].size : 1))
+        lo = mid + 1;
+      else
+        return (syms[mid].name);
+    }
+  }
+  // dl is only filled in when dladdr succeeds
+  if (!dladdr((void *)addr, &dl))
+    return ("[unknown]");
+  if (dl.dli_sname)
+    return (dl.dli_sname);
+  if (dl.dli_fname) {
+    const char *lib = strrchr(dl.dli_fname, '/');
+    snprintf(buff, size, "[%s]", lib ? lib + 1 : dl.dli_fname);
+    return (buff);
+  }
+  return ("[unknown]");
+}
+
+static int cmp_lines(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void dump_at_exit(void) { selfprof_dump(out_path); }
+
+/**
+ * --profile file: starts sampling the main thread, the samples go to file
+ * on exit and with profdump. Returns -1 on error.
+ **/
+int selfprof_start(const char *path) {
+  struct sigaction sa;
+  struct sigevent sev;
+  struct itimerspec its;
+  pthread_attr_t attr;
+  void *stack;
+  size_t stack_size;
+
+  out_path = strdup(path);
+  frames = mmap(NULL, SELFPROF_SAMPLES * SELFPROF_DEPTH * sizeof(uintptr_t),
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  depths = mmap(NULL, SELFPROF_SAMPLES, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (!out_path || frames == MAP_FAILED || depths == MAP_FAILED) {
+    perror("Error at mmap");
+    return (-1);
+  }
+  if (pthread_getattr_np(pthread_self(), &attr) ||
+      pthread_attr_getstack(&attr, &stack, &stack_size)) {
+    fprintf(stderr, "Error getting the stack of the shell\n");
+    return (-1);
+  }
+  pthread_attr_destroy(&attr);
+  stack_lo = (uintptr_t)stack;
+  stack_hi = stack_lo + stack_size;
+  load_symbols();
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = sample;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+  // Only the CPU of the main thread, and only it is interrupted
+  memset(&sev, 0, sizeof(sev));
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev._sigev_un._tid = syscall(SYS_gettid);
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer) == -1) {
+    perror("Error at timer_create");
+    return (-1);
+  }
+  its.it_value.tv_sec = its.it_interval.tv_sec = 0;
+  its.it_value.tv_nsec = its.it_interval.tv_nsec = 1000000000L / SELFPROF_HZ;
+  if (timer_settime(timer, 0, &its, NULL) == -1) {
+    perror("Error at timer_settime");
+    return (-1);
+  }
+  atexit(dump_at_exit);
+  return (0);
+}
+
+/**
+ * Writes the samples in the ring as folded stacks. Returns how many there
+ * were, -1 on error.
+ **/
+int selfprof_dump(const char *path) {
+  char line[SELFPROF_LINE], unknown[256];
+  unsigned long total, first;
+  sigset_t block, old;
+  char **lines;
+  int n, m = 0;
+  FILE *fp;
+
+  // The handler runs on this thread, held off it doesn't write the ring
+  sigemptyset(&block);
+  sigaddset(&block, SIGPROF);
+  sigprocmask(SIG_BLOCK, &block, &old);
+  total = n_samples;
+  n = total < SELFPROF_SAMPLES ? total : SELFPROF_SAMPLES;
+  first = total - n;
+  lines = (char **)calloc(n ? n : 1, sizeof(char *));
+  for (int k = 0; lines && k < n; k++) {
+    unsigned long pos = (first + k) % SELFPROF_SAMPLES;
+    uintptr_t *stack = &frames[pos * SELFPROF_DEPTH];
+    size_t len = 0;
+    line[0] = '\0';
+    // Root first. A return address points past its call, -1 is inside it
+    for (int j = depths[pos] - 1; j >= 0 && len < sizeof(line) - 1; j--) {
+      const char *name =
+          symbolize(stack[j] - (j ? 1 : 0), unknown, sizeof(unknown));
+      len += snprintf(line + len, sizeof(line) - len, "%s%s", name,
+                      j ? ";" : "");
+    }
+    if ((lines[m] = strdup(line)))
+      m++;
+  }
+  sigprocmask(SIG_SETMASK, &old, NULL);
+  if (!lines) {
+    perror("Error at calloc");
+    return (-1);
+  }
+
+  fp = fopen(path, "w");
+  if (!fp)
+    perror("Error opening the profile");
+  qsort(lines, m, sizeof(char *), cmp_lines);
+  for (int k = 0; k < m;) {
+    int same = 1;
+    while (k + same < m && !strcmp(lines[k], lines[k + same]))
+      same++;
+    if (fp)
+      fprintf(fp, "%s %d\n", lines[k], same);
+    for (int i = 0; i < same; i++)
+      free(lines[k + i]);
+    k += same;
+  }
+  free(lines);
+  if (!fp)
+    return (-1);
+  fclose(fp);
+  return (m);
+}
+
+/**
+ * profdump [file]: writes the samples taken so far (to the --profile file
+ * without an argument)
+ **/
+void selfprof_builtin(char **args) {
+  const char *path = args[1] ? args[1] : out_path;
+  int n;
+
+  if (!frames) {
+    printf("profdump: the shell was not started with --profile\n");
+    return;
+  }
+  n = selfprof_dump(path);
+  if (n != -1)
+    printf("%d samples (%lu taken) written to %s\n", n, n_samples, path);
+}
@@ -0,0 +1,33 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for selfprof module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _SELFPROF_H
+#define _SELFPROF_H
+
+#include "job_control.h"
+
+#define SELFPROF_HZ 997        /* Samples per second of shell CPU time */
+#define SELFPROF_SAMPLES 16384 /* Ring of the most recent samples */
+#define SELFPROF_DEPTH 48      /* Frames kept per sample */
+#define SELFPROF_LINE 4096     /* A folded stack */
+
+/* Function symbol of the shell binary */
+typedef struct selfprof_sym_ {
+  unsigned long addr; /* Offset from the load address */
+  unsigned long size;
+  const char *name;
+} selfprof_sym;
+
+/**
+ * Public Functions
+ **/
+int selfprof_start(const char *path);
+int selfprof_dump(const char *path);
+void selfprof_builtin(char **args);
+
+#endif
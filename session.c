@@ -0,0 +1,398 @@
+/**
+ * Linux Job Control Shell Project
+ * session module: --record / --replay of interactive sessions
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * A recording is a text file with one record per line, fields split by tabs:
+ *   L <ns since the previous line> <input line>
+ *   T <ns until the prompt was back>     (for the last L)
+ *   F <raw status of its foreground job> (for the last L)
+ *   E <notify kind> <info> <command>     (job event after the last L)
+ *   X <ns from the last line to the end of the session>
+ * A replay feeds the lines back, with the same inter-arrival times divided
+ * by the speed, through the prompt loop in place of readline. At the end it
+ * compares the foreground results line by line and the job events as a
+ * multiset (pids are different on every run), and prints the time each
+ * line took grouped by its command.
+ **/
+#include "session.h"
+#include "event_loop.h"
+#include "jobsched.h"
+#include "notify.h"
+#include "shell.h"
+
+#include <errno.h>
+
+static char *kind_strings[] = {"Ended", "Stopped",  "Continued",
+                               "Relaunched", "Alarm", "Dag done"};
+
+static FILE *rec_file = NULL;
+static pid_t rec_owner = 0; /* Shell process, atexit also runs in children */
+static int replaying = 0;
+static int subscribed = 0;
+static double replay_speed = 1.0;
+static char *replay_path = NULL;
+
+static session_log recorded; /* Loaded from the replay file */
+static session_log current;  /* This run */
+static int next_line = 0;
+static int line_open = 0; /* Last line read still running */
+static long long last_read_ns = 0;
+
+static void replay_report(void);
+
+static void *grow(void *array, int *cap, int n, size_t size) {
+  if (n < *cap)
+    return array;
+  *cap = *cap ? *cap * 2 : 64;
+  array = realloc(array, *cap * size);
+  if (!array) {
+    perror("Error at realloc");
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+static session_line *add_line(session_log *log, const char *text,
+                              long long delta_ns) {
+  session_line *line;
+  log->lines =
+      grow(log->lines, &log->cap_lines, log->n_lines, sizeof(session_line));
+  line = &log->lines[log->n_lines++];
+  line->text = strdup(text);
+  line->delta_ns = delta_ns;
+  line->took_ns = -1;
+  line->fg_status = -1;
+  return line;
+}
+
+static void add_event(session_log *log, int kind, int info,
+                      const char *command) {
+  session_event *ev;
+  log->events = grow(log->events, &log->cap_events, log->n_events,
+                     sizeof(session_event));
+  ev = &log->events[log->n_events++];
+  ev->line = log->n_lines - 1;
+  ev->kind = kind;
+  ev->info = info;
+  snprintf(ev->command, sizeof(ev->command), "%s", command);
+}
+
+static void session_event_cb(notify_event_t *ev) {
+  // Only the end of a dag run carries an id instead of a pid
+  int info = ev->kind == NOTIFY_DAG_DONE ? 0 : ev->info;
+  add_event(&current, ev->kind, info, ev->command);
+  if (rec_file)
+    fprintf(rec_file, "E\t%d\t%d\t%s\n", ev->kind, info, ev->command);
+}
+
+static void subscribe(void) {
+  if (!subscribed)
+    notify_subscribe(session_event_cb);
+  subscribed = 1;
+}
+
+static void record_atexit(void) {
+  // Children that fail to exec also run atexit handlers
+  if (!rec_file || getpid() != rec_owner)
+    return;
+  session_prompt();
+  fprintf(rec_file, "X\t%lld\n", monotonic_ns() - last_read_ns);
+  fclose(rec_file);
+  rec_file = NULL;
+}
+
+/**
+ * Starts recording the session into path. Returns -1 on error.
+ **/
+int session_record(const char *path) {
+  rec_file = fopen(path, "w");
+  if (!rec_file) {
+    perror("Error opening record file");
+    return (-1);
+  }
+  // A crash keeps everything up to the last whole record
+  setvbuf(rec_file, NULL, _IOLBF, 0);
+  fprintf(rec_file, "# shell session record v1\n");
+  rec_owner = getpid();
+  last_read_ns = monotonic_ns();
+  atexit(record_atexit);
+  subscribe();
+  return (0);
+}
+
+/**
+ * Loads a recording to be fed back as input. Returns -1 on error.
+ **/
+int session_replay(const char *path, double speed) {
+  FILE *fp = fopen(path, "r");
+  char *buff = NULL;
+  size_t size = 0;
+  ssize_t len;
+  session_line *line = NULL;
+
+  if (!fp) {
+    perror("Error opening replay file");
+    return (-1);
+  }
+  while ((len = getline(&buff, &size, fp)) != -1) {
+    char *fields[4] = {buff, NULL, NULL, NULL};
+    int n = 1;
+    if (len && buff[len - 1] == '\n')
+      buff[len - 1] = '\0';
+    // The input line is the last field and may hold tabs itself
+    int max = buff[0] == 'E' ? 4 : 3;
+    for (char *p = buff; n < max && (p = strchr(p, '\t')); n++) {
+      *p++ = '\0';
+      fields[n] = p;
+    }
+    if (buff[0] == 'L' && n == 3)
+      line = add_line(&recorded, fields[2], atoll(fields[1]));
+    else if (buff[0] == 'T' && line && n >= 2)
+      line->took_ns = atoll(fields[1]);
+    else if (buff[0] == 'F' && line && n >= 2)
+      line->fg_status = atoi(fields[1]);
+    else if (buff[0] == 'E' && n == 4)
+      add_event(&recorded, atoi(fields[1]), atoi(fields[2]), fields[3]);
+    else if (buff[0] == 'X' && n >= 2)
+      recorded.tail_ns = atoll(fields[1]);
+  }
+  free(buff);
+  fclose(fp);
+
+  replaying = 1;
+  replay_speed = speed > 0 ? speed : 1.0;
+  replay_path = strdup(path);
+  last_read_ns = monotonic_ns();
+  rec_owner = getpid();
+  atexit(replay_report);
+  subscribe();
+  return (0);
+}
+
+/**
+ * Returns 1 while input comes from a replay file instead of readline
+ **/
+int session_replaying(void) { return replaying; }
+
+/**
+ * Takes note of a line read by the prompt loop (NULL at the end of input)
+ **/
+void session_line_read(const char *line) {
+  long long now = monotonic_ns();
+  if ((!rec_file && !replaying) || !line)
+    return;
+  add_line(&current, line, now - last_read_ns);
+  if (rec_file)
+    fprintf(rec_file, "L\t%lld\t%s\n", now - last_read_ns, line);
+  last_read_ns = now;
+  line_open = 1;
+}
+
+/**
+ * The prompt loop is back: the last line read has been processed
+ **/
+void session_prompt(void) {
+  long long took;
+  if (!line_open)
+    return;
+  line_open = 0;
+  took = monotonic_ns() - last_read_ns;
+  current.lines[current.n_lines - 1].took_ns = took;
+  if (rec_file)
+    fprintf(rec_file, "T\t%lld\n", took);
+}
+
+/**
+ * Result of the foreground job of the last line read (raw wait status)
+ **/
+void session_foreground(int status) {
+  if (!line_open)
+    return;
+  current.lines[current.n_lines - 1].fg_status = status;
+  if (rec_file)
+    fprintf(rec_file, "F\t%d\n", status);
+}
+
+static const char *describe(int status, char *buff, int size) {
+  int info;
+  enum status status_res;
+  if (status == -1)
+    return "no foreground job";
+  status_res = analyze_status(status, &info);
+  snprintf(buff, size, "%s %d", status_strings[status_res], info);
+  return buff;
+}
+
+static int cmp_event(const void *a, const void *b) {
+  const session_event *ea = a, *eb = b;
+  if (ea->kind != eb->kind)
+    return ea->kind - eb->kind;
+  if (ea->info != eb->info)
+    return ea->info - eb->info;
+  return strcmp(ea->command, eb->command);
+}
+
+static int cmp_ll(const void *a, const void *b) {
+  long long la = *(const long long *)a, lb = *(const long long *)b;
+  return (la > lb) - (la < lb);
+}
+
+static void print_event(const char *what, session_event *ev) {
+  char buff[64];
+  int raw = ev->kind == NOTIFY_ENDED || ev->kind == NOTIFY_STOPPED;
+  printf("  %s event after line %d: %s %s%s%s\n", what, ev->line + 1,
+         kind_strings[ev->kind], ev->command, raw ? ", " : "",
+         raw ? describe(ev->info, buff, sizeof(buff)) : "");
+}
+
+// Events of one run that have no match in the other one
+static int diff_events(void) {
+  session_event *rec = recorded.events, *cur = current.events;
+  int r = 0, c = 0, diverged = 0;
+
+  qsort(rec, recorded.n_events, sizeof(session_event), cmp_event);
+  qsort(cur, current.n_events, sizeof(session_event), cmp_event);
+  while (r < recorded.n_events || c < current.n_events) {
+    int cmp = r == recorded.n_events  ? 1
+              : c == current.n_events ? -1
+                                      : cmp_event(&rec[r], &cur[c]);
+    if (cmp == 0) {
+      r++, c++;
+      continue;
+    }
+    if (diverged++ < 10)
+      print_event(cmp < 0 ? "missing" : "extra", cmp < 0 ? &rec[r] : &cur[c]);
+    if (cmp < 0)
+      r++;
+    else
+      c++;
+  }
+  return (diverged);
+}
+
+// Group (first word) of a line for the latency table
+static int group_of(const char *text, char groups[][32], int *n_groups) {
+  char word[32] = "";
+  sscanf(text, "%31s", word);
+  for (int g = 0; g < *n_groups; g++) {
+    if (!strcmp(groups[g], word))
+      return (g);
+  }
+  if (*n_groups == SESSION_GROUPS)
+    return (SESSION_GROUPS - 1);
+  strcpy(groups[*n_groups], *n_groups == SESSION_GROUPS - 1 ? "(other)" : word);
+  return (*n_groups)++;
+}
+
+static void print_latencies(void) {
+  static char groups[SESSION_GROUPS][32];
+  int n_groups = 0;
+  int n = current.n_lines;
+  int *group = (int *)malloc((n + 1) * sizeof(int));
+  long long *values = (long long *)malloc((n + 1) * sizeof(long long));
+
+  if (!group || !values) {
+    perror("Error at malloc");
+    free(group);
+    free(values);
+    return;
+  }
+  for (int i = 0; i < n; i++)
+    group[i] = group_of(current.lines[i].text, groups, &n_groups);
+  printf("  %-12s %6s %10s %10s %10s %10s %10s\n", "command", "lines",
+         "rec avg", "avg", "p50", "p99", "max");
+  for (int g = 0; g < n_groups; g++) {
+    long long rec_total = 0;
+    int k = 0, rec_n = 0;
+    for (int i = 0; i < n; i++) {
+      if (group[i] != g || current.lines[i].took_ns < 0)
+        continue;
+      values[k++] = current.lines[i].took_ns;
+      if (i < recorded.n_lines && recorded.lines[i].took_ns >= 0) {
+        rec_total += recorded.lines[i].took_ns;
+        rec_n++;
+      }
+    }
+    if (!k)
+      continue;
+    qsort(values, k, sizeof(long long), cmp_ll);
+    long long total = 0;
+    for (int i = 0; i < k; i++)
+      total += values[i];
+    printf("  %-12s %6d %8.2fms %8.2fms %8.2fms %8.2fms %8.2fms\n", groups[g],
+           k, rec_n ? rec_total / 1e6 / rec_n : 0.0, total / 1e6 / k,
+           values[k / 2] / 1e6, values[(k * 99) / 100] / 1e6,
+           values[k - 1] / 1e6);
+  }
+  free(group);
+  free(values);
+}
+
+static void replay_report(void) {
+  char rec_buff[64], cur_buff[64];
+  int fg_diverged = 0, ev_diverged;
+
+  // Once, either at the end of the lines or when one of them is exit
+  if (!replaying || getpid() != rec_owner)
+    return;
+  replaying = 0;
+  session_prompt();
+
+  printf("Replay of %s at %.2fx: %d lines\n", replay_path, replay_speed,
+         current.n_lines);
+  for (int i = 0; i < current.n_lines && i < recorded.n_lines; i++) {
+    int rec = recorded.lines[i].fg_status, cur = current.lines[i].fg_status;
+    if (rec == cur)
+      continue;
+    if (fg_diverged++ < 10)
+      printf("  line %d (%s): recorded %s, replayed %s\n", i + 1,
+             current.lines[i].text, describe(rec, rec_buff, sizeof(rec_buff)),
+             describe(cur, cur_buff, sizeof(cur_buff)));
+  }
+  ev_diverged = diff_events();
+  printf("Divergences: %d foreground results, %d job events (%d recorded, "
+         "%d replayed)\n",
+         fg_diverged, ev_diverged, recorded.n_events, current.n_events);
+  print_latencies();
+}
+
+/**
+ * Next line of the replay, given once its inter-arrival time has passed
+ * (the loop is served meanwhile). At the end it lets the remaining jobs
+ * finish, prints the report and returns NULL like readline on ^D.
+ **/
+char *session_next_line(void) {
+  long long due, deadline;
+
+  if (next_line < recorded.n_lines) {
+    session_line *line = &recorded.lines[next_line++];
+    due = last_read_ns + (long long)(line->delta_ns / replay_speed);
+    for (long long left; (left = due - monotonic_ns()) > 0;)
+      loop_poll_once((left + 999999) / 1000000);
+    printf("COMMAND->%s\n", line->text);
+    return strdup(line->text);
+  }
+
+  // Same time as the original session had after its last line, and then
+  // up to SESSION_SETTLE_MS more for jobs that are still running
+  due = last_read_ns + (long long)(recorded.tail_ns / replay_speed);
+  deadline = due + SESSION_SETTLE_MS * 1000000LL;
+  for (;;) {
+    long long now = monotonic_ns();
+    int busy;
+    block_SIGCHLD();
+    busy = get_iterator(tasks) != NULL;
+    unblock_SIGCHLD();
+    // Jobs leave tasks when their event is queued, drain it after the check
+    notify_drain();
+    if (now >= deadline || (now >= due && !busy))
+      break;
+    loop_poll_once(now < due ? (due - now + 999999) / 1000000 : 100);
+  }
+  replay_report();
+  return NULL;
+}
@@ -0,0 +1,55 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for session module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include "job_control.h"
+
+#define SESSION_SETTLE_MS 10000 /* Longest wait for jobs after the last line */
+#define SESSION_GROUPS 64       /* Commands reported apart in the latencies */
+
+/* Input line of a recorded or replayed session */
+typedef struct session_line_ {
+  char *text;
+  long long delta_ns; /* Since the previous line was read */
+  long long took_ns;  /* Until the prompt was back, -1 if unknown */
+  int fg_status;      /* Raw status of its foreground job, -1 if none */
+} session_line;
+
+/* Job event, compared by command, kind and status (pids change) */
+typedef struct session_event_ {
+  int line; /* Index of the last line read when it happened */
+  int kind; /* enum notify_kind */
+  char command[48];
+  int info;
+} session_event;
+
+/* Lines and events of one run */
+typedef struct session_log_ {
+  session_line *lines;
+  int n_lines;
+  int cap_lines;
+  session_event *events;
+  int n_events;
+  int cap_events;
+  long long tail_ns; /* From the last line to the end of the session */
+} session_log;
+
+/**
+ * Public Functions
+ **/
+int session_record(const char *path);
+int session_replay(const char *path, double speed);
+int session_replaying(void);
+char *session_next_line(void);
+void session_line_read(const char *line);
+void session_prompt(void);
+void session_foreground(int status);
+
+#endif
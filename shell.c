@@ -16,10 +16,41 @@
  **/
 
 #include "job_control.h" /* Remember to compile with module job_control.c */
-
-#define MAX_LINE 256 /* 256 chars per line, per command, should be enough */
+#include "admit.h"
+#include "ckpt.h"
+#include "cmdlist.h"
+#include "complete.h"
+#include "coproc.h"
+#include "ctlsock.h"
+#include "dag.h"
+#include "env.h"
+#include "event_loop.h"
+#include "fanout.h"
+#include "fastcmd.h"
+#include "notify.h"
+#include "joblimit.h"
+#include "jobprof.h"
+#include "jobspec.h"
+#include "jobsched.h"
+#include "jobwait.h"
+#include "jobwatch.h"
+#include "selfprof.h"
+#include "session.h"
+#include "shell.h"
+#include "termpol.h"
+#include "trace.h"
+#include "zredir.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#ifdef SOAK
+// From the sanitizer runtime (sanitizer/allocator_interface.h)
+size_t __sanitizer_get_current_allocated_bytes(void);
+#endif
 
 job *tasks;
+pid_t foreground_pid;
 
 // Variables globales para alarm signal pues solo puede haber un comando en
 // foreground a la vez
@@ -52,8 +83,80 @@ void free_pp_char(char **args) {
   free(args);
 }
 
+// Fork + exec a command straight into the job list as a background job,
+// with optional redirections (opened here, before the fork), limits (the
+// defaults are added) and environment. Also used from the notify drain
+// with SIGCHLD blocked, so the signal mask is restored rather than
+// unblocked. Returns the pid of the new job or -1 if it could not start
+pid_t launch_job(char **args, int inmortal, redir_plan *redir,
+                 const job_limits *lim, char **envp) {
+  pid_t pid_fork;
+  job *new_task;
+  sigset_t block_sigchld, old_mask;
+  job_limits limits = {0};
+
+  if (lim)
+    limits = *lim;
+  limit_add_defaults(&limits);
+  if (redir && redir_open(redir) == -1)
+    return (-1);
+
+  // Blocked before fork so the reaper can't miss a child that ends at once
+  sigemptyset(&block_sigchld);
+  sigaddset(&block_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &block_sigchld, &old_mask);
+  pid_fork = fork();
+  if (pid_fork == -1) {
+    perror("Error at fork");
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    if (redir)
+      redir_close(redir);
+    return (-1);
+  } else if (pid_fork == 0) {
+    new_process_group(getpid());
+    restore_terminal_signals();
+    // A FIFO is opened here and may wait for its peer: killable by now
+    if (redir && redir_apply(redir) == -1)
+      exit(EXIT_FAILURE);
+    // The mask survives exec, jobs must not inherit the handler's one
+    sigemptyset(&old_mask);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    limit_apply(&limits);
+    trace_event(TRACE_EXEC, getpid(), args[0], 0);
+    if (envp)
+      environ = envp;
+    execvp(args[0], args);
+    perror("Error executing command");
+    exit(EXIT_FAILURE);
+  }
+  if (redir)
+    redir_close(redir);
+  new_process_group(pid_fork);
+  trace_event(TRACE_FORK, pid_fork, args[0], 0);
+  new_task = new_job(pid_fork, args[0], BACKGROUND);
+  new_task->inmortal = inmortal;
+  new_task->limits = limits.mask;
+  new_task->comm_args = cpy_args(args);
+  new_task->threadWait = NULL;
+  new_task->isProcWait = 0;
+  new_task->pid_wait = -1;
+  new_task->isAlarmSig = 0;
+  new_task->timeAlarmSig = 0;
+  new_task->initTime = 0;
+  add_job(tasks, new_task);
+  ckpt_sync(new_task);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  return (pid_fork);
+}
+
+pid_t launch_background(char **args) {
+  return launch_job(args, 0, NULL, NULL, NULL);
+}
+
 // If the job is inmortal we will relauunch it in background mode
 void relaunch(job *rela_job) {
+  job_limits limits = {0};
+  limit_add_defaults(&limits);
   pid_t pid_fork = fork();
   job *new_task;
 
@@ -63,13 +166,22 @@ void relaunch(job *rela_job) {
   } else if (pid_fork == 0) {
     new_process_group(getpid());
     restore_terminal_signals();
+    // Forked with SIGCHLD blocked: don't exec with that signal mask
+    unblock_SIGCHLD();
+    block_signal(SIGALRM, 0);
+    limit_apply(&limits);
+    trace_event(TRACE_EXEC, getpid(), rela_job->comm_args[0], 0);
     execvp(rela_job->comm_args[0], rela_job->comm_args);
     perror("Error executing job");
     exit(EXIT_FAILURE);
   } else {
     new_process_group(pid_fork);
+    trace_event(TRACE_FORK, pid_fork, rela_job->comm_args[0], 0);
+    trace_event(TRACE_RELAUNCH, pid_fork, rela_job->comm_args[0],
+                rela_job->pgid);
     new_task = new_job(pid_fork, rela_job->comm_args[0], BACKGROUND);
     new_task->inmortal = 1;
+    new_task->limits = limits.mask;
     new_task->comm_args = cpy_args(rela_job->comm_args);
     new_task->threadWait = NULL;
     new_task->isProcWait = 0;
@@ -78,7 +190,134 @@ void relaunch(job *rela_job) {
     new_task->timeAlarmSig = 0;
     new_task->initTime = 0;
     add_job(tasks, new_task);
+    ckpt_sync(new_task);
+    notify_push(NOTIFY_RELAUNCHED, pid_fork, rela_job->comm_args[0], 0);
+  }
+}
+
+// Drops a reference to an alarm-thread alarm, the last one frees it.
+// Lock-free, the alarm-thread and the prompt loop race for the last one
+void alarm_thread_put(waitThread_t *alarm) {
+  if (__atomic_sub_fetch(&alarm->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    close(alarm->wake_fd);
+    free(alarm);
+  }
+}
+
+// The job ended first: wakes the thread up without killing anything.
+// Unlike pthread_cancel it is safe on a thread that has already finished,
+// and in the SIGCHLD handler. The reference of the job is still held
+void alarm_thread_stop(waitThread_t *alarm) {
+  uint64_t one = 1;
+  ssize_t ignored = write(alarm->wake_fd, &one, sizeof(one));
+  (void)ignored;
+}
+
+// alarm_thread_stop() and drops the reference of the job
+void alarm_thread_cancel(waitThread_t *alarm) {
+  alarm_thread_stop(alarm);
+  alarm_thread_put(alarm);
+}
+
+// Function that will exec our alarm-thread
+void *thread_job(void *arg) {
+  waitThread_t *argThreadJ = (waitThread_t *)arg;
+  struct pollfd pfd = {argThreadJ->wake_fd, POLLIN, 0};
+  int ret;
+
+  // Sleeps for the alarm time unless the job cancels it first
+  while ((ret = poll(&pfd, 1, argThreadJ->wait * 1000)) == -1 &&
+         errno == EINTR)
+    ;
+  // The stages stop once the job is reaped and cancels it
+  if (ret == 0)
+    term_run(argThreadJ->pid, argThreadJ->wake_fd);
+
+  alarm_thread_put(argThreadJ);
+  return NULL;
+}
+
+// Starts the alarm-thread of pid. The reference returned belongs to the job.
+// Returns NULL on error
+waitThread_t *alarm_thread_start(pid_t pid, int wait) {
+  waitThread_t *alarm = (waitThread_t *)malloc(sizeof(waitThread_t));
+  pthread_attr_t attr;
+  pthread_t thread;
+  sigset_t all, old;
+  int err;
+
+  if (!alarm) {
+    perror("Error at malloc");
+    return NULL;
+  }
+  alarm->pid = pid;
+  alarm->wait = wait;
+  alarm->deadline = time(NULL) + wait;
+  alarm->refs = 2;
+  alarm->wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (alarm->wake_fd == -1) {
+    perror("Error at eventfd");
+    free(alarm);
+    return NULL;
+  }
+  // Detached, nobody joins it. Signals stay with the main thread
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  err = pthread_create(&thread, &attr, thread_job, alarm);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pthread_attr_destroy(&attr);
+  if (err) {
+    fprintf(stderr, "Error at pthread_create: %s\n", strerror(err));
+    close(alarm->wake_fd);
+    free(alarm);
+    return NULL;
+  }
+  return (alarm);
+}
+
+// What follows the end of a job already out of the job list, wherever it
+// was waited for: the SIGCHLD handler, fg or the pidfd of an adopted job.
+// Only what is safe in the handler: the rest (relaunch, admission, dag,
+// freeing it) waits for its event in job_event(). Reports it quietly for
+// fg, which prints its own line. Call with SIGCHLD blocked and room in the
+// ring. Returns the term_forget() code of its alarm.
+int job_ended(job *item, int status, const struct rusage *ru, int quiet) {
+  int code;
+
+  prof_record(item->comm_args, item->start_ns, ru);
+  // Its alarm stops first, so the stage reported is the last one sent
+  if (item->threadWait)
+    alarm_thread_stop(item->threadWait);
+  if (item->isProcWait) {
+    kill(item->pid_wait, SIGKILL);
+    waitpid(item->pid_wait, NULL, WUNTRACED);
   }
+  ckpt_drop(item);
+  code = term_forget(item->pgid);
+  notify_push_ended(item, status, code, quiet);
+  return (code);
+}
+
+// Drain side of job_ended(): relaunches an inmortal job and frees it.
+// Runs first among the subscribers, so admission sees the relaunch queued
+static void job_event(notify_event_t *ev) {
+  job *item = ev->item;
+
+  if (ev->kind != NOTIFY_ENDED)
+    return;
+  block_SIGCHLD();
+  if (item->threadWait)
+    alarm_thread_put(item->threadWait);
+  // Relaunches go through admission control like any & launch
+  if (item->inmortal && admit_hold())
+    admit_enqueue(item->comm_args, 1, NULL);
+  else if (item->inmortal)
+    relaunch(item);
+  unblock_SIGCHLD();
+  free_pp_char(item->comm_args);
+  free_job(item);
 }
 
 // No es necesario bloquear la señal de SIGCHLD ya que al llamarse al manejador
@@ -89,42 +328,50 @@ void signal_handler(int signal) {
   int status;
   int info;
   enum status task_status;
+  struct rusage ru;
+  // wait4 leaves ECHILD behind, the interrupted code may be reading errno
+  int saved_errno = errno;
 
   block_SIGCHLD();
 
   act_task = get_iterator(tasks);
 
   while (act_task) {
-    pid_wait =
-        waitpid(act_task->pgid, &status, WUNTRACED | WNOHANG | WCONTINUED);
+    // Room for its event and the two its drain may push (relaunched, dag
+    // done), otherwise leave the job unreaped until the ring is drained
+    if (notify_space() < 3) {
+      notify_overflow();
+      break;
+    }
+    pid_wait = wait4(act_task->pgid, &status, WUNTRACED | WNOHANG | WCONTINUED,
+                     &ru);
     if (pid_wait == act_task->pgid) {
       task_status = analyze_status(status, &info);
       if ((task_status == EXITED) || (task_status == SIGNALED)) {
-        printf("Background job %s ended correctly\n", act_task->command);
-        if (act_task->inmortal) {
-          print_item(act_task);
-          relaunch(act_task);
-        }
-        if (act_task->threadWait) {
-          pthread_cancel(*(act_task->threadWait));
-        }
-        if (act_task->isProcWait) {
-          kill(act_task->pid_wait, SIGKILL);
-          waitpid(act_task->pid_wait, NULL, WUNTRACED);
-        }
-        free_pp_char(act_task->comm_args);
-        delete_job(tasks, act_task);
+        trace_event(TRACE_EXIT, act_task->pgid, act_task->command, status);
+        // The job is freed here, the loop goes on from its successor
+        job *ended = next(act_task);
+        remove_job(tasks, ended);
+        job_ended(ended, status, &ru, 0);
+        continue;
       } else if ((task_status == CONTINUED)) {
-        printf("Stopped job %s launched\n", act_task->command);
+        trace_event(TRACE_CONTINUE, act_task->pgid, act_task->command, 0);
+        notify_push(NOTIFY_CONTINUED, act_task->pgid, act_task->command, 0);
         act_task->state = BACKGROUND;
+        ckpt_sync(act_task);
       } else if ((task_status == SUSPENDED)) {
-        printf("Job %s, running at background stopped\n", act_task->command);
+        trace_event(TRACE_STOP, act_task->pgid, act_task->command, info);
+        notify_push(NOTIFY_STOPPED, act_task->pgid, act_task->command, status);
         act_task->state = STOPPED;
+        ckpt_sync(act_task);
       }
     }
     next(act_task);
   }
+  // Orphans given to the shell as subreaper
+  ckpt_child_event();
   unblock_SIGCHLD();
+  errno = saved_errno;
 }
 
 // Sighup handler
@@ -137,14 +384,21 @@ void sighup_handler(int signal) {
   }
 }
 
-// Sigalrm handler
+// Rearms the alarm in secs unless it is already due sooner
+static void rearm_alarm(int secs) {
+  unsigned int left = alarm(0);
+  alarm(left && left < (unsigned int)secs ? left : (unsigned int)secs);
+}
+
+// Sigalrm handler: sends the stage of the termination policy that is due
 void sigalrm_handler(int signal) {
+  int secs, due = 0;
+  int saved_errno = errno;
+
   // Chequeamos el de foreground
   if (pidAlarmSig > 0) {
-    if ((time(NULL) - global_time) >= timeSignalGlobal) {
-      kill(pidAlarmSig, SIGCONT);
-      kill(pidAlarmSig, SIGKILL);
-    }
+    if ((time(NULL) - global_time) >= timeSignalGlobal)
+      due = term_due(pidAlarmSig, NULL);
   }
   // Comprobamos los que esten en bg o suspended
   block_SIGCHLD();
@@ -152,37 +406,91 @@ void sigalrm_handler(int signal) {
   while (act_task) {
     if (act_task->isAlarmSig) {
       if ((time(NULL) - act_task->initTime) >= act_task->timeAlarmSig) {
-        kill(act_task->pgid, SIGCONT);
-        kill(act_task->pgid, SIGKILL);
+        // No room to report it, try again in a second
+        if (!notify_space()) {
+          due = 1;
+          break;
+        }
+        if (!term_sent(act_task->pgid))
+          notify_push(NOTIFY_ALARM, act_task->pgid, act_task->command, 0);
+        secs = term_due(act_task->pgid, act_task->command);
+        if (secs && (!due || secs < due))
+          due = secs;
       }
     }
     next(act_task);
   }
   unblock_SIGCHLD();
+  if (due)
+    rearm_alarm(due);
+  errno = saved_errno;
 }
 
-// Check if we need to append and on that case organize args
-int check_if_append(char **args, char **file_out) {
+// Check for a compressed redirection ">z file" / ">>z file" and remove it
+// from args. Returns 1 (>z), 2 (>>z), 0 if there is none or -1 on error
+int check_if_compress(char **args, char **file_z) {
   for (int i = 0; args[i]; i++) {
-    if (!strcmp(args[i], ">>")) {
-      *file_out = args[i + 1];
-      if (!file_out) {
+    int ret = !strcmp(args[i], ">z") ? 1 : !strcmp(args[i], ">>z") ? 2 : 0;
+    if (ret) {
+      *file_z = args[i + 1];
+      if (!*file_z) {
         fprintf(stderr, "syntax error in redirection\n");
         return (-1);
       }
-      char *act = args[i + 2];
-      int z = 0;
-      while (args[i + z]) {
-        args[i + z] = act;
-        z++;
-        act = args[i + 2 + z];
-      }
-      return (1);
+      for (int z = i; args[z + 1]; z++)
+        args[z] = args[z + 2];
+      return (ret);
     }
   }
   return (0);
 }
 
+static int is_redirection(const char *arg) {
+  return redir_is_operator(arg) || !strcmp(arg, ">+") || !strcmp(arg, ">z") ||
+         !strcmp(arg, ">>z") || !strcmp(arg, "+");
+}
+
+// Collects the files of a fan-out redirection, several "> file" or
+// ">+ file1 file2 ..." (up to the next operator), and removes them from args.
+// Returns the number of files or -1 on error. A single "> file" is left to
+// the redirection plan
+int check_if_fanout(char **args, char **files) {
+  int n_out = 0, plus = 0, n = 0, w = 0, len;
+
+  for (len = 0; args[len]; len++) {
+    n_out += !strcmp(args[len], ">");
+    plus |= !strcmp(args[len], ">+");
+  }
+  if (n_out < 2 && !plus)
+    return (0);
+  // >+ *.log can give more names than a line has tokens
+  if (len > MAX_LINE / 2) {
+    fprintf(stderr, "too many fan-out files\n");
+    return (-1);
+  }
+  for (int i = 0; args[i];) {
+    if (!strcmp(args[i], ">")) {
+      if (!args[i + 1]) {
+        fprintf(stderr, "syntax error in redirection\n");
+        return (-1);
+      }
+      files[n++] = args[i + 1];
+      i += 2;
+    } else if (!strcmp(args[i], ">+")) {
+      for (i++; args[i] && !is_redirection(args[i]); i++)
+        files[n++] = args[i];
+    } else {
+      args[w++] = args[i++];
+    }
+  }
+  args[w] = NULL;
+  if (!n) {
+    fprintf(stderr, "syntax error in redirection\n");
+    return (-1);
+  }
+  return (n);
+}
+
 // Check if we have "+" character
 int is_inmortal(char **args) {
   for (int i = 0; args[i]; i++) {
@@ -205,6 +513,78 @@ int is_block_mask(char **args) {
   return (0);
 }
 
+// A command submitted through the control socket, as a background job: the
+// same steps as one typed with &, VAR=x and limit prefixes, + for inmortal,
+// redirections and admission control. What only makes sense at the prompt
+// (alarms, mask, fan-out, >z) is refused. Returns the pid, 0 if it was
+// queued or -1 with the reason in *err
+pid_t submit_job(char **args, const char **err) {
+  char *files[MAX_LINE / 2];
+  char *file_z;
+  char **envp;
+  job_limits lim = {0};
+  redir_plan redir;
+  int inmortal, n_fanout, i = 0;
+  pid_t pid;
+
+  // Alone, VAR=x would set a variable of the shell
+  while (args[i] && env_is_assignment(args[i]))
+    i++;
+  if (!args[i]) {
+    *err = "no command";
+    return (-1);
+  }
+  envp = env_prefix(args);
+  if (!strcmp(args[0], "limit")) {
+    int cmd = args[1] && strcmp(args[1], "-d") ? limit_parse(args, &lim) : -1;
+    if (cmd == -1 || !args[cmd]) {
+      *err = "bad limit prefix";
+      free(envp);
+      return (-1);
+    }
+    for (i = 0; args[i + cmd]; i++)
+      args[i] = args[i + cmd];
+    args[i] = NULL;
+  }
+  if (!strcmp(args[0], "alarm-thread") || !strcmp(args[0], "alarm-proc") ||
+      !strcmp(args[0], "alarm-signal") || is_block_mask(args)) {
+    *err = "alarms and mask are only available at the prompt";
+    free(envp);
+    return (-1);
+  }
+  n_fanout = check_if_fanout(args, files);
+  if (n_fanout == -1 || !args[0] || redir_parse(args, &redir) == -1 ||
+      !args[0] ||
+      (n_fanout == 1 &&
+       redir_add(&redir, STDOUT_FILENO, REDIR_OUT, files[0]) == -1)) {
+    *err = "bad redirection";
+    free(envp);
+    return (-1);
+  }
+  if (n_fanout > 1 || check_if_compress(args, &file_z)) {
+    *err = "fan-out and >z are only available at the prompt";
+    free(envp);
+    return (-1);
+  }
+  inmortal = is_inmortal(args);
+
+  // Queued like a & launch typed at the prompt, same exceptions
+  if (!lim.mask && !envp) {
+    block_SIGCHLD();
+    if (admit_hold()) {
+      admit_enqueue(args, inmortal, &redir);
+      unblock_SIGCHLD();
+      return (0);
+    }
+    unblock_SIGCHLD();
+  }
+  pid = launch_job(args, inmortal, &redir, &lim, envp);
+  free(envp);
+  if (pid == -1)
+    *err = "launch failed";
+  return (pid);
+}
+
 // Here we are sure that the argumet to block signals is correct and procceed to
 // block signals, there is a function to do this so there was no need to replay
 // this function
@@ -240,26 +620,35 @@ void clone_into_buff(char *input, char inputBuff[]) {
   inputBuff[len] = '\n';
 }
 
-// Function that will exec our alarm-thread
-void *thread_job(void *arg) {
-  waitThread_t *argThreadJ = (waitThread_t *)arg;
-
-  sleep(argThreadJ->wait);
-
-  kill(argThreadJ->pid, SIGCONT);
-  kill(argThreadJ->pid, SIGKILL);
-
-  free(argThreadJ);
-  pthread_exit(NULL);
+#ifdef SOAK
+// Prints the live heap of the sanitizer allocator, the RSS and the jobs
+void soak_stat(void) {
+  char line[256];
+  long rss_kb = -1;
+  int n_tasks;
+  FILE *fd = fopen("/proc/self/status", "r");
+  while (fd && fgets(line, sizeof(line), fd)) {
+    if (!strncmp(line, "VmRSS:", 6))
+      rss_kb = atol(line + 6);
+  }
+  if (fd)
+    fclose(fd);
+  block_SIGCHLD();
+  n_tasks = list_size(tasks);
+  unblock_SIGCHLD();
+  printf("soak-stat live: %zu rss: %ld tasks: %d\n",
+         __sanitizer_get_current_allocated_bytes(), rss_kb, n_tasks);
 }
+#endif
 
 /**
  * MAIN
  **/
-int main(void) {
+int main(int argc, char *argv[]) {
   char inputBuffer[MAX_LINE]; /* Buffer to hold the command entered */
   int background;             /* Equals 1 if a command is followed by '&' */
-  char *args[MAX_LINE / 2]; /* Command line (of 256) has max of 128 arguments */
+  char *line_args[MAX_LINE / 2]; /* Line (of 256) has max of 128 tokens */
+  char **args;              /* Command to run, after expansion */
   /* Probably useful variables: */
   int pid_fork, pid_wait; /* PIDs for created and waited processes */
   int status;             /* Status returned by wait */
@@ -270,27 +659,119 @@ int main(void) {
   ignore_terminal_signals();
   // we create our new task list
   tasks = new_list("tasks");
+  // Job notifications are printed from the prompt loop, not the handlers
+  if (notify_init() == -1)
+    exit(EXIT_FAILURE);
+  // Before any other subscriber: ended jobs are still readable in theirs
+  notify_subscribe(job_event);
+  // Stages of the alarm termination policy, shared with alarm-proc
+  if (term_init() == -1)
+    exit(EXIT_FAILURE);
+  // Timer queue for every / at
+  if (sched_init() == -1)
+    exit(EXIT_FAILURE);
+  // Dependency graph runs report from the notification drain
+  dag_init();
+  wait_init();
+  // Persistent workers, their pipes close when their job ends
+  coproc_init();
+  // Queue for background launches held back by admission control
+  if (admit_init() == -1)
+    exit(EXIT_FAILURE);
+  // Variables, environ becomes the envp cached by the module
+  env_init();
+  // Tab completion from an index of PATH kept fresh with inotify
+  complete_init();
+  // The shell runs for weeks, the history must not grow forever
+  stifle_history(HIST_MAX);
+
+  // --listen path: also take requests from a local control socket
+  char *replay_file = NULL;
+  char *ckpt_path = NULL;
+  char *prof_path = NULL;
+  char *selfprof_path = NULL;
+  double replay_speed = 1.0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--listen") && argv[i + 1]) {
+      if (ctl_listen(argv[++i]) == -1)
+        exit(EXIT_FAILURE);
+    } else if (!strcmp(argv[i], "--trace") && argv[i + 1]) {
+      if (trace_start(argv[++i]) == -1)
+        exit(EXIT_FAILURE);
+    } else if (!strcmp(argv[i], "--record") && argv[i + 1]) {
+      if (session_record(argv[++i]) == -1)
+        exit(EXIT_FAILURE);
+    } else if (!strcmp(argv[i], "--replay") && argv[i + 1]) {
+      replay_file = argv[++i];
+    } else if (!strcmp(argv[i], "--speed") && argv[i + 1]) {
+      replay_speed = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--checkpoint") && argv[i + 1]) {
+      ckpt_path = argv[++i];
+    } else if (!strcmp(argv[i], "--jobprof") && argv[i + 1]) {
+      prof_path = argv[++i];
+    } else if (!strcmp(argv[i], "--profile") && argv[i + 1]) {
+      selfprof_path = argv[++i];
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--listen socket_path] [--trace file] [--record "
+              "file] [--replay file [--speed x]] [--checkpoint file] "
+              "[--jobprof file] [--profile file]\n",
+              argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  // --profile file: samples of the shell's own stacks, folded on exit
+  if (selfprof_path && selfprof_start(selfprof_path) == -1)
+    exit(EXIT_FAILURE);
+  // --jobprof file: run times of previous shells, kept up to date
+  if (prof_path && prof_open(prof_path) == -1)
+    exit(EXIT_FAILURE);
+  // Replayed lines go through the same path as typed ones
+  if (replay_file && session_replay(replay_file, replay_speed) == -1)
+    exit(EXIT_FAILURE);
+  // SIGCHLD and SIGALRM handlers mask each other, both push notifications
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaddset(&sa.sa_mask, SIGCHLD);
+  sigaddset(&sa.sa_mask, SIGALRM);
   // how me manage when we receive SIGCHLD
-  signal(SIGCHLD, signal_handler);
+  sa.sa_handler = signal_handler;
+  sigaction(SIGCHLD, &sa, NULL);
   // manage alarm signal
-  signal(SIGALRM, sigalrm_handler);
+  sa.sa_handler = sigalrm_handler;
+  sigaction(SIGALRM, &sa, NULL);
+  // --checkpoint file: adopt the jobs of a previous shell and keep the file
+  // up to date. Their alarms may fire at once, so after the handlers
+  if (ckpt_path && ckpt_open(ckpt_path) == -1)
+    exit(EXIT_FAILURE);
 
   // Fg, Bg and jobs
   job *act_task;
   pid_t pid_fg;
   char *fg_task_name;
 
-  // Redirections
-  char *file_in = NULL;
-  char *file_out = NULL;
-  FILE *f_in = NULL;
-  FILE *f_out = NULL;
+  // Redirections, opened by the shell before the fork
+  redir_plan redir;
+
+  // Commands of the line still to run (a; b && c)
+  cmd_list cmds = {0};
+  // Environment of a command with a VAR=x prefix, NULL for the cached one
+  char **job_envp = NULL;
 
   // Sighup
   signal(SIGHUP, sighup_handler);
 
-  // Append >>
-  int append = 0;
+  // Compressed output >z / >>z
+  char *file_z = NULL;
+  int compress = 0;
+  zstream *zout = NULL;
+
+  // Fan-out > a > b / >+ a b c
+  char *fanout_files[MAX_LINE / 2];
+  int n_fanout = 0;
+  fanout *fan = NULL;
 
   // Inmortal
   int inmortal = 0;
@@ -301,14 +782,25 @@ int main(void) {
   // Alarm-Thread
   int isThread;
   int timeThread;
-  pthread_t *threadWait;
-  waitThread_t *argThread = NULL;
+  waitThread_t *threadWait;
 
   // Alarm-Proc
   int isProcWait;
   int timeProc;
   pid_t pidAlarmProc;
 
+  // Limit prefix
+  job_limits job_lim;
+  int fg_limits;
+
+  // In-process utilities (true, echo, test...) and builtin -x
+  int fast;
+  int external;
+
+  // Run time profile of the foreground job
+  long long start_ns = 0;
+  struct rusage usage;
+
   // Alarm-Signal
   time_t initTime;
   int isAlarmSig;
@@ -317,136 +809,195 @@ int main(void) {
   while (
       1) /* Program terminates normally inside get_command() after ^D is typed*/
   {
-    // Con la libreral de readline implementamos el historial
-    entry = readline("COMMAND->");
-
-    /*
-    printf("COMMAND->");
-    fflush(stdout);
-    */
-
-    // Para ejecutar la instruccion del historial
-    if ((entry != NULL) && entry[0] == '!') {
-      int num = atoi(&entry[1]);
-      if (num > 0) {
-        HIST_ENTRY **hist_search = history_list();
-        int i = 0;
-        while ((i < (num - 1)) && hist_search[i]) {
-          i++;
-        }
-        if ((i == (num - 1)) && hist_search[i]) {
-          free(entry);
-          entry = strdup(hist_search[i]->line);
+    // The rest of a command list runs before the next prompt
+    if (!list_next(&cmds)) {
+      // Orphans that ended while a foreground job ran
+      ckpt_reap_orphans();
+      // Con la libreral de readline implementamos el historial
+      // (served from the event loop so job notifications show while typing)
+      session_prompt();
+      if (session_replaying())
+        entry = session_next_line();
+      else
+        entry = loop_readline("COMMAND->");
+      session_line_read(entry);
+
+      /*
+      printf("COMMAND->");
+      fflush(stdout);
+      */
+
+      // Para ejecutar la instruccion del historial
+      if ((entry != NULL) && entry[0] == '!') {
+        int num = atoi(&entry[1]);
+        if (num > 0) {
+          HIST_ENTRY **hist_search = history_list();
+          int i = 0;
+          while ((i < (num - 1)) && hist_search[i]) {
+            i++;
+          }
+          if ((i == (num - 1)) && hist_search[i]) {
+            free(entry);
+            entry = strdup(hist_search[i]->line);
+          }
         }
       }
-    }
 
-    // Vaciamos lo que haya en  input buffer
-    bzero(inputBuffer, MAX_LINE);
-    // Si el usuario ha usado ^D se acaba, sino clonamos
-    if (entry == NULL)
-      inputBuffer[0] = 0;
-    else
-      clone_into_buff(entry, inputBuffer);
+      // Without stdin the control socket, if any, keeps the shell alive
+      if (entry == NULL && ctl_active())
+        ctl_serve();
 
-    // Parseo de lo introducido por el usuario
-    get_command(inputBuffer, MAX_LINE, args,
-                &background); /* Get next command */
+      // Vaciamos lo que haya en  input buffer
+      bzero(inputBuffer, MAX_LINE);
+      // Si el usuario ha usado ^D se acaba, sino clonamos
+      if (entry == NULL)
+        inputBuffer[0] = 0;
+      else
+        clone_into_buff(entry, inputBuffer);
 
-    // Texto vacio == continuar
-    if (args[0] == NULL)
-      continue; /* Do nothing if empty command */
+      // Parseo de lo introducido por el usuario
+      get_command(inputBuffer, MAX_LINE, line_args,
+                  &background); /* Get next command */
 
-    // Se añade la entrada al historial y se borra
-    add_history(entry);
-    free(entry);
+      // Texto vacio == continuar
+      if (line_args[0] == NULL) {
+        free(entry);
+        continue; /* Do nothing if empty command */
+      }
+
+      // Se añade la entrada al historial y se borra
+      add_history(entry);
+      free(entry);
+
+      // a; b && c || d: one command per pass of the loop
+      if (list_parse(line_args, background, &cmds) == -1)
+        continue;
+      // A list ending in & is a single job
+      if (cmds.background && cmds.n > 1) {
+        pid_fork = list_launch(&cmds);
+        if (pid_fork != -1)
+          printf("Background job running... pid: %d, command: %s\n",
+                 pid_fork, cmds.tokens[0]);
+        continue;
+      }
+      if (!list_next(&cmds))
+        continue;
+    }
+    args = cmds.argv;
+    background = cmds.background;
+    // Builtins succeed unless they say otherwise
+    list_set_status(0);
+
+    // VAR=x alone sets a variable, VAR=x cmd only for that command
+    free(job_envp);
+    job_envp = env_prefix(args);
+    if (!args[0])
+      continue;
 
     // Cd built-in
     if (!strcmp(args[0], "cd")) {
-      if (args[1] != NULL)
-        chdir(args[1]);
+      // A failed cd stops "cd dir && cmd"
+      if (args[1] != NULL && chdir(args[1]) == -1) {
+        fprintf(stderr, "cd: %s: %s\n", args[1], strerror(errno));
+        list_set_status(1);
+      }
       continue;
     }
 
     // Prints the jobs suspended and bg list
     if (!strcmp(args[0], "jobs")) {
+      if (args[1] && !strcmp(args[1], "--watch")) {
+        jobs_watch(args);
+        continue;
+      }
       block_SIGCHLD();
       print_job_list(tasks);
       unblock_SIGCHLD();
+      admit_print();
       continue;
     }
 
-    // Changes suspended job to run in background
-    if (!strcmp(args[0], "bg")) {
-      int pos = 1;
-      if (args[1] != NULL)
-        pos = atoi(args[1]);
-      block_SIGCHLD();
-      act_task = get_item_bypos(tasks, pos);
-      if (act_task) {
-        act_task->state = BACKGROUND;
-        killpg(act_task->pgid, SIGCONT);
-      }
-      unblock_SIGCHLD();
+    // bg, stop, kill and deljob act on every job of a spec in one pass
+    if (!strcmp(args[0], "bg") || !strcmp(args[0], "stop") ||
+        !strcmp(args[0], "kill") || !strcmp(args[0], "deljob")) {
+      spec_builtin(args);
       continue;
     }
 
     // Changes a suspended, or a background job to run in foreground
     if (!strcmp(args[0], "fg")) {
       int pos = 1;
-      pthread_t *threadFG;
+      job *fg_job;
+      int code;
       if (args[1] != NULL)
         pos = atoi(args[1]);
+      // Blocked until the job is out of the list, once continued the
+      // handler could reap and free it while it is still being read
       block_SIGCHLD();
       act_task = get_item_bypos(tasks, pos);
-      unblock_SIGCHLD();
+      // Not a child of this shell, waitpid can't wait for it
+      if (act_task && act_task->pidfd != -1) {
+        printf("Job %d was adopted from a previous shell, it can't be "
+               "brought to foreground\n",
+               act_task->pgid);
+        act_task = NULL;
+      }
+      if (!act_task)
+        unblock_SIGCHLD();
       if (act_task) {
         set_terminal(act_task->pgid);
+        trace_event(TRACE_FG, act_task->pgid, act_task->command, 0);
         if (act_task->state == STOPPED)
           killpg(act_task->pgid, SIGCONT);
         pid_fg = act_task->pgid;
         fg_task_name = strdup(act_task->command);
-        threadFG = act_task->threadWait;
-        isProcWait = act_task->isProcWait;
-        pidAlarmProc = act_task->pid_wait;
         isAlarmSig = act_task->isAlarmSig;
-        timeAlarmSig = act_task->timeAlarmSig;
-        initTime = act_task->initTime;
-        block_SIGCHLD();
-        free_pp_char(act_task->comm_args);
-        delete_job(tasks, act_task);
+        // The job is kept out of the list while it runs in foreground,
+        // and back to it if it is suspended again
+        fg_job = act_task;
+        fg_job->inmortal = 0;
+        ckpt_drop(fg_job);
+        remove_job(tasks, fg_job);
         act_task = NULL;
         unblock_SIGCHLD();
 
-        pidAlarmSig = pidAlarmProc;
-        global_time = initTime;
-        timeSignalGlobal = timeAlarmSig;
+        pidAlarmSig = isAlarmSig ? pid_fg : 0;
+        global_time = fg_job->initTime;
+        timeSignalGlobal = fg_job->timeAlarmSig;
 
-        pid_wait = waitpid(pid_fg, &status, WUNTRACED);
+        foreground_pid = pid_fg;
+        pid_wait = loop_waitpid(pid_fg, &status, WUNTRACED, &usage);
+        foreground_pid = 0;
+        pidAlarmSig = 0;
         set_terminal(getpid());
         status_res = analyze_status(status, &info);
+        session_foreground(status);
+        list_foreground(status);
+        if (status_res == SUSPENDED)
+          trace_event(TRACE_STOP, pid_fg, fg_task_name, info);
+        else
+          trace_event(TRACE_EXIT, pid_fg, fg_task_name, status);
 
         if (status_res == SUSPENDED) {
-          pidAlarmSig = 0;
           block_SIGCHLD();
-          act_task = new_job(pid_fg, fg_task_name, STOPPED);
-          act_task->inmortal = 0;
-          act_task->comm_args = cpy_args(args);
-          act_task->threadWait = threadFG;
-          act_task->isProcWait = isProcWait;
-          act_task->pid_wait = pidAlarmProc;
-          act_task->isAlarmSig = isAlarmSig;
-          act_task->timeAlarmSig = timeAlarmSig;
-          act_task->initTime = initTime;
-          add_job(tasks, act_task);
+          fg_job->state = STOPPED;
+          add_job(tasks, fg_job);
+          ckpt_sync(fg_job);
           unblock_SIGCHLD();
           free(fg_task_name);
           printf("Suspended job added\n");
-        } else if (status_res == EXITED || /*new*/ status_res == EXITED) {
-          if (threadFG)
-            pthread_cancel(*threadFG);
-          printf("Foreground pid: %d, command: %s, %s, info: %d\n", pid_fg,
-                 fg_task_name, status_strings[status_res], info);
+        } else {
+          // Ended like a background job, so dependents and waiters see it
+          fg_limits = fg_job->limits;
+          if (notify_space() < 3)
+            notify_drain();
+          block_SIGCHLD();
+          code = job_ended(fg_job, status, &usage, 1);
+          unblock_SIGCHLD();
+          printf("Foreground pid: %d, command: %s, %s, info: %d%s%s\n",
+                 pid_fg, fg_task_name, status_strings[status_res], info,
+                 limit_explain(status, fg_limits), term_explain(code, status));
+          prof_save(0);
           free(fg_task_name);
         }
       }
@@ -465,31 +1016,6 @@ int main(void) {
       continue;
     }
 
-    // Deljob deletes a job from the job list --> this leads to zombie jobs
-    if (!strcmp(args[0], "deljob")) {
-      block_SIGCHLD();
-      act_task = get_item_bypos(tasks, 1);
-      unblock_SIGCHLD();
-      if (!act_task)
-        printf("No hay trabajo actual\n");
-      else {
-        if (act_task->state == STOPPED) {
-          printf(
-              "No se permiten borrar trabajos en segundo plano suspendido\n");
-        } else {
-          printf("Borrando trabajo actual de la lista de jobs: PID=%d "
-                 "command=%s\n",
-                 act_task->pgid, act_task->command);
-          block_SIGCHLD();
-          free_pp_char(act_task->comm_args);
-          delete_job(tasks, act_task);
-          unblock_SIGCHLD();
-        }
-      }
-      act_task = NULL;
-      continue;
-    }
-
     // zjobs --> cleans all zombie jobs made by deljob
     if (!strcmp(args[0], "zjobs")) {
       block_SIGCHLD();
@@ -534,32 +1060,78 @@ int main(void) {
       }
       if (atoi(args[1]) <= 0)
         continue;
-      for (int i = 0; i < atoi(args[1]); i++) {
-        pid_fork = fork();
-        if (pid_fork == -1) {
-          perror("Error at fork");
-        } else if (pid_fork == 0) {
-          new_process_group(getpid());
-          restore_terminal_signals();
-          execvp(args[2], &args[2]);
-          perror("Error executing command");
-          exit(EXIT_FAILURE);
-        } else {
-          new_process_group(pid_fork);
-          block_SIGCHLD();
-          act_task = new_job(pid_fork, args[2], BACKGROUND);
-          act_task->inmortal = 0;
-          act_task->comm_args = cpy_args(args);
-          act_task->threadWait = NULL;
-          act_task->isProcWait = 0;
-          act_task->pid_wait = -1;
-          act_task->isAlarmSig = 0;
-          act_task->timeAlarmSig = 0;
-          act_task->initTime = 0;
-          add_job(tasks, act_task);
-          unblock_SIGCHLD();
-        }
-      }
+      for (int i = 0; i < atoi(args[1]); i++)
+        admit_launch(&args[2]);
+      continue;
+    }
+
+    // jobprof --> slowest command lines, from the run time profile
+    if (!strcmp(args[0], "jobprof")) {
+      prof_builtin(args);
+      continue;
+    }
+
+    // coproc / coreq --> persistent workers fed one line per request
+    if (!strcmp(args[0], "coproc")) {
+      coproc_builtin(args);
+      continue;
+    }
+    if (!strcmp(args[0], "coreq")) {
+      list_set_status(coreq_builtin(args));
+      continue;
+    }
+
+    // alarm-policy --> signals and grace periods for expired alarms
+    if (!strcmp(args[0], "alarm-policy")) {
+      term_builtin(args);
+      continue;
+    }
+
+    // profdump --> folded stacks of the shell, taken with --profile
+    if (!strcmp(args[0], "profdump")) {
+      selfprof_builtin(args);
+      continue;
+    }
+
+    // admit --> limits for background launches (queued while exceeded)
+    if (!strcmp(args[0], "admit")) {
+      admit_builtin(args);
+      continue;
+    }
+
+    // every / at / sched --> periodic and one-shot background launches
+    if (!strcmp(args[0], "every")) {
+      sched_every(args);
+      continue;
+    }
+    if (!strcmp(args[0], "at")) {
+      sched_at(args);
+      continue;
+    }
+    if (!strcmp(args[0], "sched")) {
+      sched_builtin(args);
+      continue;
+    }
+
+    // after / dag --> launches jobs once their dependencies succeed
+    if (!strcmp(args[0], "after")) {
+      after_builtin(args);
+      continue;
+    }
+    if (!strcmp(args[0], "dag")) {
+      dag_builtin(args);
+      continue;
+    }
+
+    // wait --> blocks until background jobs end
+    if (!strcmp(args[0], "wait")) {
+      list_set_status(wait_builtin(args));
+      continue;
+    }
+
+    // trace --> records job lifecycle events into a trace file
+    if (!strcmp(args[0], "trace")) {
+      trace_builtin(args);
       continue;
     }
 
@@ -569,6 +1141,14 @@ int main(void) {
       continue;
     }
 
+#ifdef SOAK
+    // soak-stat --> live heap and RSS, read by soak.sh
+    if (!strcmp(args[0], "soak-stat")) {
+      soak_stat();
+      continue;
+    }
+#endif
+
     // Shows all commands executed by user
     if (!strcmp(args[0], "hist")) {
       HIST_ENTRY **hist = history_list();
@@ -578,6 +1158,25 @@ int main(void) {
       continue;
     }
 
+    // limit name=value... cmd --> resource limits set before execvp, the
+    // defaults of background jobs are added later
+    memset(&job_lim, 0, sizeof(job_lim));
+    if (!strcmp(args[0], "limit")) {
+      if (!args[1] || !strcmp(args[1], "-d")) {
+        limit_builtin(args);
+        continue;
+      }
+      int cmd = limit_parse(args, &job_lim);
+      if (cmd == -1)
+        continue;
+      int i = 0;
+      while (args[i + cmd]) {
+        args[i] = args[i + cmd];
+        i++;
+      }
+      args[i] = NULL;
+    }
+
     // Set to 0 / null var needed by alarm-thread
     isThread = 0;
     timeThread = 0;
@@ -637,6 +1236,22 @@ int main(void) {
       args[i] = NULL;
     }
 
+    // builtin -x cmd --> always executes the binary, never the shell's own
+    external = 0;
+    if (!strcmp(args[0], "builtin")) {
+      if (!args[1] || strcmp(args[1], "-x") || !args[2]) {
+        printf("Usage: builtin -x cmd [args...]\n");
+        continue;
+      }
+      external = 1;
+      int i = 0;
+      while (args[i + 2]) {
+        args[i] = args[i + 2];
+        i++;
+      }
+      args[i] = NULL;
+    }
+
     // Variables needed for mydeamon
     pid_t pid_sub_fork = 0;
     FILE *f_null;
@@ -683,6 +1298,12 @@ int main(void) {
       continue;
     }
 
+    // export and unset --> variables in the environment of the jobs
+    if (!strcmp(args[0], "export") || !strcmp(args[0], "unset")) {
+      env_builtin(args);
+      continue;
+    }
+
     // Exit function
     if (!strcmp(args[0], "exit"))
       exit(EXIT_SUCCESS);
@@ -695,24 +1316,115 @@ int main(void) {
      * 	 (5) Loop returns to get_commnad() function
      **/
 
-    // We detect if we have to redirect outputs or inputs
-    parse_redirections(args, &file_in, &file_out);
+    // Several output files are relayed by the prompt loop
+    n_fanout = check_if_fanout(args, fanout_files);
+    if (n_fanout == -1 || !args[0])
+      continue;
 
-    append = check_if_append(args, &file_out);
-    if (append == -1)
+    // We detect if we have to redirect inputs, outputs or errors
+    if (redir_parse(args, &redir) == -1 || !args[0])
       continue;
+    if (n_fanout == 1) {
+      if (redir_add(&redir, STDOUT_FILENO, REDIR_OUT, fanout_files[0]) == -1)
+        continue;
+      n_fanout = 0;
+    }
+
+    // Compressed output is written by a thread of the shell
+    compress = check_if_compress(args, &file_z);
+    if (compress == -1 || !args[0])
+      continue;
+    if (compress && n_fanout) {
+      fprintf(stderr, ">z can not be combined with several outputs\n");
+      continue;
+    }
+    if ((compress || n_fanout) && redir_sets(&redir, STDOUT_FILENO)) {
+      fprintf(stderr, "Output can only be redirected once\n");
+      continue;
+    }
 
     // Initialize varibale used for inmortal commands
     inmortal = 0;
     inmortal = is_inmortal(args);
 
+    // true, echo, test, cat... run inside the shell in the foreground and
+    // skip the exec in the background. Alarms and limits need a real job
+    fast = !external && !compress && !n_fanout && !isThread && !isProcWait &&
+           !isAlarmSig && !job_lim.mask &&
+           fast_builtin(args, &redir);
+    if (fast && !background && !inmortal) {
+      status = fast_foreground(args, &redir);
+      if (status == -1)
+        continue;
+      status_res = analyze_status(status, &info);
+      session_foreground(status);
+      list_foreground(status);
+      // No process of its own: pid 0
+      printf("Foreground pid: 0, command: %s, %s, info: %d\n", args[0],
+             status_strings[status_res], info);
+      continue;
+    }
+
+    // Background launches wait in the admission queue while the machine is
+    // busy. Alarms must start counting now, mask, limit and a VAR=x prefix
+    // need the fork below
+    if ((background || inmortal) && !compress && !n_fanout && !isThread &&
+        !isProcWait && !isAlarmSig && !is_block_mask(args) && !job_lim.mask &&
+        !job_envp) {
+      block_SIGCHLD();
+      if (admit_hold()) {
+        admit_enqueue(args, inmortal, &redir);
+        unblock_SIGCHLD();
+        printf("Background job queued... command: %s\n", args[0]);
+        continue;
+      }
+      unblock_SIGCHLD();
+    }
+
+    // Default limits of background jobs, unless the prefix sets them
+    if (background || inmortal)
+      limit_add_defaults(&job_lim);
+
     // Set to use for blocking signals
     sigset_t signals_set;
 
     // Initialize variables for alarm-signal
     pidAlarmSig = 0;
 
+    // A file that can't be opened costs no process
+    if (redir_open(&redir) == -1) {
+      list_set_status(1);
+      continue;
+    }
+    zout = NULL;
+    if (compress) {
+      zout = zredir_open(file_z, compress == 2);
+      if (!zout) {
+        redir_close(&redir);
+        continue;
+      }
+    }
+    fan = NULL;
+    if (n_fanout) {
+      fan = fanout_open(fanout_files, n_fanout);
+      if (!fan) {
+        redir_close(&redir);
+        continue;
+      }
+    }
+
     pid_fork = fork();
+    if (pid_fork > 0)
+      redir_close(&redir);
+    // The stages of its alarm are recorded from before it can fire
+    if (pid_fork > 0 && (isThread || isProcWait || isAlarmSig))
+      term_claim(pid_fork);
+
+    // The compressor only sees EOF once every copy of the write end is closed
+    if (pid_fork > 0 && zout)
+      zredir_start(zout, pid_fork, args[0]);
+    if (pid_fork > 0 && fan)
+      fanout_start(fan, pid_fork, args[0]);
 
     // In alarm-proc we need pid of child and pid of the process that will kill
     // child
@@ -722,8 +1434,7 @@ int main(void) {
         new_process_group(getpid());
         restore_terminal_signals();
         sleep(timeProc);
-        kill(pid_fork, SIGCONT);
-        kill(pid_fork, SIGKILL);
+        term_run(pid_fork, -1);
         exit(EXIT_SUCCESS);
       } else if (pidAlarmProc > 0) {
         new_process_group(pidAlarmProc);
@@ -731,9 +1442,15 @@ int main(void) {
     }
 
     if (pid_fork == -1) {
-      // Error
+      // Error: the shell keeps running, the files opened for it are released
       perror("Error at fork");
-      exit(EXIT_FAILURE);
+      redir_close(&redir);
+      if (zout)
+        zredir_abort(zout);
+      if (fan)
+        fanout_abort(fan);
+      list_set_status(1);
+      continue;
     } else if (pid_fork == 0) {
       // Child
 
@@ -741,45 +1458,31 @@ int main(void) {
       if (is_block_mask(args))
         block_signals_mask(args, &signals_set);
 
-      // Redirect file out
-      if (file_out) {
-        if (append)
-          f_out = fopen(file_out, "a");
-        else
-          f_out = fopen(file_out, "w");
-        if (!f_out) {
-          perror("Error opening out file\n");
-          exit(EXIT_FAILURE);
-        }
-        int fd_out = fileno(f_out);
-        dup2(fd_out, STDOUT_FILENO);
-        fclose(f_out);
-        f_out = NULL;
-        close(fd_out);
-      }
-
-      // Redirect file in
-      if (file_in) {
-        f_in = fopen(file_in, "r");
-        if (!f_in) {
-          perror("Error opening in file\n");
-          exit(EXIT_FAILURE);
-        }
-        int fd_in = fileno(f_in);
-        dup2(fd_in, STDIN_FILENO);
-        fclose(f_in);
-        f_in = NULL;
-        close(fd_in);
-      }
-
       new_process_group(getpid());
       if (!background && !inmortal)
         set_terminal(getpid());
       restore_terminal_signals();
 
+      // Redirect to the compressor pipe
+      if (zout)
+        dup2(zout->pipe_w, STDOUT_FILENO);
+      if (fan)
+        dup2(fan->in_w, STDOUT_FILENO);
+
+      // Files opened by the parent, 2>&1 after a pipe goes to the pipe. A
+      // FIFO is opened here, once ^C and ^Z reach the job
+      if (redir_apply(&redir) == -1)
+        exit(EXIT_FAILURE);
+      limit_apply(&job_lim);
+
       // Built in command to execute bash script
       if (!strcmp(args[0], "fico"))
         args[0] = "./cuentafich.sh";
+      trace_event(TRACE_EXEC, getpid(), args[0], 0);
+      if (fast)
+        exit(fast_exec(args));
+      if (job_envp)
+        environ = job_envp;
       execvp(args[0], args);
       perror("Error executing command");
 
@@ -798,16 +1501,12 @@ int main(void) {
       // compilador por lo que, aunque redundante es mejor incluirlo pues da
       // mayor seguridad.
       new_process_group(pid_fork);
+      trace_event(TRACE_FORK, pid_fork, args[0], 0);
+      start_ns = monotonic_ns();
 
       // In case of alarm-thread create a new thread + arguments for every case
-      if (isThread) {
-        threadWait = (pthread_t *)malloc(sizeof(pthread_t));
-        argThread = (waitThread_t *)malloc(sizeof(waitThread_t));
-        argThread->pid = pid_fork;
-        argThread->wait = timeThread;
-        pthread_create(threadWait, NULL, thread_job, argThread);
-        pthread_detach(*threadWait);
-      }
+      if (isThread)
+        threadWait = alarm_thread_start(pid_fork, timeThread);
 
       // Set needed data for alarm-signal case
       if (isAlarmSig) {
@@ -819,19 +1518,32 @@ int main(void) {
       if (!background && !inmortal) {
         // Parent + no background
         set_terminal(pid_fork);
-
-        pidAlarmSig = pid_fork;
-        pid_wait = waitpid(pid_fork, &status, WUNTRACED);
+        trace_event(TRACE_FG, pid_fork, args[0], 0);
+
+        pidAlarmSig = isAlarmSig ? pid_fork : 0;
+        foreground_pid = pid_fork;
+        // The loop keeps relaying fan-out output and draining job events
+        // (relaunches, dag nodes, queued jobs) while the job runs
+        pid_wait = loop_waitpid(pid_fork, &status, WUNTRACED, &usage);
+        foreground_pid = 0;
+        pidAlarmSig = 0;
         set_terminal(getpid());
 
         if (pid_wait == pid_fork) {
           status_res = analyze_status(status, &info);
+          session_foreground(status);
+          list_foreground(status);
+          if (status_res == SUSPENDED)
+            trace_event(TRACE_STOP, pid_fork, args[0], info);
+          else
+            trace_event(TRACE_EXIT, pid_fork, args[0], status);
           if (status_res == SUSPENDED) {
-            pidAlarmSig = 0;
             block_SIGCHLD();
             act_task = new_job(pid_fork, args[0], STOPPED);
             act_task->inmortal = 0;
+            act_task->limits = job_lim.mask;
             act_task->comm_args = cpy_args(args);
+            act_task->start_ns = start_ns;
             act_task->threadWait = NULL;
             if (isThread)
               act_task->threadWait = threadWait;
@@ -841,14 +1553,19 @@ int main(void) {
             act_task->timeAlarmSig = timeAlarmSig;
             act_task->initTime = initTime;
             add_job(tasks, act_task);
+            ckpt_sync(act_task);
             unblock_SIGCHLD();
             printf("Suspended job added\n");
+          } else {
+            block_SIGCHLD();
+            prof_record(args, start_ns, &usage);
+            unblock_SIGCHLD();
+            prof_save(0);
           }
 
           // Kill thread (ALARM-THREAD) if proccess has died on fg
-          if ((status_res != SUSPENDED) && isThread) {
-            pthread_cancel(*threadWait);
-          }
+          if ((status_res != SUSPENDED) && threadWait)
+            alarm_thread_cancel(threadWait);
 
           // Kill process (ALARM-PROC) if proccess has died on fg
           if ((status_res != SUSPENDED) && isProcWait) {
@@ -856,8 +1573,12 @@ int main(void) {
             waitpid(pidAlarmProc, NULL, WUNTRACED);
           }
 
-          printf("Foreground pid: %d, command: %s, %s, info: %d\n", pid_fork,
-                 args[0], status_strings[status_res], info);
+          printf("Foreground pid: %d, command: %s, %s, info: %d%s%s\n",
+                 pid_fork, args[0], status_strings[status_res], info,
+                 limit_explain(status, job_lim.mask),
+                 status_res == SUSPENDED
+                     ? ""
+                     : term_explain(term_forget(pid_fork), status));
         }
 
       } else {
@@ -865,6 +1586,7 @@ int main(void) {
         block_SIGCHLD();
         act_task = new_job(pid_fork, args[0], BACKGROUND);
         act_task->inmortal = inmortal;
+        act_task->limits = job_lim.mask;
         act_task->comm_args = cpy_args(args);
         act_task->threadWait = NULL;
         if (isThread)
@@ -875,6 +1597,7 @@ int main(void) {
         act_task->timeAlarmSig = timeAlarmSig;
         act_task->initTime = initTime;
         add_job(tasks, act_task);
+        ckpt_sync(act_task);
         unblock_SIGCHLD();
         printf("Background job running... pid: %d, command: %s\n", pid_fork,
                args[0]);
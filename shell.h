@@ -0,0 +1,40 @@
+/**
+ * Linux Job Control Shell Project
+ * Shell wide state and helpers shared by the builtin modules
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _SHELL_H
+#define _SHELL_H
+
+#include "job_control.h"
+#include "joblimit.h"
+#include "redir.h"
+
+#define MAX_LINE 256 /* 256 chars per line, per command, should be enough */
+#define HIST_MAX 1000 /* Lines kept in the history of a long session */
+
+/* Job list owned by shell.c */
+extern job *tasks;
+/* Job the shell is waiting for in foreground, 0 at the prompt */
+extern pid_t foreground_pid;
+
+/**
+ * Public Functions (defined in shell.c)
+ **/
+char **cpy_args(char **args);
+void free_pp_char(char **args);
+pid_t launch_job(char **args, int inmortal, redir_plan *redir,
+                 const job_limits *lim, char **envp);
+pid_t launch_background(char **args);
+pid_t submit_job(char **args, const char **err);
+void relaunch(job *rela_job);
+int job_ended(job *item, int status, const struct rusage *ru, int quiet);
+waitThread_t *alarm_thread_start(pid_t pid, int wait);
+void alarm_thread_put(waitThread_t *alarm);
+void alarm_thread_stop(waitThread_t *alarm);
+void alarm_thread_cancel(waitThread_t *alarm);
+
+#endif
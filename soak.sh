@@ -0,0 +1,98 @@
+#!/bin/bash
+
+# Soak test: drives a sanitizer build of the shell through launch, suspend,
+# fg, bg and alarm cycles and fails if the live heap or the RSS grows.
+# Usage: ./soak.sh ./a.out.asan [cycles]   (the binary needs -DSOAK)
+# The default 2000 cycles take a few minutes and are what make soak runs.
+# The leaks this is for show up over weeks: make soak-long runs 2000000,
+# about a cycle every 60 ms with ASan, so plan on days for both builds.
+
+shell="$1"
+cycles="${2:-2000}"
+every=$(( cycles / 10 > 0 ? cycles / 10 : 1 ))
+# Cycles before the first checkpoint: the history (HIST_MAX lines) is full
+warmup=100
+log=$(mktemp)
+errors=$(mktemp)
+# The shell has no quoting, jobs that stop themselves are a script
+stopme=$(mktemp)
+printf '#!/bin/sh\nkill -STOP $$\nexit 0\n' > "$stopme"
+chmod +x "$stopme"
+
+# Slack for the allocator and page noise
+live_slack=65536
+rss_slack=1024
+
+export ASAN_OPTIONS="detect_leaks=1:quarantine_size_mb=1:exitcode=23"
+# Signal-unsafe calls are reported too: the handlers only reap and push
+# events, relaunches, admission and dag launches run from the drain
+export TSAN_OPTIONS="halt_on_error=1:exitcode=23"
+
+commands() {
+  for ((i = 1; i <= warmup + cycles; i++)); do
+    echo "sleep 0 &"
+    echo "$stopme"
+    echo "fg"
+    echo "$stopme"
+    echo "bg"
+    echo "alarm-thread 5 true"
+    echo "alarm-proc 5 true"
+    echo "alarm-thread 5 $stopme"
+    echo "fg"
+    echo "true"
+    echo ""
+    # One alarm that really fires every 100 cycles
+    if (( i % 100 == 0 )); then
+      echo "alarm-thread 1 sleep 5 &"
+    fi
+    # Checkpoints once every job is gone
+    if (( i == warmup || (i > warmup && i % every == 0) )); then
+      echo "wait"
+      echo "sleep 1.2"
+      echo "wait"
+      echo "soak-stat"
+    fi
+  done
+  echo "exit"
+}
+
+# Only the checkpoints are kept, a long run prints gigabytes otherwise.
+# Sanitizer reports go to stderr
+commands | "$shell" 2> "$errors" | grep "^soak-stat" > "$log"
+ret=${PIPESTATUS[1]}
+rm -f "$stopme"
+if [ $ret -ne 0 ]; then
+  grep -A30 "ERROR\|WARNING" "$errors" | head -60
+  echo "soak: $shell exited with $ret"
+  rm -f "$log" "$errors"
+  exit 1
+fi
+rm -f "$errors"
+
+# The live heap can't grow past the checkpoint at the end of the warm-up.
+# The sanitizer allocator and quarantine take a while to fill, so the RSS
+# of the second half is compared with the peak of the first half
+stats=$(cat "$log")
+rm -f "$log"
+n=$(echo "$stats" | wc -l)
+base_live=$(echo "$stats" | head -1 | awk '{print $3}')
+base_rss=$(echo "$stats" | head -$(( (n + 1) / 2 )) | awk '{print $5}' |
+  sort -n | tail -1)
+fail=0
+k=0
+while read -r _ _ live _ rss _ tasks; do
+  k=$((k + 1))
+  if (( live > base_live + live_slack )); then
+    fail=1
+  fi
+  if (( k > (n + 1) / 2 && rss > base_rss + rss_slack )); then
+    fail=1
+  fi
+  echo "soak: live $live bytes, rss $rss kB, tasks $tasks"
+done <<< "$stats"
+
+if [ $fail -ne 0 ]; then
+  echo "soak: FAILED, memory grows (live $base_live bytes, rss $base_rss kB)"
+  exit 1
+fi
+echo "soak: $cycles cycles OK"
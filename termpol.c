@@ -0,0 +1,485 @@
+/**
+ * Linux Job Control Shell Project
+ * termpol module: how a job whose alarm expired is terminated
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * The policy is a list of signals, each with a grace period for the job to
+ * end before the next one (TERM, 5s, KILL by default), so a job can flush
+ * and clean up before it is killed. Every stage goes to the whole process
+ * group, and with sweep also to the descendants that left it, found before
+ * the signal from /proc/<pid>/task/<tid>/children, or from the parent pid
+ * in /proc/<pid>/stat on kernels without that file. Stopped processes are
+ * continued so that they see the signal.
+ *
+ * alarm-thread runs the stages on its thread and alarm-proc in its process,
+ * both waking up early when the job ends. alarm-signal can't wait in the
+ * handler: each SIGALRM sends the stage that is due and rearms the alarm
+ * for the next one. Everything here is async-signal-safe except the
+ * builtin, term_claim() and term_explain().
+ *
+ * The builtin never changes the policy in place: it publishes a new copy
+ * with an atomic pointer store, so an alarm-thread or the handler reading
+ * it sees either the old policy or the new one, never half of each. Old
+ * copies are not freed, as an alarm may still be running them; there is
+ * one per alarm-policy typed.
+ *
+ * The stages sent to a job are kept in slots of shared memory, since an
+ * alarm-proc process writes them too, and read back when the job is reaped
+ * to tell which stage ended it. The slot is taken at launch and freed when
+ * the job is reaped; an alarm still running after that finds no slot and
+ * records nothing, instead of taking one that nobody would free.
+ **/
+#include "termpol.h"
+#include "jobsched.h"
+#include "jobspec.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Record returned by the getdents64 system call */
+struct term_dirent {
+  unsigned long long ino;
+  long long off;
+  unsigned short reclen;
+  unsigned char type;
+  char name[];
+};
+
+static const term_policy default_policy = {
+    {{SIGTERM, TERM_GRACE_MS}, {SIGKILL, 0}}, 2, 0};
+static const term_policy *policy = &default_policy; /* Replaced, never changed */
+static term_slot *slots = NULL; /* Shared with the alarm-proc processes */
+
+// Builds /proc paths without stdio, which is not async-signal-safe
+static char *put_str(char *p, const char *str) {
+  while (*str)
+    *p++ = *str++;
+  *p = '\0';
+  return (p);
+}
+
+static char *put_int(char *p, long value) {
+  char digits[24];
+  int n = 0;
+
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (n)
+    *p++ = digits[--n];
+  *p = '\0';
+  return (p);
+}
+
+// Reads a small /proc file. Returns its length, -1 on error
+static int read_file(const char *path, char *buff, int size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  int len = 0;
+  ssize_t n;
+
+  if (fd == -1)
+    return (-1);
+  while (len < size - 1 && (n = read(fd, buff + len, size - 1 - len)) > 0)
+    len += n;
+  close(fd);
+  buff[len] = '\0';
+  return (len);
+}
+
+// Numeric entries of a /proc directory (opendir allocates, this does not).
+// Returns how many, -1 if it can't be opened
+static int list_pids(const char *dir, pid_t *pids, int max) {
+  char buff[4096];
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  int n = 0;
+  long len;
+
+  if (fd == -1)
+    return (-1);
+  while (n < max &&
+         (len = syscall(SYS_getdents64, fd, buff, sizeof(buff))) > 0) {
+    for (long off = 0; off < len && n < max;) {
+      struct term_dirent *d = (struct term_dirent *)(buff + off);
+      long value = 0;
+      char *c = d->name;
+      while (*c >= '0' && *c <= '9')
+        value = value * 10 + (*c++ - '0');
+      if (!*c && c != d->name)
+        pids[n++] = value;
+      off += d->reclen;
+    }
+  }
+  close(fd);
+  return (n);
+}
+
+// Appends the numbers in a list like "12 345 " to pids
+static int parse_pids(const char *str, pid_t *pids, int max) {
+  int n = 0;
+
+  while (*str && n < max) {
+    long value = 0;
+    if (*str < '0' || *str > '9') {
+      str++;
+      continue;
+    }
+    while (*str >= '0' && *str <= '9')
+      value = value * 10 + (*str++ - '0');
+    pids[n++] = value;
+  }
+  return (n);
+}
+
+// Children of every thread of pid. Returns how many, -1 when the kernel
+// has no children files
+static int children(pid_t pid, pid_t *out, int max) {
+  pid_t tids[64];
+  char path[64], buff[1024], *end;
+  int n = 0, n_tids;
+
+  end = put_int(put_str(path, "/proc/"), pid);
+  put_str(end, "/task");
+  n_tids = list_pids(path, tids, 64);
+  for (int i = 0; i < n_tids && n < max; i++) {
+    put_str(put_int(put_str(end, "/task/"), tids[i]), "/children");
+    if (read_file(path, buff, sizeof(buff)) == -1) {
+      if (errno == ENOENT && i == 0)
+        return (-1);
+      continue;
+    }
+    n += parse_pids(buff, out + n, max - n);
+  }
+  return (n);
+}
+
+// Parent of pid from /proc/<pid>/stat, after the command in parentheses
+static pid_t parent_of(pid_t pid) {
+  char path[64], buff[512], *p = NULL;
+
+  put_str(put_int(put_str(path, "/proc/"), pid), "/stat");
+  if (read_file(path, buff, sizeof(buff)) == -1)
+    return (0);
+  for (char *c = buff; *c; c++) {
+    if (*c == ')')
+      p = c;
+  }
+  // ") S ppid"
+  if (!p || !p[1] || !p[2] || !p[3])
+    return (0);
+  return (parse_pids(p + 4, &pid, 1) ? pid : 0);
+}
+
+// Descendants of pid, pid first, breadth first. Returns how many
+static int collect(pid_t pid, pid_t *out, int max) {
+  pid_t all[TERM_SCAN], parent[TERM_SCAN];
+  int n = 1, total;
+
+  out[0] = pid;
+  total = children(pid, out + 1, max - 1);
+  if (total != -1) {
+    n += total;
+    for (int i = 1; i < n && n < max; i++) {
+      int got = children(out[i], out + n, max - n);
+      if (got > 0)
+        n += got;
+    }
+    return (n);
+  }
+
+  // Without children files: one pass over /proc, then the same walk
+  total = list_pids("/proc", all, TERM_SCAN);
+  for (int k = 0; k < total; k++)
+    parent[k] = parent_of(all[k]);
+  for (int i = 0; i < n; i++) {
+    for (int k = 0; k < total && n < max; k++) {
+      if (parent[k] == out[i])
+        out[n++] = all[k];
+    }
+  }
+  return (n);
+}
+
+// Sends sig to the group and, with sweep, to the descendants out of it
+static void signal_tree(pid_t pgid, int sig, int sweep) {
+  pid_t tree[TERM_SWEEP];
+  int n = 0;
+
+  // Looked up first: once the leader dies its children are reparented
+  if (sweep)
+    n = collect(pgid, tree, TERM_SWEEP);
+  killpg(pgid, sig);
+  for (int i = 1; i < n; i++) {
+    if (getpgid(tree[i]) != pgid)
+      kill(tree[i], sig);
+  }
+  if (sig == SIGKILL || sig == SIGSTOP || sig == SIGCONT)
+    return;
+  killpg(pgid, SIGCONT);
+  for (int i = 1; i < n; i++) {
+    if (getpgid(tree[i]) != pgid)
+      kill(tree[i], SIGCONT);
+  }
+}
+
+static unsigned long long slot_tag(pid_t pgid, int sent, int sig) {
+  return ((unsigned long long)(unsigned int)pgid << 32 |
+          (unsigned int)sent << 8 | (sig & 0xff));
+}
+
+static pid_t tag_pgid(unsigned long long tag) { return (pid_t)(tag >> 32); }
+static int tag_sent(unsigned long long tag) { return (tag >> 8) & 0xffffff; }
+
+// Slot of pgid. NULL if none
+static term_slot *find_slot(pid_t pgid) {
+  if (!slots || pgid <= 0)
+    return NULL;
+  for (int i = 0; i < TERM_SLOTS; i++) {
+    if (tag_pgid(__atomic_load_n(&slots[i].tag, __ATOMIC_ACQUIRE)) == pgid)
+      return (&slots[i]);
+  }
+  return NULL;
+}
+
+// Sends one stage. It is recorded first: the job may be reaped before
+// kill() returns. Only while the slot still belongs to pgid
+static void send_stage(pid_t pgid, const char *command, const term_stage *st,
+                       int stage, int sweep) {
+  term_slot *slot = find_slot(pgid);
+
+  if (slot) {
+    unsigned long long tag = __atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE);
+    while (tag_pgid(tag) == pgid &&
+           !__atomic_compare_exchange_n(&slot->tag, &tag,
+                                        slot_tag(pgid, stage + 1, st->sig),
+                                        0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+      ;
+  }
+  trace_event(TRACE_ALARM, pgid, command, st->sig);
+  signal_tree(pgid, st->sig, sweep);
+}
+
+// Sleeps ms unless cancel_fd becomes readable or the group is gone.
+// Returns 1 if the wait was cut short
+static int wait_grace(pid_t pgid, int cancel_fd, int ms) {
+  struct pollfd pfd = {cancel_fd, POLLIN, 0};
+
+  while (ms > 0) {
+    int slice = ms < 100 ? ms : 100;
+    int ret = poll(&pfd, 1, slice);
+    if (ret > 0 || (ret == -1 && errno != EINTR))
+      return (1);
+    if (kill(-pgid, 0) == -1 && errno == ESRCH)
+      return (1);
+    ms -= slice;
+  }
+  return (0);
+}
+
+/**
+ * Shared slots for the stages sent, before any alarm-proc is forked.
+ * Returns -1 on error.
+ **/
+int term_init(void) {
+  slots = mmap(NULL, TERM_SLOTS * sizeof(term_slot), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (slots == MAP_FAILED) {
+    perror("Error at mmap");
+    slots = NULL;
+    return (-1);
+  }
+  return (0);
+}
+
+/**
+ * Takes the slot of a job launched with an alarm, before the alarm can
+ * fire. With every slot taken the job still gets its alarm, but
+ * alarm-signal sends the last stage right away and the report can't tell
+ * which stage ended it: that is printed here. Returns -1 in that case.
+ **/
+int term_claim(pid_t pgid) {
+  if (!slots || pgid <= 0)
+    return (-1);
+  if (find_slot(pgid))
+    return (0);
+  for (int i = 0; i < TERM_SLOTS; i++) {
+    unsigned long long free_slot = 0;
+    if (__atomic_compare_exchange_n(&slots[i].tag, &free_slot,
+                                    slot_tag(pgid, 0, 0), 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      return (0);
+  }
+  fprintf(stderr,
+          "Alarm of pid: %d has no slot (%d jobs with alarms), its policy "
+          "is not paced\n",
+          pgid, TERM_SLOTS);
+  return (-1);
+}
+
+/**
+ * Runs the whole policy on pgid, waiting out each grace period. Stops when
+ * the group is gone or cancel_fd (-1 for none) becomes readable. For
+ * alarm-thread and alarm-proc. Returns the stages sent.
+ **/
+int term_run(pid_t pgid, int cancel_fd) {
+  /* A new policy applies to the next alarms */
+  const term_policy run = *__atomic_load_n(&policy, __ATOMIC_ACQUIRE);
+  int i;
+
+  for (i = 0; i < run.n; i++) {
+    send_stage(pgid, NULL, &run.stage[i], i, run.sweep);
+    if (i + 1 < run.n &&
+        wait_grace(pgid, cancel_fd, run.stage[i].grace_ms))
+      return (i + 1);
+  }
+  return (i);
+}
+
+/**
+ * alarm-signal: sends the stage of pgid that is due, if any. Returns the
+ * seconds to the next one, 0 when there are no more. Safe in a handler.
+ **/
+int term_due(pid_t pgid, const char *command) {
+  const term_policy *run = __atomic_load_n(&policy, __ATOMIC_ACQUIRE);
+  term_slot *slot = find_slot(pgid);
+  time_t now = time(NULL);
+  int stage = slot ? tag_sent(__atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE))
+                   : 0;
+
+  if (stage >= run->n)
+    return (0);
+  if (stage > 0 && now < slot->next)
+    return (slot->next - now);
+  send_stage(pgid, command, &run->stage[stage], stage, run->sweep);
+  // No slot to pace the stages (term_claim() said so): the last one now
+  if (!slot) {
+    stage = run->n - 1;
+    send_stage(pgid, command, &run->stage[stage], stage, run->sweep);
+  }
+  if (stage + 1 >= run->n)
+    return (0);
+  slot->next = now + (run->stage[stage].grace_ms + 999) / 1000;
+  return ((run->stage[stage].grace_ms + 999) / 1000);
+}
+
+/**
+ * Stages already sent to pgid
+ **/
+int term_sent(pid_t pgid) {
+  term_slot *slot = find_slot(pgid);
+  return (slot ? tag_sent(__atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE))
+               : 0);
+}
+
+/**
+ * pgid was reaped: frees its slot. Returns a code for term_explain(), 0 if
+ * no stage was sent.
+ **/
+int term_forget(pid_t pgid) {
+  term_slot *slot = find_slot(pgid);
+  unsigned long long tag;
+
+  if (!slot)
+    return (0);
+  // An alarm-thread may record a stage meanwhile: the code is the last one
+  tag = __atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE);
+  while (tag_pgid(tag) == pgid &&
+         !__atomic_compare_exchange_n(&slot->tag, &tag, 0, 0,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    ;
+  if (tag_pgid(tag) != pgid)
+    return (0);
+  return ((int)(tag & 0xffffffff));
+}
+
+static const char *sig_name(int sig) {
+  const char *name = sigabbrev_np(sig);
+  return (name ? name : "?");
+}
+
+/**
+ * Text for the report of a job, given its term_forget() code and wait
+ * status: "" if no stage was sent
+ **/
+const char *term_explain(int code, int status) {
+  static char buff[64];
+  int sig = code & 0xff;
+
+  if (!code)
+    return "";
+  snprintf(buff, sizeof(buff), " (%s alarm stage %d: SIG%s)",
+           WIFSIGNALED(status) && WTERMSIG(status) == sig ? "killed at"
+                                                           : "ended after",
+           code >> 8, sig_name(sig));
+  return (buff);
+}
+
+static void print_policy(const term_policy *shown) {
+  printf("alarm-policy:");
+  for (int i = 0; i < shown->n; i++) {
+    int ms = shown->stage[i].grace_ms;
+    printf(" %s", sig_name(shown->stage[i].sig));
+    if (i + 1 == shown->n)
+      break;
+    if (ms % 1000)
+      printf(" %dms", ms);
+    else
+      printf(" %ds", ms / 1000);
+  }
+  printf(", sweep %s\n", shown->sweep ? "on" : "off");
+}
+
+/**
+ * alarm-policy [sweep | nosweep] [SIG [grace] SIG...]: signals sent to a
+ * job whose alarm expires, each followed by its grace period (TERM_GRACE_MS
+ * if not given). Without arguments prints the policy.
+ **/
+void term_builtin(char **args) {
+  term_policy next = *policy, *copy;
+  int i = 1, after_sig = 0;
+
+  if (!args[1]) {
+    print_policy(policy);
+    return;
+  }
+  if ((!strcmp(args[1], "sweep") || !strcmp(args[1], "nosweep")))
+    next.sweep = (args[i++][0] == 's');
+  if (args[i])
+    next.n = 0;
+  for (; args[i]; i++) {
+    long long ns;
+    // Signals go by name: a number is a grace period
+    int digit = args[i][0] >= '0' && args[i][0] <= '9';
+    int sig = digit ? -1 : spec_signal(args[i]);
+    if (sig > 0 && next.n < TERM_STAGES) {
+      next.stage[next.n].sig = sig;
+      next.stage[next.n++].grace_ms = TERM_GRACE_MS;
+      after_sig = 1;
+    } else if (digit && after_sig && parse_duration(args[i], &ns) != -1) {
+      next.stage[next.n - 1].grace_ms = ns / 1000000;
+      after_sig = 0;
+    } else {
+      printf("Usage: alarm-policy [sweep | nosweep] [SIG [grace] SIG...] "
+             "(at most %d signals)\n",
+             TERM_STAGES);
+      return;
+    }
+  }
+  // Published whole: alarm-threads and the handler may be reading it
+  copy = malloc(sizeof(*copy));
+  if (!copy) {
+    perror("Error at alarm-policy");
+    return;
+  }
+  *copy = next;
+  __atomic_store_n(&policy, copy, __ATOMIC_RELEASE);
+  print_policy(copy);
+}
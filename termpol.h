@@ -0,0 +1,52 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for termpol module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _TERMPOL_H
+#define _TERMPOL_H
+
+#include "job_control.h"
+
+#define TERM_STAGES 8      /* Signals in a policy */
+#define TERM_SLOTS 1024    /* Jobs with an alarm, until they are reaped */
+#define TERM_SWEEP 512     /* Descendants signalled per stage */
+#define TERM_SCAN 4096     /* Processes read from /proc without children */
+#define TERM_GRACE_MS 5000 /* Default wait between TERM and KILL */
+
+/* A signal and how long the job has to end before the next one */
+typedef struct term_stage_ {
+  int sig;
+  int grace_ms; /* Ignored for the last stage */
+} term_stage;
+
+typedef struct term_policy_ {
+  term_stage stage[TERM_STAGES];
+  int n;
+  int sweep; /* Also signal descendants that left the process group */
+} term_policy;
+
+/* Progress of the alarm of a job, shared with the alarm-proc processes */
+typedef struct term_slot_ {
+  /* pgid << 32 | stages sent << 8 | signal of the last one, 0 when free.
+   * One word, so a stage is never recorded in a slot taken by another job */
+  unsigned long long tag;
+  time_t next; /* When the next stage is due (alarm-signal) */
+} term_slot;
+
+/**
+ * Public Functions
+ **/
+int term_init(void);
+int term_claim(pid_t pgid);
+int term_run(pid_t pgid, int cancel_fd);
+int term_due(pid_t pgid, const char *command);
+int term_sent(pid_t pgid);
+int term_forget(pid_t pgid);
+const char *term_explain(int code, int status);
+void term_builtin(char **args);
+
+#endif
@@ -0,0 +1,268 @@
+/**
+ * Linux Job Control Shell Project
+ * trace module: job lifecycle timeline (--trace file / trace builtin)
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * Events are recorded from the prompt loop, signal handlers, alarm threads
+ * and even forked children (exec), so the ring lives in a MAP_SHARED mapping
+ * and is a bounded multi producer queue: every slot has a sequence number
+ * and producers claim slots with a CAS on the head. Nothing ever waits, a
+ * full ring drops the record and counts it. A writer thread drains the ring
+ * into a Chrome trace_event JSON file (or JSON lines if the file name ends
+ * with .jsonl).
+ **/
+#include "trace.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <time.h>
+
+typedef struct trace_shared_s {
+  unsigned int head;    /* Next slot to claim */
+  unsigned int dropped; /* Records lost because the ring was full */
+  trace_record_t slots[TRACE_RING_SIZE];
+} trace_shared_t;
+
+static trace_shared_t *shared = NULL; /* Mapped once, never unmapped */
+static unsigned int tail = 0;         /* Only used by the writer thread */
+static int active = 0;
+static volatile int stop_writer = 0;
+static pthread_t writer;
+static FILE *trace_file = NULL;
+static int json_lines = 0;
+static int first_record = 1;
+static pid_t shell_pid = 0;
+
+/**
+ * Records an event if tracing is on. Async-signal-safe and lock-free, it
+ * may be called from signal handlers, threads and forked children.
+ **/
+void trace_event(enum trace_kind kind, pid_t pgid, const char *command,
+                 int info) {
+  trace_record_t *rec;
+  struct timespec ts;
+  unsigned int pos;
+  int i;
+
+  if (!__atomic_load_n(&active, __ATOMIC_ACQUIRE))
+    return;
+  pos = __atomic_load_n(&shared->head, __ATOMIC_RELAXED);
+  for (;;) {
+    rec = &shared->slots[pos & (TRACE_RING_SIZE - 1)];
+    int diff = (int)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&shared->head, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      __atomic_add_fetch(&shared->dropped, 1, __ATOMIC_RELAXED);
+      return;
+    } else {
+      pos = __atomic_load_n(&shared->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  rec->kind = kind;
+  rec->pgid = pgid;
+  rec->pid = getpid();
+  rec->info = info;
+  rec->ts_ns = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  for (i = 0; command && command[i] && i < TRACE_CMD_LEN - 1; i++)
+    rec->command[i] = command[i];
+  rec->command[i] = '\0';
+
+  // If the writer gave up on this slot (see drain_ring) the record is lost
+  unsigned int expected = pos;
+  __atomic_compare_exchange_n(&rec->seq, &expected, pos + 1, 0,
+                              __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+static void json_command(const char *command) {
+  for (; *command; command++) {
+    if (*command == '"' || *command == '\\')
+      fputc('\\', trace_file);
+    if ((unsigned char)*command >= 0x20)
+      fputc(*command, trace_file);
+  }
+}
+
+static void write_record(trace_record_t *rec) {
+  double ts_us = rec->ts_ns / 1000.0;
+
+  if (json_lines) {
+    fprintf(trace_file, "{\"ts_us\":%.3f,\"event\":\"%s\",\"pgid\":%d,"
+            "\"pid\":%d,\"info\":%d,\"command\":\"",
+            ts_us, trace_strings[rec->kind], rec->pgid, rec->pid, rec->info);
+    json_command(rec->command);
+    fputs("\"}\n", trace_file);
+    return;
+  }
+
+  // One row (tid) per job: fork..exit is a span, the rest are instants
+  fputs(first_record ? "" : ",\n", trace_file);
+  first_record = 0;
+  fputs("{\"name\":\"", trace_file);
+  if (rec->kind == TRACE_FORK || rec->kind == TRACE_EXIT)
+    json_command(rec->command);
+  else
+    fputs(trace_strings[rec->kind], trace_file);
+  fprintf(trace_file, "\",\"cat\":\"job\",\"ph\":\"%s\",\"ts\":%.3f,"
+          "\"pid\":%d,\"tid\":%d,\"args\":{\"event\":\"%s\",\"pgid\":%d,"
+          "\"pid\":%d,\"info\":%d,\"command\":\"",
+          rec->kind == TRACE_FORK ? "B" : rec->kind == TRACE_EXIT ? "E" : "i",
+          ts_us, shell_pid, rec->pgid, trace_strings[rec->kind], rec->pgid,
+          rec->pid, rec->info);
+  json_command(rec->command);
+  fputs(rec->kind == TRACE_FORK || rec->kind == TRACE_EXIT ? "\"}}"
+                                                           : "\"},\"s\":\"t\"}",
+        trace_file);
+}
+
+// Writes every published record. A producer that was killed between
+// claiming a slot and publishing it (a child right after fork) would stall
+// the ring forever, so such a slot is skipped after a second.
+static int drain_ring(void) {
+  static long long stuck_since = 0;
+  int n = 0;
+
+  for (;;) {
+    trace_record_t *rec = &shared->slots[tail & (TRACE_RING_SIZE - 1)];
+    unsigned int seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == tail + 1) {
+      write_record(rec);
+    } else if (tail != __atomic_load_n(&shared->head, __ATOMIC_RELAXED)) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      long long now = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+      if (!stuck_since)
+        stuck_since = now;
+      if (now - stuck_since < 1000000000LL)
+        break;
+      unsigned int expected = tail;
+      if (!__atomic_compare_exchange_n(&rec->seq, &expected,
+                                       tail + TRACE_RING_SIZE, 0,
+                                       __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        continue; // Published just now
+      __atomic_add_fetch(&shared->dropped, 1, __ATOMIC_RELAXED);
+      stuck_since = 0;
+      tail++;
+      continue;
+    } else {
+      break;
+    }
+    stuck_since = 0;
+    __atomic_store_n(&rec->seq, tail + TRACE_RING_SIZE, __ATOMIC_RELEASE);
+    tail++;
+    n++;
+  }
+  if (n)
+    fflush(trace_file);
+  return (n);
+}
+
+static void *writer_main(void *arg) {
+  struct timespec period = {0, TRACE_FLUSH_MS * 1000000L};
+
+  while (!stop_writer) {
+    if (!drain_ring())
+      nanosleep(&period, NULL);
+  }
+  drain_ring();
+  return NULL;
+}
+
+static void trace_atexit(void) {
+  // Children that fail to exec also run atexit handlers
+  if (getpid() == shell_pid)
+    trace_stop();
+}
+
+/**
+ * Starts recording into path. Returns -1 on error.
+ **/
+int trace_start(const char *path) {
+  sigset_t all, old;
+
+  if (active) {
+    fprintf(stderr, "Trace already running\n");
+    return (-1);
+  }
+  if (!shared) {
+    shared = mmap(NULL, sizeof(trace_shared_t), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+      perror("Error at mmap");
+      shared = NULL;
+      return (-1);
+    }
+    for (unsigned int i = 0; i < TRACE_RING_SIZE; i++)
+      shared->slots[i].seq = i;
+    shell_pid = getpid();
+    atexit(trace_atexit);
+  }
+  trace_file = fopen(path, "w");
+  if (!trace_file) {
+    perror("Error opening trace file");
+    return (-1);
+  }
+  setvbuf(trace_file, NULL, _IOFBF, 1 << 16);
+  json_lines = strlen(path) > 6 && !strcmp(path + strlen(path) - 6, ".jsonl");
+  first_record = 1;
+  if (!json_lines)
+    fputs("[\n", trace_file);
+  __atomic_store_n(&shared->dropped, 0, __ATOMIC_RELAXED);
+
+  // Signals must keep running on the main thread, never on the writer
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  stop_writer = 0;
+  if (pthread_create(&writer, NULL, writer_main, NULL)) {
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    perror("Error at pthread_create");
+    fclose(trace_file);
+    return (-1);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  __atomic_store_n(&active, 1, __ATOMIC_RELEASE);
+  return (0);
+}
+
+/**
+ * Stops recording and closes the trace file
+ **/
+void trace_stop(void) {
+  if (!active)
+    return;
+  __atomic_store_n(&active, 0, __ATOMIC_RELEASE);
+  stop_writer = 1;
+  pthread_join(writer, NULL);
+  if (!json_lines)
+    fputs("\n]\n", trace_file);
+  fclose(trace_file);
+  trace_file = NULL;
+  if (shared->dropped)
+    fprintf(stderr, "Trace: %u events dropped\n", shared->dropped);
+}
+
+/**
+ * trace <file>  --> starts recording (.jsonl for JSON lines)
+ * trace off     --> stops recording
+ * trace         --> shows whether it is recording
+ **/
+void trace_builtin(char **args) {
+  if (!args[1]) {
+    if (active)
+      printf("Tracing, %u events dropped\n", shared->dropped);
+    else
+      printf("Not tracing\n");
+  } else if (!strcmp(args[1], "off")) {
+    trace_stop();
+  } else {
+    trace_start(args[1]);
+  }
+}
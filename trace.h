@@ -0,0 +1,55 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for trace module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "job_control.h"
+
+#define TRACE_RING_SIZE 16384 /* Must be a power of two */
+#define TRACE_CMD_LEN 32      /* Command name kept in each record */
+#define TRACE_FLUSH_MS 20     /* Writer thread period when idle */
+
+/**
+ * Enumerations
+ **/
+enum trace_kind {
+  TRACE_FORK,
+  TRACE_EXEC,
+  TRACE_STOP,
+  TRACE_CONTINUE,
+  TRACE_FG,
+  TRACE_BG,
+  TRACE_ALARM,
+  TRACE_RELAUNCH,
+  TRACE_EXIT
+};
+static char *trace_strings[] = {"fork", "exec",  "stop",     "continue", "fg",
+                                "bg",   "alarm", "relaunch", "exit"};
+
+/* Slot of the multi producer ring (bounded queue with sequence numbers) */
+typedef struct trace_record_s {
+  unsigned int seq;
+  enum trace_kind kind;
+  pid_t pgid;
+  pid_t pid; /* Process that recorded it (the child for exec) */
+  int info;
+  long long ts_ns; /* CLOCK_MONOTONIC */
+  char command[TRACE_CMD_LEN];
+} trace_record_t;
+
+/**
+ * Public Functions
+ **/
+int trace_start(const char *path);
+void trace_stop(void);
+void trace_event(enum trace_kind kind, pid_t pgid, const char *command,
+                 int info);
+void trace_builtin(char **args);
+
+#endif
@@ -0,0 +1,241 @@
+/**
+ * Linux Job Control Shell Project
+ * wildcard module: * ? and [...] expansion of words
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * A pattern is matched one path component at a time, against sorted
+ * directory listings. A batch of commands keeps globbing the same
+ * directories, so the listings are cached by device and inode (not by
+ * path: "." is another directory after a cd). A listing is used
+ * while the mtime of the directory is the one it was read with, at the
+ * cost of a stat. When the mtime is too close to the read time, a change
+ * within the same timestamp tick could hide, and the listing is read
+ * again. Listings not used for WILD_TTL_NS are dropped, and the least
+ * recently used one makes room when the cache is full.
+ *
+ * As in sh, a word that matches nothing is left as it is, and names
+ * starting with '.' only match a pattern that starts with '.'.
+ **/
+#include "wildcard.h"
+
+#include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static wild_dir *cache[WILD_CACHE];
+static int n_cache = 0;
+
+static long long clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+static int cmp_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void free_dir(wild_dir *dir) {
+  for (int i = 0; i < dir->n; i++)
+    free(dir->names[i]);
+  free(dir->names);
+  free(dir);
+}
+
+static void drop(int i) {
+  cache[i]->cached = 0;
+  if (!cache[i]->pinned)
+    free_dir(cache[i]);
+  cache[i] = cache[--n_cache];
+}
+
+// Sorted names of path, without . and ..
+static wild_dir *read_dir(const char *path) {
+  wild_dir *dir = (wild_dir *)calloc(1, sizeof(wild_dir));
+  struct dirent *ent;
+  int cap = 0;
+  DIR *d;
+
+  if (!dir) {
+    perror("Error at calloc");
+    return NULL;
+  }
+  d = opendir(path);
+  if (!d) {
+    free_dir(dir);
+    return NULL;
+  }
+  while ((ent = readdir(d))) {
+    if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+      continue;
+    if (dir->n == cap) {
+      cap = cap ? cap * 2 : 32;
+      char **aux = (char **)realloc(dir->names, cap * sizeof(char *));
+      if (!aux)
+        break;
+      dir->names = aux;
+    }
+    if (!(dir->names[dir->n] = strdup(ent->d_name)))
+      break;
+    dir->n++;
+  }
+  closedir(d);
+  qsort(dir->names, dir->n, sizeof(char *), cmp_names);
+  return (dir);
+}
+
+// Listing of path, from the cache while the directory is unchanged. It is
+// pinned until release()
+static wild_dir *listing(const char *path) {
+  long long mono = clock_ns(CLOCK_MONOTONIC), mtime;
+  wild_dir *dir;
+  struct stat st;
+  int i, lru = -1;
+
+  for (i = 0; i < n_cache;) {
+    if (!cache[i]->pinned && mono - cache[i]->used_ns > WILD_TTL_NS)
+      drop(i);
+    else
+      i++;
+  }
+  if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode))
+    return NULL;
+  mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  for (i = 0; i < n_cache; i++) {
+    if (cache[i]->dev != st.st_dev || cache[i]->ino != st.st_ino)
+      continue;
+    dir = cache[i];
+    if (dir->mtime.tv_sec == st.st_mtim.tv_sec &&
+        dir->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+        mtime + WILD_RACY_NS < dir->read_ns) {
+      dir->used_ns = mono;
+      dir->pinned++;
+      return (dir);
+    }
+    drop(i);
+    break;
+  }
+
+  // Read before the time is taken: a change after this stat shows later
+  // as a newer mtime
+  dir = read_dir(path);
+  if (!dir)
+    return NULL;
+  dir->dev = st.st_dev;
+  dir->ino = st.st_ino;
+  dir->mtime = st.st_mtim;
+  dir->read_ns = clock_ns(CLOCK_REALTIME);
+  dir->used_ns = mono;
+  dir->pinned = 1;
+  if (n_cache == WILD_CACHE) {
+    for (i = 0; i < n_cache; i++) {
+      if (!cache[i]->pinned &&
+          (lru == -1 || cache[i]->used_ns < cache[lru]->used_ns))
+        lru = i;
+    }
+    if (lru == -1)
+      return (dir); // Every one is being walked, this one is not kept
+    drop(lru);
+  }
+  dir->cached = 1;
+  cache[n_cache++] = dir;
+  return (dir);
+}
+
+static void release(wild_dir *dir) {
+  if (--dir->pinned == 0 && !dir->cached)
+    free_dir(dir);
+}
+
+/**
+ * Does the word hold a pattern (* ? or a closed [...])?
+ **/
+int wild_has_magic(const char *word) {
+  for (; *word; word++) {
+    if (*word == '*' || *word == '?')
+      return (1);
+    if (*word == '[' && strchr(word + 1, ']'))
+      return (1);
+  }
+  return (0);
+}
+
+// Matches the components in rest below path (len chars already there)
+static int expand_from(char *path, size_t len, const char *rest,
+                       void (*add)(char *path, void *data), void *data) {
+  const char *slash = strchr(rest, '/');
+  size_t comp_len = slash ? (size_t)(slash - rest) : strlen(rest);
+  char comp[NAME_MAX + 1];
+  wild_dir *dir;
+  int n = 0, all;
+
+  if (comp_len > NAME_MAX || len + comp_len + 2 > PATH_MAX)
+    return (0);
+  memcpy(comp, rest, comp_len);
+  comp[comp_len] = '\0';
+
+  // a/b: nothing to match, the path just gets longer
+  if (!wild_has_magic(comp)) {
+    struct stat st;
+    memcpy(path + len, comp, comp_len + 1);
+    len += comp_len;
+    if (slash) {
+      path[len++] = '/';
+      path[len] = '\0';
+      return expand_from(path, len, slash + 1, add, data);
+    }
+    if (lstat(path, &st) == -1)
+      return (0);
+    add(strdup(path), data);
+    return (1);
+  }
+
+  dir = listing(len ? path : ".");
+  if (!dir)
+    return (0);
+  // A lone * (the usual case) takes every name not starting with '.'
+  all = !strcmp(comp, "*");
+  for (int i = 0; i < dir->n; i++) {
+    const char *name = dir->names[i];
+    size_t name_len = strlen(name);
+    if (all ? name[0] == '.' : fnmatch(comp, name, FNM_PERIOD) != 0)
+      continue;
+    if (len + name_len + 2 > PATH_MAX)
+      continue;
+    memcpy(path + len, name, name_len + 1);
+    if (!slash) {
+      add(strdup(path), data);
+      n++;
+      continue;
+    }
+    path[len + name_len] = '/';
+    path[len + name_len + 1] = '\0';
+    n += expand_from(path, len + name_len + 1, slash + 1, add, data);
+  }
+  path[len] = '\0';
+  release(dir);
+  return (n);
+}
+
+/**
+ * Calls add with every path that matches pattern (strings to free), in
+ * order. Returns how many there were.
+ **/
+int wild_expand(const char *pattern, void (*add)(char *path, void *data),
+                void *data) {
+  char path[PATH_MAX];
+  size_t len = 0;
+
+  path[0] = '\0';
+  while (*pattern == '/') {
+    path[len++] = '/';
+    path[len] = '\0';
+    pattern++;
+  }
+  return expand_from(path, len, pattern, add, data);
+}
@@ -0,0 +1,38 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for wildcard module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _WILDCARD_H
+#define _WILDCARD_H
+
+#include "job_control.h"
+
+#define WILD_CACHE 64          /* Directory listings kept */
+#define WILD_TTL_NS 5000000000LL /* Unused listings are dropped after 5s */
+#define WILD_RACY_NS 1000000000LL /* mtime this close to the read: reread */
+
+/* Listing of a directory, sorted */
+typedef struct wild_dir_ {
+  dev_t dev; /* Device and inode of the directory */
+  ino_t ino;
+  struct timespec mtime; /* Of the directory when it was read */
+  long long read_ns;     /* CLOCK_REALTIME of the read */
+  long long used_ns;     /* CLOCK_MONOTONIC of the last lookup */
+  int n;
+  char **names;
+  int pinned; /* Being walked, can't be dropped */
+  int cached; /* In the cache, freed by it */
+} wild_dir;
+
+/**
+ * Public Functions
+ **/
+int wild_has_magic(const char *word);
+int wild_expand(const char *pattern, void (*add)(char *path, void *data),
+                void *data);
+
+#endif
@@ -0,0 +1,273 @@
+/**
+ * Linux Job Control Shell Project
+ * zredir module: compressed output redirection (>z file, >>z file)
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ *
+ * The job writes into a pipe and a thread of the shell deflates it into the
+ * file. Every ZREDIR_BLOCK bytes (or after ZREDIR_FLUSH_MS without output)
+ * the pending data is written as a complete gzip member. Concatenated
+ * members are a valid gzip file (zcat reads them all), so >>z just appends
+ * members and a crash loses at most the block being filled.
+ *
+ * Without zlib (the Makefile defines HAVE_ZLIB when it finds it) >z is
+ * refused before the job is launched.
+ **/
+#include "zredir.h"
+#include "event_loop.h"
+#include "jobsched.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef HAVE_ZLIB
+#include <sys/eventfd.h>
+#include <zlib.h>
+
+static zstream *streams = NULL;
+
+// write() all of buff, returns -1 on error
+static int write_all(int fd, const unsigned char *buff, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buff, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return (-1);
+    buff += n;
+    len -= n;
+  }
+  return (0);
+}
+
+// Deflates len bytes of in as one gzip member and writes it
+static void write_block(zstream *z, z_stream *zs, unsigned char *in, int len,
+                        unsigned char *out, int out_size) {
+  deflateReset(zs);
+  zs->next_in = in;
+  zs->avail_in = len;
+  zs->next_out = out;
+  zs->avail_out = out_size;
+  // out_size comes from deflateBound, a single call always completes
+  deflate(zs, Z_FINISH);
+  // After a write error keep draining the pipe so the job is not blocked
+  if (!z->error && write_all(z->out_fd, out, out_size - zs->avail_out) == -1)
+    z->error = errno;
+  z->bytes_out += out_size - zs->avail_out;
+  z->blocks++;
+}
+
+static void *compressor_main(void *arg) {
+  zstream *z = (zstream *)arg;
+  unsigned char *in = (unsigned char *)malloc(ZREDIR_BLOCK);
+  unsigned char *out = NULL;
+  char discard[4096];
+  struct pollfd pfd = {z->pipe_r, POLLIN, 0};
+  z_stream zs;
+  int out_size = 0;
+  int len = 0;
+  uint64_t one = 1;
+
+  memset(&zs, 0, sizeof(zs));
+  // windowBits 15 + 16: gzip header and trailer instead of zlib ones
+  if (in && deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) == Z_OK) {
+    out_size = deflateBound(&zs, ZREDIR_BLOCK);
+    out = (unsigned char *)malloc(out_size);
+  }
+  if (!out)
+    z->error = ENOMEM;
+
+  for (;;) {
+    ssize_t n;
+    int ready = poll(&pfd, 1, len ? ZREDIR_FLUSH_MS : -1);
+    if (ready == -1 && errno == EINTR)
+      continue;
+    if (ready == 0) {
+      // The job is quiet, don't keep its last lines only in memory
+      write_block(z, &zs, in, len, out, out_size);
+      len = 0;
+      continue;
+    }
+    // Without buffers the output is just drained
+    if (out)
+      n = read(z->pipe_r, in + len, ZREDIR_BLOCK - len);
+    else
+      n = read(z->pipe_r, discard, sizeof(discard));
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    z->bytes_in += n;
+    if (!out)
+      continue;
+    len += n;
+    if (len == ZREDIR_BLOCK) {
+      write_block(z, &zs, in, len, out, out_size);
+      len = 0;
+    }
+  }
+  if (out && len)
+    write_block(z, &zs, in, len, out, out_size);
+  if (out)
+    deflateEnd(&zs);
+  free(in);
+  free(out);
+  close(z->out_fd);
+  close(z->pipe_r);
+  z->end_ns = monotonic_ns();
+  // Tells the prompt loop the stream is finished
+  if (write(z->done_fd, &one, sizeof(one)) == -1)
+    perror("Error at eventfd write");
+  return NULL;
+}
+
+// The compressor thread ended: report and free the stream
+static void stream_done(int fd, short revents, void *data) {
+  zstream *z = (zstream *)data;
+  zstream **aux = &streams;
+  double secs;
+  uint64_t value;
+
+  if (read(fd, &value, sizeof(value)) == -1 && errno == EAGAIN)
+    return;
+  pthread_join(z->thread, NULL);
+  loop_unwatch_fd(z->done_fd);
+  close(z->done_fd);
+  while (*aux && *aux != z)
+    aux = &(*aux)->next;
+  if (*aux)
+    *aux = z->next;
+
+  secs = (z->end_ns - z->start_ns) / 1e9;
+  loop_print_begin();
+  if (z->error)
+    printf("Compressed output of pid: %d, command: %s, to %s failed: %s\n",
+           z->pid, z->command, z->path, strerror(z->error));
+  else
+    printf("Compressed output of pid: %d, command: %s, to %s: %llu -> %llu "
+           "bytes, ratio %.2f:1, %.2f MB/s, %llu blocks\n",
+           z->pid, z->command, z->path, z->bytes_in, z->bytes_out,
+           z->bytes_out ? (double)z->bytes_in / z->bytes_out : 0.0,
+           secs > 0 ? z->bytes_in / secs / 1e6 : 0.0, z->blocks);
+  loop_print_end();
+  free(z->command);
+  free(z->path);
+  free(z);
+}
+
+/**
+ * Opens (truncates, or appends to with append) the file and creates the pipe
+ * for a >z redirection. The child must dup2 pipe_w into its stdout. Returns
+ * NULL on error.
+ **/
+zstream *zredir_open(const char *path, int append) {
+  // Always O_APPEND: members of jobs writing the same file never overlap
+  int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+  int fds[2];
+  zstream *z = (zstream *)calloc(1, sizeof(zstream));
+
+  if (!append)
+    flags |= O_TRUNC;
+  if (!z) {
+    perror("Error at calloc");
+    return NULL;
+  }
+  z->out_fd = open(path, flags, 0666);
+  if (z->out_fd == -1) {
+    perror("Error opening out file");
+    free(z);
+    return NULL;
+  }
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    perror("Error at pipe");
+    close(z->out_fd);
+    free(z);
+    return NULL;
+  }
+  z->pipe_r = fds[0];
+  z->pipe_w = fds[1];
+  z->done_fd = -1;
+  z->path = strdup(path);
+  return z;
+}
+
+/**
+ * Called by the parent after fork: closes its copy of the write end and
+ * starts the compressor thread. Returns -1 on error (the job's output is
+ * lost then, the job gets SIGPIPE).
+ **/
+int zredir_start(zstream *z, pid_t pid, const char *command) {
+  sigset_t all, old;
+
+  close(z->pipe_w);
+  z->pipe_w = -1;
+  z->pid = pid;
+  z->command = strdup(command);
+  z->start_ns = monotonic_ns();
+  z->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (z->done_fd == -1) {
+    perror("Error at eventfd");
+    goto error;
+  }
+  // Watched before the thread exists: nobody would join an unwatched one
+  if (loop_watch_fd(z->done_fd, POLLIN, stream_done, z) == -1) {
+    fprintf(stderr, "Error: no room in the event loop for >z of pid: %d\n",
+            pid);
+    close(z->done_fd);
+    goto error;
+  }
+  // Signals must keep running on the main thread, never on the compressor
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  if (pthread_create(&z->thread, NULL, compressor_main, z)) {
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    perror("Error at pthread_create");
+    loop_unwatch_fd(z->done_fd);
+    close(z->done_fd);
+    goto error;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  z->next = streams;
+  streams = z;
+  return (0);
+
+error:
+  close(z->pipe_r);
+  close(z->out_fd);
+  free(z->command);
+  free(z->path);
+  free(z);
+  return (-1);
+}
+
+/**
+ * Releases a stream whose job could not be launched
+ **/
+void zredir_abort(zstream *z) {
+  if (z->pipe_w != -1)
+    close(z->pipe_w);
+  close(z->pipe_r);
+  close(z->out_fd);
+  free(z->path);
+  free(z);
+}
+
+#else /* !HAVE_ZLIB */
+
+/**
+ * Built without zlib: always NULL, the job is not launched
+ **/
+zstream *zredir_open(const char *path, int append) {
+  fprintf(stderr, "Error: %s %s needs zlib, the shell was built without it\n",
+          append ? ">>z" : ">z", path);
+  return NULL;
+}
+
+int zredir_start(zstream *z, pid_t pid, const char *command) { return (-1); }
+
+void zredir_abort(zstream *z) {}
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * Linux Job Control Shell Project
+ * Function prototypes and type declarations for zredir module
+ *
+ * Operating Systems
+ * Grados Ing. Informatica & Software
+ * Dept. de Arquitectura de Computadores - UMA
+ **/
+#ifndef _ZREDIR_H
+#define _ZREDIR_H
+
+#include "job_control.h"
+
+#define ZREDIR_BLOCK (128 * 1024) /* Input bytes per gzip member */
+#define ZREDIR_FLUSH_MS 1000      /* Idle time before writing a partial block */
+
+/* stdout of a job compressed by a thread of the shell (>z / >>z) */
+typedef struct zstream_ {
+  pthread_t thread;
+  int pipe_r; /* Read end, the job writes into pipe_w */
+  int pipe_w;
+  int out_fd;  /* Compressed file */
+  int done_fd; /* eventfd, written by the thread once the pipe is closed */
+  pid_t pid;
+  char *command;
+  char *path;
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+  unsigned long long blocks;
+  long long start_ns;
+  long long end_ns;
+  int error; /* errno of the first failed write, 0 if none */
+  struct zstream_ *next;
+} zstream;
+
+/**
+ * Public Functions
+ **/
+zstream *zredir_open(const char *path, int append);
+int zredir_start(zstream *z, pid_t pid, const char *command);
+void zredir_abort(zstream *z);
+
+#endif